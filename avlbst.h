@@ -6,6 +6,9 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
 #include "bst.h"
 
 struct KeyError { };
@@ -19,9 +22,10 @@ template <typename Key, typename Value>
 class AVLNode : public Node<Key, Value>
 {
 public:
-    // Constructor/destructor.
+    // Constructors.
     AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    template<typename... Args>
+    AVLNode(AVLNode<Key, Value>* parent, Args&&... args);
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
@@ -29,11 +33,11 @@ public:
     void updateBalance(int8_t diff);
 
     // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    // return pointers to AVLNodes - not plain Nodes. They hide (rather than
+    // override) the Node versions; see the Node class in bst.h for more information.
+    AVLNode<Key, Value>* getParent() const;
+    AVLNode<Key, Value>* getLeft() const;
+    AVLNode<Key, Value>* getRight() const;
 
 protected:
     int8_t balance_;    // effectively a signed char
@@ -56,10 +60,12 @@ AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Va
 }
 
 /**
-* A destructor which does nothing.
+* Constructs the item in place from args; see the matching Node constructor.
 */
 template<class Key, class Value>
-AVLNode<Key, Value>::~AVLNode()
+template<typename... Args>
+AVLNode<Key, Value>::AVLNode(AVLNode<Key, Value>* parent, Args&&... args) :
+    Node<Key, Value>(parent, std::forward<Args>(args)...), balance_(0)
 {
 
 }
@@ -92,8 +98,8 @@ void AVLNode<Key, Value>::updateBalance(int8_t diff)
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* A redefined getter for the parent. The static_cast is safe because an AVLTree
+* only ever links AVLNodes together.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
@@ -102,7 +108,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
@@ -111,7 +117,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
@@ -127,72 +133,163 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 */
 
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+
+
+/**
+* A height-balanced (AVL) binary search tree.
+*
+* split, join and the set operations hand whole subtrees from one tree
+* to the other when the two trees' allocators compare equal, i.e. when
+* either can free the other's nodes: always for std::allocator, and for
+* SlabAllocators that share a pool. Otherwise, as for two trees on
+* SlabAllocators with pools of their own, the items that change trees
+* are copied into nodes from the receiving tree's allocator and the
+* originals are freed by their own tree, which adds O(m) for the m
+* items moved.
+*
+* NodeType is AVLNode unless a tree needs more from its nodes, as
+* ConcurrentAVLTree does; it must derive from AVLNode and redefine the
+* link getters to return its own type.
+*/
+template <class Key, class Value,
+          class Compare = std::less<Key>,
+          class Alloc = std::allocator<std::pair<const Key, Value> >,
+          class NodeType = AVLNode<Key, Value> >
+class AVLTree : public BinarySearchTree<Key, Value, Compare, Alloc, NodeType>
 {
 public:
-    virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
+    AVLTree();
+    explicit AVLTree(const Compare& comp);
+    AVLTree(const Compare& comp, const Alloc& alloc);
+    template<typename ForwardIt>
+    AVLTree(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
+
     virtual void remove(const Key& key);  // TODO
+
+    // Moving whole subtrees between trees (see the class comment for
+    // trees whose allocators differ). The set operations consume other,
+    // which is left empty, and keep this tree's value where both hold a
+    // key. threads caps the number of threads used, 0 meaning one per
+    // hardware thread.
+    void split(const Key& key, AVLTree& greater);
+    void join(AVLTree& right);
+    void setUnion(AVLTree& other, unsigned threads = 0);
+    void setIntersection(AVLTree& other, unsigned threads = 0);
+    void setDifference(AVLTree& other, unsigned threads = 0);
+
+    // Set operations on fewer nodes than this run on a single thread
+    static const size_t ParallelGrain = 1 << 15;
 protected:
-    virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    virtual void nodeSwap( NodeType* n1, NodeType* n2);
+    virtual void afterInsert(NodeType* node);
 
     // Add helper functions here
-    void rotateLeft(AVLNode<Key,Value>* x);
-    void rotateRight(AVLNode<Key,Value>* x);
-    void updateBalanceFromChildren(AVLNode<Key,Value>* node);
-    void rebalanceAt(AVLNode<Key,Value>* node);
+    void rotateLeft(NodeType* x);
+    void rotateRight(NodeType* x);
+    void insertFix(NodeType* p, NodeType* n);
+    void removeFix(NodeType* n, int8_t diff);
+    virtual const char* verifyNode(NodeType* node, int leftHeight, int rightHeight) const;
+    virtual void initBuiltNode(NodeType* node, int leftHeight, int rightHeight);
+
+    // Nodes dropped by a set operation, chained through their parent
+    // pointers and destroyed once the result is built
+    struct DiscardList
+    {
+        NodeType* head;
+        NodeType* tail;
+
+        DiscardList() : head(NULL), tail(NULL) { }
+        void push(NodeType* node);
+        void splice(DiscardList& other);
+    };
+
+    // Join-based helpers. They work on detached subtrees whose heights
+    // are passed along, and return the new subtree's root with its
+    // height in h; the root's parent pointer is left for the caller.
+    static int subtreeHeight(NodeType* node);
+    static void childHeights(NodeType* node, int h, int& leftHeight, int& rightHeight);
+    NodeType* attach(NodeType* l, int hl, NodeType* k, NodeType* r, int hr, int& h);
+    NodeType* rotateSubtreeLeft(NodeType* x, int hx, int& h);
+    NodeType* rotateSubtreeRight(NodeType* x, int hx, int& h);
+    NodeType* joinRight(NodeType* l, int hl, NodeType* k, NodeType* r, int hr, int& h);
+    NodeType* joinLeft(NodeType* l, int hl, NodeType* k, NodeType* r, int hr, int& h);
+    NodeType* joinNodes(NodeType* l, int hl, NodeType* k, NodeType* r, int hr, int& h);
+    NodeType* joinNodes(NodeType* l, int hl, NodeType* r, int hr, int& h);
+    NodeType* splitLast(NodeType* t, int ht, NodeType*& last, int& h);
+    NodeType* splitNodes(NodeType* t, int ht, const Key& key,
+                         NodeType*& l, int& hl, NodeType*& r, int& hr);
+    NodeType* unionNodes(NodeType* a, int ha, NodeType* b, int hb,
+                         int& h, DiscardList& discard, int forks);
+    NodeType* intersectNodes(NodeType* a, int ha, NodeType* b, int hb,
+                             int& h, DiscardList& discard, int forks);
+    NodeType* differenceNodes(NodeType* a, int ha, NodeType* b, int hb,
+                              int& h, DiscardList& discard, int forks);
+    bool sharesAllocator(const AVLTree& other) const;
+    NodeType* copyItems(NodeType* first, size_t count, int& h);
+    NodeType* takeNodes(AVLTree& other, int& h);
+    void setRoot(NodeType* root);
+    void releaseDiscarded(DiscardList& discard);
+    bool shouldFork(NodeType* a, NodeType* b, int forks) const;
+    static int forkLevels(unsigned threads);
+    template<typename Left, typename Right>
+    static void forkJoin(bool fork, Left left, Right right);
 };
 
-/*
- * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
- */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+AVLTree<Key, Value, Compare, Alloc, NodeType>::AVLTree()
 {
-    
-    if(this->root_ == NULL) {
-        this->root_ = new AVLNode<Key,Value>(new_item.first, new_item.second, NULL);
-        return;
-    }
 
-    
-    AVLNode<Key,Value>* curr = static_cast<AVLNode<Key,Value>*>(this->root_);
-    AVLNode<Key,Value>* parent = NULL;
-
-    while(curr != NULL) {
-        parent = curr;
-        if(new_item.first == curr->getKey()) {
-            
-            curr->setValue(new_item.second);
-            return;
-        }
-        else if(new_item.first < curr->getKey()) {
-            curr = curr->getLeft();
-        }
-        else {
-            curr = curr->getRight();
-        }
-    }
+}
 
-    AVLNode<Key,Value>* newNode =
-        new AVLNode<Key,Value>(new_item.first, new_item.second, parent);
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+AVLTree<Key, Value, Compare, Alloc, NodeType>::AVLTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>(comp)
+{
 
-    if(new_item.first < parent->getKey()) parent->setLeft(newNode);
-    else parent->setRight(newNode);
+}
 
-    
-    AVLNode<Key,Value>* node = parent;
-    while(node != NULL) {
-        updateBalanceFromChildren(node);
-        int8_t bal = node->getBalance();
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+AVLTree<Key, Value, Compare, Alloc, NodeType>::AVLTree(const Compare& comp, const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>(comp, alloc)
+{
 
-        if(bal < -1 || bal > 1) {
-            
-            rebalanceAt(node);
-            break;
-        }
-        node = node->getParent();
+}
+
+/**
+ * Builds a balanced tree from a range in O(n) if it is sorted. This
+ * cannot be left to the base constructor: the balance factors are set
+ * through a virtual hook, which only reaches AVLTree once it exists.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename ForwardIt>
+AVLTree<Key, Value, Compare, Alloc, NodeType>::AVLTree(ForwardIt first, ForwardIt last, const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>(comp)
+{
+    this->assign(first, last);
+}
+
+/**
+ * Called by BinarySearchTree with every newly linked node. Updates the
+ * parent's balance and retraces if the parent's height grew.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::afterInsert(NodeType* node)
+{
+    NodeType* parent = node->getParent();
+    if(parent == NULL) return;
+
+    if(node == parent->getLeft()) {
+        parent->updateBalance(-1);
+    }
+    else {
+        parent->updateBalance(1);
+    }
+    this->adjustSizes(parent, 1);
+
+    // If the parent became perfectly balanced its height did not change,
+    // so nothing above it can be affected.
+    if(parent->getBalance() != 0) {
+        insertFix(parent, node);
     }
 }
 
@@ -200,72 +297,821 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
  * Recall: The writeup specifies that if a node has 2 children you
  * should swap with the predecessor and then remove.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>::remove(const Key& key)
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::remove(const Key& key)
 {
     
-    Node<Key,Value>* temp = this->internalFind(key);
-    if(temp == NULL) return;
-
-    AVLNode<Key,Value>* node = static_cast<AVLNode<Key,Value>*>(temp);
+    NodeType* node = this->internalFind(key);
+    if(node == NULL) return;
 
     
     if(node->getLeft() != NULL && node->getRight() != NULL) {
-        Node<Key,Value>* predNode =
-            BinarySearchTree<Key,Value>::predecessor(node);
-        AVLNode<Key,Value>* pred = static_cast<AVLNode<Key,Value>*>(predNode);
+        NodeType* pred = this->predecessor(node);
         nodeSwap(node, pred);
         
     }
 
-    AVLNode<Key,Value>* parent = node->getParent();
-    AVLNode<Key,Value>* child =
+    NodeType* parent = node->getParent();
+    NodeType* child =
         (node->getLeft() != NULL) ? node->getLeft() : node->getRight();
 
     if(child != NULL) {
         child->setParent(parent);
     }
 
+    // diff is the change to the parent's balance: losing height on the
+    // left makes it more right-heavy and vice versa.
+    int8_t diff = 0;
     if(parent == NULL) {
         
         this->root_ = child;
     }
     else if(node == parent->getLeft()) {
         parent->setLeft(child);
+        diff = 1;
     }
     else {
         parent->setRight(child);
+        diff = -1;
     }
 
-    delete node;
+    this->destroyNode(node);
 
-    
-    AVLNode<Key,Value>* cur = parent;
-    while(cur != NULL) {
-        updateBalanceFromChildren(cur);
-        int8_t bal = cur->getBalance();
-
-        if(bal < -1 || bal > 1) {
-            AVLNode<Key,Value>* oldParent = cur->getParent();
-            rebalanceAt(cur);
-            
-            cur = oldParent;
+    this->adjustSizes(parent, -1);
+    removeFix(parent, diff);
+}
+
+/**
+ * Moves every item with a key not less than key into greater, whose
+ * previous contents are cleared, in O(log n).
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::split(const Key& key, AVLTree& greater)
+{
+    if(&greater == this) return;
+    greater.clear();
+
+    // Copy first, so that a failed copy leaves this tree as it was
+    NodeType* copy = NULL;
+    if(!sharesAllocator(greater)) {
+        NodeType* first = this->internalLowerBound(key);
+        int hc;
+        copy = greater.copyItems(first, first == NULL ? 0 : this->size() - this->rank(first->getKey()), hc);
+    }
+
+    NodeType* l;
+    NodeType* r;
+    int hl, hr, h;
+    NodeType* match = splitNodes(this->root_, subtreeHeight(this->root_), key, l, hl, r, hr);
+    if(match != NULL) {
+        r = joinNodes(NULL, 0, match, r, hr, h);
+    }
+    setRoot(l);
+    if(copy != NULL) {
+        this->clearHelper(r);
+        r = copy;
+    }
+    greater.setRoot(r);
+}
+
+/**
+ * Moves every item of right into this tree in O(log n). Every key in
+ * right must be greater than every key here.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::join(AVLTree& right)
+{
+    if(&right == this || right.root_ == NULL) return;
+    if(this->root_ != NULL &&
+       !this->comp_(this->getLargestNode()->getKey(), right.getSmallestNode()->getKey())) {
+        throw std::invalid_argument("join: keys of the right tree must all be greater");
+    }
+
+    int hr, h;
+    NodeType* r = takeNodes(right, hr);
+    setRoot(joinNodes(this->root_, subtreeHeight(this->root_), r, hr, h));
+}
+
+/**
+ * Adds every item of other whose key is not here yet. Takes
+ * O(m log(n/m + 1)) for trees of m <= n items.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::setUnion(AVLTree& other, unsigned threads)
+{
+    if(&other == this) return;
+    DiscardList discard;
+    int hb, h;
+    NodeType* b = takeNodes(other, hb);
+    setRoot(unionNodes(this->root_, subtreeHeight(this->root_), b, hb,
+                       h, discard, forkLevels(threads)));
+    releaseDiscarded(discard);
+}
+
+/**
+ * Keeps only the items whose key is also in other
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::setIntersection(AVLTree& other, unsigned threads)
+{
+    if(&other == this) return;
+    DiscardList discard;
+    int hb, h;
+    NodeType* b = takeNodes(other, hb);
+    setRoot(intersectNodes(this->root_, subtreeHeight(this->root_), b, hb,
+                           h, discard, forkLevels(threads)));
+    releaseDiscarded(discard);
+}
+
+/**
+ * Removes the items whose key is in other
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::setDifference(AVLTree& other, unsigned threads)
+{
+    if(&other == this) {
+        this->clear();
+        return;
+    }
+    DiscardList discard;
+    int hb, h;
+    NodeType* b = takeNodes(other, hb);
+    setRoot(differenceNodes(this->root_, subtreeHeight(this->root_), b, hb,
+                            h, discard, forkLevels(threads)));
+    releaseDiscarded(discard);
+}
+
+/**
+ * Nodes can only change trees if either tree's allocator can free them.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+bool AVLTree<Key, Value, Compare, Alloc, NodeType>::sharesAllocator(const AVLTree& other) const
+{
+    return this->alloc_ == other.alloc_;
+}
+
+/**
+ * Copies count items, starting at first and going in order through
+ * another tree, into a balanced subtree of nodes from this tree's
+ * allocator, in O(count). Its height goes in h. If a copy throws, the
+ * ones made so far are freed and the source is untouched.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::copyItems(NodeType* first, size_t count, int& h)
+{
+    std::vector<NodeType*> nodes;
+    nodes.reserve(count);
+    try {
+        for(NodeType* node = first; nodes.size() < count; node = this->successor(node)) {
+            nodes.push_back(this->createNode(NULL, node->getItem()));
+        }
+    }
+    catch(...) {
+        for(size_t i = 0; i < nodes.size(); ++i) this->destroyNode(nodes[i]);
+        throw;
+    }
+    return this->linkBalanced(nodes.data(), nodes.size(), NULL, h);
+}
+
+/**
+ * Empties other and returns its items as a detached subtree (height in
+ * h) whose nodes this tree can free: other's own nodes if the trees
+ * share an allocator, otherwise copies, after which other frees its
+ * originals.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::takeNodes(AVLTree& other, int& h)
+{
+    NodeType* root = other.root_;
+    if(sharesAllocator(other)) {
+        h = subtreeHeight(root);
+        other.root_ = NULL;
+        return root;
+    }
+    NodeType* copy = copyItems(other.getSmallestNode(), other.size(), h);
+    other.clear();
+    return copy;
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::setRoot(NodeType* root)
+{
+    if(root != NULL) root->setParent(NULL);
+    this->root_ = root;
+}
+
+/**
+ * Follows the taller side down, so O(log n)
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+int AVLTree<Key, Value, Compare, Alloc, NodeType>::subtreeHeight(NodeType* node)
+{
+    int h = 0;
+    while(node != NULL) {
+        ++h;
+        node = (node->getBalance() > 0) ? node->getRight() : node->getLeft();
+    }
+    return h;
+}
+
+/**
+ * The heights of node's subtrees, given node's height h
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::childHeights(NodeType* node, int h, int& leftHeight, int& rightHeight)
+{
+    int balance = node->getBalance();
+    leftHeight = (balance > 0) ? h - 1 - balance : h - 1;
+    rightHeight = (balance < 0) ? h - 1 + balance : h - 1;
+}
+
+/**
+ * Makes l and r the subtrees of k and sets k's balance and size. The
+ * balance may be off by one more than AVL allows; the callers rotate
+ * such a node right away.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::attach(NodeType* l, int hl, NodeType* k, NodeType* r, int hr, int& h)
+{
+    k->setLeft(l);
+    k->setRight(r);
+    if(l != NULL) l->setParent(k);
+    if(r != NULL) r->setParent(k);
+    k->setBalance(static_cast<int8_t>(hr - hl));
+    this->updateSize(k);
+    h = 1 + std::max(hl, hr);
+    return k;
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::rotateSubtreeLeft(NodeType* x, int hx, int& h)
+{
+    NodeType* y = x->getRight();
+    int hxl, hy, hyl, hyr, hx2;
+    childHeights(x, hx, hxl, hy);
+    childHeights(y, hy, hyl, hyr);
+    NodeType* c = y->getRight();
+    x = attach(x->getLeft(), hxl, x, y->getLeft(), hyl, hx2);
+    return attach(x, hx2, y, c, hyr, h);
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::rotateSubtreeRight(NodeType* x, int hx, int& h)
+{
+    NodeType* y = x->getLeft();
+    int hy, hxr, hyl, hyr, hx2;
+    childHeights(x, hx, hy, hxr);
+    childHeights(y, hy, hyl, hyr);
+    NodeType* a = y->getLeft();
+    x = attach(y->getRight(), hyr, x, x->getRight(), hxr, hx2);
+    return attach(a, hyl, y, x, hx2, h);
+}
+
+/**
+ * Joins l, k and r when l is more than one level taller than r: k and
+ * r go in down l's right spine, where the heights meet, and the spine
+ * is rebalanced on the way back up.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::joinRight(NodeType* l, int hl, NodeType* k, NodeType* r, int hr, int& h)
+{
+    int hll, hc, ht, hn;
+    childHeights(l, hl, hll, hc);
+    NodeType* ll = l->getLeft();
+    NodeType* c = l->getRight();
+
+    NodeType* t;
+    if(hc <= hr + 1) {
+        t = attach(c, hc, k, r, hr, ht);
+        if(ht <= hll + 1) return attach(ll, hll, l, t, ht, h);
+        t = rotateSubtreeRight(t, ht, ht);
+        NodeType* n = attach(ll, hll, l, t, ht, hn);
+        return rotateSubtreeLeft(n, hn, h);
+    }
+
+    t = joinRight(c, hc, k, r, hr, ht);
+    NodeType* n = attach(ll, hll, l, t, ht, hn);
+    if(ht <= hll + 1) {
+        h = hn;
+        return n;
+    }
+    return rotateSubtreeLeft(n, hn, h);
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::joinLeft(NodeType* l, int hl, NodeType* k, NodeType* r, int hr, int& h)
+{
+    int hc, hrr, ht, hn;
+    childHeights(r, hr, hc, hrr);
+    NodeType* c = r->getLeft();
+    NodeType* rr = r->getRight();
+
+    NodeType* t;
+    if(hc <= hl + 1) {
+        t = attach(l, hl, k, c, hc, ht);
+        if(ht <= hrr + 1) return attach(t, ht, r, rr, hrr, h);
+        t = rotateSubtreeLeft(t, ht, ht);
+        NodeType* n = attach(t, ht, r, rr, hrr, hn);
+        return rotateSubtreeRight(n, hn, h);
+    }
+
+    t = joinLeft(l, hl, k, c, hc, ht);
+    NodeType* n = attach(t, ht, r, rr, hrr, hn);
+    if(ht <= hrr + 1) {
+        h = hn;
+        return n;
+    }
+    return rotateSubtreeRight(n, hn, h);
+}
+
+/**
+ * Joins l, the single node k and r, all of l's keys being less than
+ * k's and all of r's greater, in O(|hl - hr| + 1)
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::joinNodes(NodeType* l, int hl, NodeType* k, NodeType* r, int hr, int& h)
+{
+    if(hl > hr + 1) return joinRight(l, hl, k, r, hr, h);
+    if(hr > hl + 1) return joinLeft(l, hl, k, r, hr, h);
+    return attach(l, hl, k, r, hr, h);
+}
+
+/**
+ * Joins l and r, using l's largest node as the middle
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::joinNodes(NodeType* l, int hl, NodeType* r, int hr, int& h)
+{
+    if(l == NULL) {
+        h = hr;
+        return r;
+    }
+    NodeType* k;
+    l = splitLast(l, hl, k, hl);
+    return joinNodes(l, hl, k, r, hr, h);
+}
+
+/**
+ * Takes the largest node, last, out of t
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::splitLast(NodeType* t, int ht, NodeType*& last, int& h)
+{
+    int hl, hr;
+    childHeights(t, ht, hl, hr);
+    if(t->getRight() == NULL) {
+        last = t;
+        h = hl;
+        return t->getLeft();
+    }
+    NodeType* r = splitLast(t->getRight(), hr, last, hr);
+    return joinNodes(t->getLeft(), hl, t, r, hr, h);
+}
+
+/**
+ * Splits t into l, the keys less than key, and r, the greater ones.
+ * Returns the node holding key, or NULL. O(log n): the joins on the
+ * way back up cost O(log n) together since heights grow along the path.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::splitNodes(NodeType* t, int ht, const Key& key,
+                                                                    NodeType*& l, int& hl, NodeType*& r, int& hr)
+{
+    if(t == NULL) {
+        l = r = NULL;
+        hl = hr = 0;
+        return NULL;
+    }
+
+    int htl, htr;
+    childHeights(t, ht, htl, htr);
+    NodeType* a = t->getLeft();
+    NodeType* b = t->getRight();
+
+    if(this->comp_(key, t->getKey())) {
+        NodeType* mid;
+        int hmid;
+        NodeType* match = splitNodes(a, htl, key, l, hl, mid, hmid);
+        r = joinNodes(mid, hmid, t, b, htr, hr);
+        return match;
+    }
+    if(this->comp_(t->getKey(), key)) {
+        NodeType* mid;
+        int hmid;
+        NodeType* match = splitNodes(b, htr, key, mid, hmid, r, hr);
+        l = joinNodes(a, htl, t, mid, hmid, hl);
+        return match;
+    }
+
+    l = a;
+    hl = htl;
+    r = b;
+    hr = htr;
+    t->setLeft(NULL);
+    t->setRight(NULL);
+    return t;
+}
+
+/**
+ * Union after Blelloch, Ferizovic and Sun, "Just Join for Parallel
+ * Ordered Sets": split b by a's root key, unite the halves (in parallel
+ * when large) and join them back around a's root.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::unionNodes(NodeType* a, int ha, NodeType* b, int hb,
+                                                                    int& h, DiscardList& discard, int forks)
+{
+    if(a == NULL) {
+        h = hb;
+        return b;
+    }
+    if(b == NULL) {
+        h = ha;
+        return a;
+    }
+
+    int hal, har, hbl, hbr;
+    childHeights(a, ha, hal, har);
+    NodeType* al = a->getLeft();
+    NodeType* ar = a->getRight();
+    bool fork = shouldFork(a, b, forks);
+    NodeType* bl;
+    NodeType* br;
+    NodeType* match = splitNodes(b, hb, a->getKey(), bl, hbl, br, hbr);
+    if(match != NULL) discard.push(match);
+
+    NodeType* l;
+    NodeType* r;
+    int hl, hr;
+    DiscardList leftDiscard;
+    forkJoin(fork,
+             [&]() { l = unionNodes(al, hal, bl, hbl, hl, leftDiscard, forks - 1); },
+             [&]() { r = unionNodes(ar, har, br, hbr, hr, discard, forks - 1); });
+    discard.splice(leftDiscard);
+    return joinNodes(l, hl, a, r, hr, h);
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::intersectNodes(NodeType* a, int ha, NodeType* b, int hb,
+                                                                        int& h, DiscardList& discard, int forks)
+{
+    if(a == NULL || b == NULL) {
+        discard.push(a);
+        discard.push(b);
+        h = 0;
+        return NULL;
+    }
+
+    int hal, har, hbl, hbr;
+    childHeights(a, ha, hal, har);
+    NodeType* al = a->getLeft();
+    NodeType* ar = a->getRight();
+    bool fork = shouldFork(a, b, forks);
+    NodeType* bl;
+    NodeType* br;
+    NodeType* match = splitNodes(b, hb, a->getKey(), bl, hbl, br, hbr);
+
+    NodeType* l;
+    NodeType* r;
+    int hl, hr;
+    DiscardList leftDiscard;
+    forkJoin(fork,
+             [&]() { l = intersectNodes(al, hal, bl, hbl, hl, leftDiscard, forks - 1); },
+             [&]() { r = intersectNodes(ar, har, br, hbr, hr, discard, forks - 1); });
+    discard.splice(leftDiscard);
+
+    if(match != NULL) {
+        discard.push(match);
+        return joinNodes(l, hl, a, r, hr, h);
+    }
+    a->setLeft(NULL);
+    a->setRight(NULL);
+    discard.push(a);
+    return joinNodes(l, hl, r, hr, h);
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+NodeType* AVLTree<Key, Value, Compare, Alloc, NodeType>::differenceNodes(NodeType* a, int ha, NodeType* b, int hb,
+                                                                         int& h, DiscardList& discard, int forks)
+{
+    if(a == NULL || b == NULL) {
+        discard.push(b);
+        h = ha;
+        return a;
+    }
+
+    int hbl, hbr, hal, har;
+    childHeights(b, hb, hbl, hbr);
+    NodeType* bl = b->getLeft();
+    NodeType* br = b->getRight();
+    bool fork = shouldFork(a, b, forks);
+    b->setLeft(NULL);
+    b->setRight(NULL);
+    discard.push(b);
+    NodeType* al;
+    NodeType* ar;
+    NodeType* match = splitNodes(a, ha, b->getKey(), al, hal, ar, har);
+    if(match != NULL) discard.push(match);
+
+    NodeType* l;
+    NodeType* r;
+    int hl, hr;
+    DiscardList leftDiscard;
+    forkJoin(fork,
+             [&]() { l = differenceNodes(al, hal, bl, hbl, hl, leftDiscard, forks - 1); },
+             [&]() { r = differenceNodes(ar, har, br, hbr, hr, discard, forks - 1); });
+    discard.splice(leftDiscard);
+    return joinNodes(l, hl, r, hr, h);
+}
+
+/**
+ * Appends a node, or a whole subtree, to the list
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::DiscardList::push(NodeType* node)
+{
+    if(node == NULL) return;
+    node->setParent(NULL);
+    if(tail == NULL) head = node;
+    else tail->setParent(node);
+    tail = node;
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::DiscardList::splice(DiscardList& other)
+{
+    if(other.head == NULL) return;
+    if(tail == NULL) head = other.head;
+    else tail->setParent(other.head);
+    tail = other.tail;
+    other.head = other.tail = NULL;
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::releaseDiscarded(DiscardList& discard)
+{
+    NodeType* node = discard.head;
+    while(node != NULL) {
+        NodeType* next = node->getParent();
+        this->clearHelper(node);
+        node = next;
+    }
+    discard.head = discard.tail = NULL;
+}
+
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+bool AVLTree<Key, Value, Compare, Alloc, NodeType>::shouldFork(NodeType* a, NodeType* b, int forks) const
+{
+    return forks > 0 && this->subtreeSize(a) + this->subtreeSize(b) >= ParallelGrain;
+}
+
+/**
+ * Forking this many levels deep gives every thread a share of the work
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+int AVLTree<Key, Value, Compare, Alloc, NodeType>::forkLevels(unsigned threads)
+{
+    if(threads == 0) threads = std::thread::hardware_concurrency();
+    int levels = 0;
+    while((1u << levels) < threads) ++levels;
+    return levels;
+}
+
+/**
+ * Runs left on a new thread and right on this one, or both here if
+ * fork is false or no thread can be started. An exception from either
+ * is rethrown once both are done.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+template<typename Left, typename Right>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::forkJoin(bool fork, Left left, Right right)
+{
+    std::exception_ptr leftError;
+    std::thread worker;
+    if(fork) {
+        try {
+            worker = std::thread([&]() {
+                try {
+                    left();
+                }
+                catch(...) {
+                    leftError = std::current_exception();
+                }
+            });
+        }
+        catch(const std::system_error&) {
+            fork = false;
+        }
+    }
+    if(!fork) left();
+
+    try {
+        right();
+    }
+    catch(...) {
+        if(worker.joinable()) worker.join();
+        throw;
+    }
+    if(worker.joinable()) worker.join();
+    if(leftError) std::rethrow_exception(leftError);
+}
+
+/**
+ * Retraces upward after an insert. p is the parent of n, the subtree
+ * that just grew by one level, and p's balance has already been
+ * updated to a non-zero value. Stops as soon as a subtree's height is
+ * unchanged or after the single (or double) rotation an insert needs.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::insertFix(NodeType* p, NodeType* n)
+{
+    while(p != NULL) {
+        NodeType* g = p->getParent();
+        if(g == NULL) return;
+
+        if(p == g->getLeft()) {
+            g->updateBalance(-1);
+            if(g->getBalance() == 0) return;
+            if(g->getBalance() == -2) {
+                if(n == p->getLeft()) {
+                    // zig-zig
+                    rotateRight(g);
+                    p->setBalance(0);
+                    g->setBalance(0);
+                }
+                else {
+                    // zig-zag
+                    rotateLeft(p);
+                    rotateRight(g);
+                    if(n->getBalance() == -1) {
+                        p->setBalance(0);
+                        g->setBalance(1);
+                    }
+                    else if(n->getBalance() == 0) {
+                        p->setBalance(0);
+                        g->setBalance(0);
+                    }
+                    else {
+                        p->setBalance(-1);
+                        g->setBalance(0);
+                    }
+                    n->setBalance(0);
+                }
+                return;
+            }
         }
         else {
-            cur = cur->getParent();
+            g->updateBalance(1);
+            if(g->getBalance() == 0) return;
+            if(g->getBalance() == 2) {
+                if(n == p->getRight()) {
+                    // zig-zig
+                    rotateLeft(g);
+                    p->setBalance(0);
+                    g->setBalance(0);
+                }
+                else {
+                    // zig-zag
+                    rotateRight(p);
+                    rotateLeft(g);
+                    if(n->getBalance() == 1) {
+                        p->setBalance(0);
+                        g->setBalance(-1);
+                    }
+                    else if(n->getBalance() == 0) {
+                        p->setBalance(0);
+                        g->setBalance(0);
+                    }
+                    else {
+                        p->setBalance(1);
+                        g->setBalance(0);
+                    }
+                    n->setBalance(0);
+                }
+                return;
+            }
         }
+
+        // g went from 0 to +/-1: its height grew, keep going up
+        n = p;
+        p = g;
     }
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* x)
+/**
+ * Retraces upward after a removal. diff is the change to n's balance
+ * caused by one of its subtrees shrinking by one level (+1 when the
+ * left side shrank, -1 when the right side shrank). Unlike insert,
+ * a removal may need a rotation at every level up to the root.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::removeFix(NodeType* n, int8_t diff)
+{
+    while(n != NULL) {
+        // Work out the next step before any rotation moves n
+        NodeType* p = n->getParent();
+        int8_t ndiff = 0;
+        if(p != NULL) {
+            ndiff = (n == p->getLeft()) ? 1 : -1;
+        }
+
+        int8_t bal = static_cast<int8_t>(n->getBalance() + diff);
+
+        if(bal == 2) {
+            NodeType* c = n->getRight();
+            if(c->getBalance() == 1) {
+                // zig-zig, height shrinks
+                rotateLeft(n);
+                n->setBalance(0);
+                c->setBalance(0);
+            }
+            else if(c->getBalance() == 0) {
+                // zig-zig, height is unchanged
+                rotateLeft(n);
+                n->setBalance(1);
+                c->setBalance(-1);
+                return;
+            }
+            else {
+                // zig-zag, height shrinks
+                NodeType* g = c->getLeft();
+                rotateRight(c);
+                rotateLeft(n);
+                if(g->getBalance() == 1) {
+                    n->setBalance(-1);
+                    c->setBalance(0);
+                }
+                else if(g->getBalance() == 0) {
+                    n->setBalance(0);
+                    c->setBalance(0);
+                }
+                else {
+                    n->setBalance(0);
+                    c->setBalance(1);
+                }
+                g->setBalance(0);
+            }
+        }
+        else if(bal == -2) {
+            NodeType* c = n->getLeft();
+            if(c->getBalance() == -1) {
+                rotateRight(n);
+                n->setBalance(0);
+                c->setBalance(0);
+            }
+            else if(c->getBalance() == 0) {
+                rotateRight(n);
+                n->setBalance(-1);
+                c->setBalance(1);
+                return;
+            }
+            else {
+                NodeType* g = c->getRight();
+                rotateLeft(c);
+                rotateRight(n);
+                if(g->getBalance() == -1) {
+                    n->setBalance(1);
+                    c->setBalance(0);
+                }
+                else if(g->getBalance() == 0) {
+                    n->setBalance(0);
+                    c->setBalance(0);
+                }
+                else {
+                    n->setBalance(0);
+                    c->setBalance(-1);
+                }
+                g->setBalance(0);
+            }
+        }
+        else if(bal != 0) {
+            // n went from 0 to +/-1: its height is unchanged
+            n->setBalance(bal);
+            return;
+        }
+        else {
+            n->setBalance(0);
+        }
+
+        n = p;
+        diff = ndiff;
+    }
+}
+
+/**
+ * Rotations relink pointers and fix the two subtree sizes that change;
+ * the callers (insertFix/removeFix) know the resulting balances and set
+ * them directly.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::rotateLeft(NodeType* x)
 {
     if(x == NULL) return;
-    AVLNode<Key,Value>* y = x->getRight();
+    NodeType* y = x->getRight();
     if(y == NULL) return;
 
-    AVLNode<Key,Value>* p = x->getParent();
-    AVLNode<Key,Value>* B = y->getLeft();
+    NodeType* p = x->getParent();
+    NodeType* B = y->getLeft();
 
    
     y->setParent(p);
@@ -289,20 +1135,19 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* x)
         B->setParent(x);
     }
 
-    
-    updateBalanceFromChildren(x);
-    updateBalanceFromChildren(y);
+    this->updateSize(x);
+    this->updateSize(y);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* x)
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::rotateRight(NodeType* x)
 {
     if(x == NULL) return;
-    AVLNode<Key,Value>* y = x->getLeft();
+    NodeType* y = x->getLeft();
     if(y == NULL) return;
 
-    AVLNode<Key,Value>* p = x->getParent();
-    AVLNode<Key,Value>* B = y->getRight();
+    NodeType* p = x->getParent();
+    NodeType* B = y->getRight();
 
     
     y->setParent(p);
@@ -326,66 +1171,39 @@ void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* x)
         B->setParent(x);
     }
 
-    
-    updateBalanceFromChildren(x);
-    updateBalanceFromChildren(y);
+    this->updateSize(x);
+    this->updateSize(y);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::updateBalanceFromChildren(AVLNode<Key,Value>* node)
+/**
+ * Checks the stored balance factor against the true subtree heights
+ * computed by BinarySearchTree::verify(), and the AVL property itself.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+const char* AVLTree<Key, Value, Compare, Alloc, NodeType>::verifyNode(NodeType* node, int leftHeight, int rightHeight) const
 {
-    if(node == NULL) return;
-    int leftH  = height<Key,Value>(node->getLeft());
-    int rightH = height<Key,Value>(node->getRight());
-    
-    node->setBalance(static_cast<int8_t>(rightH - leftH));
+    if(node->getBalance() != rightHeight - leftHeight) {
+        return "stored balance factor does not match subtree heights";
+    }
+    if(std::abs(rightHeight - leftHeight) > 1) {
+        return "subtree heights differ by more than one";
+    }
+    return NULL;
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rebalanceAt(AVLNode<Key,Value>* node)
+/**
+ * Bulk-built subtrees get their balance factor straight from the heights.
+ */
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::initBuiltNode(NodeType* node, int leftHeight, int rightHeight)
 {
-    if(node == NULL) return;
-
-    
-    updateBalanceFromChildren(node);
-    int8_t bal = node->getBalance();
-
-    if(bal == -2) {
-        
-        AVLNode<Key,Value>* left = node->getLeft();
-        updateBalanceFromChildren(left);
-
-        if(left->getBalance() <= 0) {
-            
-            rotateRight(node);
-        }
-        else {
-            
-            rotateLeft(left);
-            rotateRight(node);
-        }
-    }
-    else if(bal == 2) {
-        
-        AVLNode<Key,Value>* right = node->getRight();
-        updateBalanceFromChildren(right);
-
-        if(right->getBalance() >= 0) {
-            
-            rotateLeft(node);
-        }
-        else {
-            
-            rotateRight(right);
-            rotateLeft(node);
-        }
-    }
+    node->setBalance(static_cast<int8_t>(rightHeight - leftHeight));
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+template<class Key, class Value, class Compare, class Alloc, class NodeType>
+void AVLTree<Key, Value, Compare, Alloc, NodeType>::nodeSwap( NodeType* n1, NodeType* n2)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::nodeSwap(n1, n2);
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
@@ -0,0 +1,1249 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "bst.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+* In-node key search for BPlusTree. countLess returns how many of the n
+* sorted keys are less than k, and countNotGreater how many are not
+* greater. The general version binary-searches with the comparator.
+*/
+template <typename Key, typename Compare>
+struct BPlusNodeSearch
+{
+    static int countLess(const Key* keys, int n, const Key& k, const Compare& comp)
+    {
+        return static_cast<int>(std::lower_bound(keys, keys + n, k, comp) - keys);
+    }
+    static int countNotGreater(const Key* keys, int n, const Key& k, const Compare& comp)
+    {
+        return static_cast<int>(std::upper_bound(keys, keys + n, k, comp) - keys);
+    }
+};
+
+#if defined(__SSE2__)
+/**
+* 32-bit integer keys under the natural order are counted four at a time
+* with SSE2 compares, each lane keeping its own tally of matches: a
+* whole node is scanned without a single data dependent branch. Unsigned
+* keys are flipped into signed order first.
+*/
+template <typename Key, bool Signed>
+struct BPlusSimdSearch
+{
+    static __m128i load(const Key* p)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        return Signed ? v : _mm_xor_si128(v, _mm_set1_epi32(INT32_MIN));
+    }
+    static int32_t flip(Key k)
+    {
+        return Signed ? static_cast<int32_t>(k) : static_cast<int32_t>(static_cast<uint32_t>(k) ^ 0x80000000u);
+    }
+    // Adds up the four lanes of a vector of per-lane match counts
+    static int sum(__m128i acc)
+    {
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(acc);
+    }
+    static int countLess(const Key* keys, int n, Key k)
+    {
+        const __m128i kv = _mm_set1_epi32(flip(k));
+        __m128i acc = _mm_setzero_si128();
+        int i = 0;
+        for(; i + 4 <= n; i += 4) {
+            acc = _mm_sub_epi32(acc, _mm_cmplt_epi32(load(keys + i), kv));
+        }
+        int count = sum(acc);
+        for(; i < n; ++i) count += keys[i] < k;
+        return count;
+    }
+    static int countNotGreater(const Key* keys, int n, Key k)
+    {
+        const __m128i kv = _mm_set1_epi32(flip(k));
+        __m128i acc = _mm_setzero_si128();
+        int i = 0;
+        for(; i + 4 <= n; i += 4) {
+            acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(load(keys + i), kv));
+        }
+        int count = i - sum(acc);
+        for(; i < n; ++i) count += !(k < keys[i]);
+        return count;
+    }
+};
+
+template <>
+struct BPlusNodeSearch<int32_t, std::less<int32_t> >
+{
+    static int countLess(const int32_t* keys, int n, int32_t k, const std::less<int32_t>&)
+    {
+        return BPlusSimdSearch<int32_t, true>::countLess(keys, n, k);
+    }
+    static int countNotGreater(const int32_t* keys, int n, int32_t k, const std::less<int32_t>&)
+    {
+        return BPlusSimdSearch<int32_t, true>::countNotGreater(keys, n, k);
+    }
+};
+
+template <>
+struct BPlusNodeSearch<uint32_t, std::less<uint32_t> >
+{
+    static int countLess(const uint32_t* keys, int n, uint32_t k, const std::less<uint32_t>&)
+    {
+        return BPlusSimdSearch<uint32_t, false>::countLess(keys, n, k);
+    }
+    static int countNotGreater(const uint32_t* keys, int n, uint32_t k, const std::less<uint32_t>&)
+    {
+        return BPlusSimdSearch<uint32_t, false>::countNotGreater(keys, n, k);
+    }
+};
+#endif
+
+/**
+* A B+ tree whose node size is a whole number of cache lines. Each node
+* holds a plain array of CacheLines * 64 bytes worth of keys (at least
+* 4), so a search reads a handful of adjacent lines per level instead of
+* one scattered node per comparison. All items live in the leaves, which
+* are linked both ways, so ordered scans run along contiguous arrays.
+*
+* The interface mirrors AVLTree (insert/remove/find/bounds/iterators),
+* so either can stand behind the same typedef. Unlike the node-based
+* trees, items move between leaves as the tree splits and merges, so
+* any insert or remove invalidates iterators. The key arrays are plain
+* arrays, so Key must be default constructible and assignable.
+*
+* The vectorized in-node search (BPlusSimdSearch) only covers int32_t
+* and uint32_t keys under std::less, and only when SSE2 is available.
+* Every other combination, including std::greater or any other key
+* type, silently uses the binary search of BPlusNodeSearch. The
+* benchBPlusTree rows "B+ scalar" and "B+ int64" show what those cases
+* cost.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key>, size_t CacheLines = 4>
+class BPlusTree
+{
+    typedef std::pair<const Key, Value> Item;
+
+public:
+    BPlusTree();
+    explicit BPlusTree(const Compare& comp);
+    BPlusTree(const BPlusTree&) = delete;
+    BPlusTree& operator=(const BPlusTree&) = delete;
+    ~BPlusTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void insert(std::pair<const Key, Value>&& keyValuePair);
+    template<typename ForwardIt>
+    void insert(ForwardIt first, ForwardIt last);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    size_t size() const;
+    bool isBalanced() const;
+    TreeReport verify() const;
+
+    // Keys per node, from the cache-line budget
+    static const int LeafSlots = (CacheLines * 64 / sizeof(Key)) < 4 ? 4 : static_cast<int>(CacheLines * 64 / sizeof(Key));
+    static const int InnerSlots = LeafSlots;
+
+private:
+    struct NodeHeader
+    {
+        bool leaf;
+        uint16_t count;  // keys in the node
+    };
+
+    struct Leaf : NodeHeader
+    {
+        Leaf* prev;
+        Leaf* next;
+        Key keys[LeafSlots];
+        typename std::aligned_storage<sizeof(Item), alignof(Item)>::type items[LeafSlots];
+    };
+
+    // children[i] holds the keys k with keys[i - 1] <= k < keys[i]
+    struct Inner : NodeHeader
+    {
+        Key keys[InnerSlots];
+        NodeHeader* children[InnerSlots + 1];
+    };
+
+public:
+    class const_iterator;
+
+    /**
+    * A bidirectional iterator over the items in key order. --end()
+    * reaches the largest item.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key,Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
+        iterator();
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class BPlusTree<Key, Value, Compare, CacheLines>;
+        friend class const_iterator;
+        iterator(Leaf* leaf, int index, const BPlusTree* tree);
+        Leaf* leaf_;  // NULL for the end
+        int index_;
+        const BPlusTree* tree_;
+    };
+
+    /**
+    * The read-only counterpart of iterator.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key,Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        friend bool operator==(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs.leaf_ == rhs.leaf_ && lhs.index_ == rhs.index_;
+        }
+        friend bool operator!=(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return !(lhs == rhs);
+        }
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class BPlusTree<Key, Value, Compare, CacheLines>;
+        const_iterator(Leaf* leaf, int index, const BPlusTree* tree);
+        Leaf* leaf_;
+        int index_;
+        const BPlusTree* tree_;
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    iterator begin();
+    iterator end();
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin();
+    reverse_iterator rend();
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+
+    iterator find(const Key& key) const;
+    bool contains(const Key& key) const;
+    Value* lookup(const Key& key);
+    const Value* lookup(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    template<typename Visitor>
+    void scan(const Key& lo, const Key& hi, Visitor visit) const;
+    Compare key_comp() const;
+
+private:
+    typedef BPlusNodeSearch<Key, Compare> Search;
+
+    // Nodes along a descent: the inner node and the child taken from it
+    struct PathStep
+    {
+        Inner* node;
+        int child;
+    };
+
+    // The steps of a descent, root first. Inner nodes below the root
+    // have at least three children, so 64 levels cover any tree size.
+    struct Path
+    {
+        Path() : size(0) { }
+        bool empty() const { return size == 0; }
+        void push_back(const PathStep& step) { steps[size++] = step; }
+        const PathStep& back() const { return steps[size - 1]; }
+        void pop_back() { --size; }
+
+        PathStep steps[64];
+        int size;
+    };
+
+    static const int MinLeaf = LeafSlots / 2;
+    static const int MinInner = InnerSlots / 2;
+
+    static Item& item(Leaf* leaf, int i);
+    static void moveItem(Leaf* from, int i, Leaf* to, int j);
+    Leaf* descend(const Key& k, Path* path) const;
+    iterator makeIterator(Leaf* leaf, int index) const;
+
+    template<typename P>
+    void insertPair(P&& keyValuePair);
+    void insertIntoParent(Path& path, const Key& separator, NodeHeader* right);
+    void fixLeafUnderflow(Leaf* leaf, Path& path);
+    void fixInnerUnderflow(Inner* node, Path& path);
+    static void removeFromInner(Inner* node, int keyIndex, int childIndex);
+
+    Leaf* newLeaf();
+    Inner* newInner();
+    void destroySubtree(NodeHeader* node);
+
+    NodeHeader* root_;
+    Leaf* head_;  // smallest leaf
+    Leaf* tail_;  // largest leaf
+    size_t size_;
+    Compare comp_;
+};
+
+/*
+-------------------------------------------------------
+Begin implementations for the BPlusTree::iterator class.
+-------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+BPlusTree<Key, Value, Compare, CacheLines>::iterator::iterator(Leaf* leaf, int index, const BPlusTree* tree)
+{
+    leaf_ = leaf;
+    index_ = index;
+    tree_ = tree;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+BPlusTree<Key, Value, Compare, CacheLines>::iterator::iterator()
+{
+    leaf_ = NULL;
+    index_ = 0;
+    tree_ = NULL;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+std::pair<const Key,Value> &
+BPlusTree<Key, Value, Compare, CacheLines>::iterator::operator*() const
+{
+    return BPlusTree::item(leaf_, index_);
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+std::pair<const Key,Value> *
+BPlusTree<Key, Value, Compare, CacheLines>::iterator::operator->() const
+{
+    return &BPlusTree::item(leaf_, index_);
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+bool BPlusTree<Key, Value, Compare, CacheLines>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && index_ == rhs.index_;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+bool BPlusTree<Key, Value, Compare, CacheLines>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Steps along the leaf, then over to the next one
+*/
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::iterator&
+BPlusTree<Key, Value, Compare, CacheLines>::iterator::operator++()
+{
+    if(++index_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        index_ = 0;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::iterator
+BPlusTree<Key, Value, Compare, CacheLines>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Steps back one item; decrementing the end iterator moves it to the
+* largest item.
+*/
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::iterator&
+BPlusTree<Key, Value, Compare, CacheLines>::iterator::operator--()
+{
+    if(leaf_ == NULL) {
+        leaf_ = tree_->tail_;
+        index_ = leaf_->count - 1;
+    }
+    else if(index_ == 0) {
+        leaf_ = leaf_->prev;
+        index_ = leaf_->count - 1;
+    }
+    else {
+        --index_;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::iterator
+BPlusTree<Key, Value, Compare, CacheLines>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+-----------------------------------------------------
+End implementations for the BPlusTree::iterator class.
+-----------------------------------------------------
+*/
+
+/*
+-------------------------------------------------------------
+Begin implementations for the BPlusTree::const_iterator class.
+-------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+BPlusTree<Key, Value, Compare, CacheLines>::const_iterator::const_iterator(Leaf* leaf, int index, const BPlusTree* tree)
+{
+    leaf_ = leaf;
+    index_ = index;
+    tree_ = tree;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+BPlusTree<Key, Value, Compare, CacheLines>::const_iterator::const_iterator()
+{
+    leaf_ = NULL;
+    index_ = 0;
+    tree_ = NULL;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+BPlusTree<Key, Value, Compare, CacheLines>::const_iterator::const_iterator(const iterator& it)
+{
+    leaf_ = it.leaf_;
+    index_ = it.index_;
+    tree_ = it.tree_;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+const std::pair<const Key,Value> &
+BPlusTree<Key, Value, Compare, CacheLines>::const_iterator::operator*() const
+{
+    return BPlusTree::item(leaf_, index_);
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+const std::pair<const Key,Value> *
+BPlusTree<Key, Value, Compare, CacheLines>::const_iterator::operator->() const
+{
+    return &BPlusTree::item(leaf_, index_);
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::const_iterator&
+BPlusTree<Key, Value, Compare, CacheLines>::const_iterator::operator++()
+{
+    if(++index_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        index_ = 0;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::const_iterator
+BPlusTree<Key, Value, Compare, CacheLines>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::const_iterator&
+BPlusTree<Key, Value, Compare, CacheLines>::const_iterator::operator--()
+{
+    if(leaf_ == NULL) {
+        leaf_ = tree_->tail_;
+        index_ = leaf_->count - 1;
+    }
+    else if(index_ == 0) {
+        leaf_ = leaf_->prev;
+        index_ = leaf_->count - 1;
+    }
+    else {
+        --index_;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::const_iterator
+BPlusTree<Key, Value, Compare, CacheLines>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+-----------------------------------------------------------
+End implementations for the BPlusTree::const_iterator class.
+-----------------------------------------------------------
+*/
+
+/*
+------------------------------------------------
+Begin implementations for the BPlusTree class.
+------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+BPlusTree<Key, Value, Compare, CacheLines>::BPlusTree() :
+    root_(NULL),
+    head_(NULL),
+    tail_(NULL),
+    size_(0)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+BPlusTree<Key, Value, Compare, CacheLines>::BPlusTree(const Compare& comp) :
+    root_(NULL),
+    head_(NULL),
+    tail_(NULL),
+    size_(0),
+    comp_(comp)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+BPlusTree<Key, Value, Compare, CacheLines>::~BPlusTree()
+{
+    clear();
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+bool BPlusTree<Key, Value, Compare, CacheLines>::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+size_t BPlusTree<Key, Value, Compare, CacheLines>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+Compare BPlusTree<Key, Value, Compare, CacheLines>::key_comp() const
+{
+    return comp_;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+void BPlusTree<Key, Value, Compare, CacheLines>::clear()
+{
+    if(root_ != NULL) destroySubtree(root_);
+    root_ = NULL;
+    head_ = NULL;
+    tail_ = NULL;
+    size_ = 0;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+void BPlusTree<Key, Value, Compare, CacheLines>::destroySubtree(NodeHeader* node)
+{
+    if(node->leaf) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        for(int i = 0; i < leaf->count; ++i) item(leaf, i).~Item();
+        delete leaf;
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for(int i = 0; i <= inner->count; ++i) destroySubtree(inner->children[i]);
+    delete inner;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::Leaf*
+BPlusTree<Key, Value, Compare, CacheLines>::newLeaf()
+{
+    Leaf* leaf = new Leaf;
+    leaf->leaf = true;
+    leaf->count = 0;
+    leaf->prev = NULL;
+    leaf->next = NULL;
+    return leaf;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::Inner*
+BPlusTree<Key, Value, Compare, CacheLines>::newInner()
+{
+    Inner* inner = new Inner;
+    inner->leaf = false;
+    inner->count = 0;
+    return inner;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::Item&
+BPlusTree<Key, Value, Compare, CacheLines>::item(Leaf* leaf, int i)
+{
+    return *reinterpret_cast<Item*>(&leaf->items[i]);
+}
+
+/**
+* Moves item i of one leaf into the empty slot j of another (or the
+* same) leaf, key included. Items are assumed not to throw when moved.
+*/
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+void BPlusTree<Key, Value, Compare, CacheLines>::moveItem(Leaf* from, int i, Leaf* to, int j)
+{
+    ::new(static_cast<void*>(&to->items[j])) Item(std::move(item(from, i)));
+    item(from, i).~Item();
+    to->keys[j] = from->keys[i];
+}
+
+/**
+* Walks from the root to the leaf that holds k, or would hold it. An
+* inner node sends k to the child after every separator not greater
+* than k. If path is given, it records every inner node and child taken.
+*/
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::Leaf*
+BPlusTree<Key, Value, Compare, CacheLines>::descend(const Key& k, Path* path) const
+{
+    NodeHeader* node = root_;
+    while(!node->leaf) {
+        Inner* inner = static_cast<Inner*>(node);
+        int child = Search::countNotGreater(inner->keys, inner->count, k, comp_);
+        if(path != NULL) {
+            PathStep step = { inner, child };
+            path->push_back(step);
+        }
+        node = inner->children[child];
+    }
+    return static_cast<Leaf*>(node);
+}
+
+/**
+* An iterator for slot index of leaf, moved on to the next leaf when
+* index is one past the last item
+*/
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::iterator
+BPlusTree<Key, Value, Compare, CacheLines>::makeIterator(Leaf* leaf, int index) const
+{
+    if(leaf != NULL && index == leaf->count) {
+        leaf = leaf->next;
+        index = 0;
+    }
+    return iterator(leaf, index, this);
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+void BPlusTree<Key, Value, Compare, CacheLines>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    insertPair(keyValuePair);
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+void BPlusTree<Key, Value, Compare, CacheLines>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    insertPair(std::move(keyValuePair));
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+template<typename ForwardIt>
+void BPlusTree<Key, Value, Compare, CacheLines>::insert(ForwardIt first, ForwardIt last)
+{
+    for(; first != last; ++first) insertPair(*first);
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already
+* present. A full leaf is split in half and the new right half's first
+* key is pushed up as a separator, splitting full parents in turn.
+*/
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+template<typename P>
+void BPlusTree<Key, Value, Compare, CacheLines>::insertPair(P&& keyValuePair)
+{
+    if(root_ == NULL) {
+        root_ = head_ = tail_ = newLeaf();
+    }
+
+    Path path;
+    Leaf* leaf = descend(keyValuePair.first, &path);
+    int pos = Search::countLess(leaf->keys, leaf->count, keyValuePair.first, comp_);
+    if(pos < leaf->count && !comp_(keyValuePair.first, leaf->keys[pos])) {
+        item(leaf, pos).second = std::forward<P>(keyValuePair).second; // overwrite value
+        return;
+    }
+
+    // Build the item first so that a throwing constructor leaves the
+    // tree untouched
+    Item fresh(std::forward<P>(keyValuePair));
+
+    Leaf* target = leaf;
+    Leaf* right = NULL;
+    if(leaf->count == LeafSlots) {
+        right = newLeaf();
+        int mid = (LeafSlots + 1) / 2;
+        for(int i = mid; i < LeafSlots; ++i) moveItem(leaf, i, right, i - mid);
+        right->count = static_cast<uint16_t>(LeafSlots - mid);
+        leaf->count = static_cast<uint16_t>(mid);
+
+        right->next = leaf->next;
+        right->prev = leaf;
+        if(leaf->next != NULL) leaf->next->prev = right;
+        else tail_ = right;
+        leaf->next = right;
+
+        if(pos >= mid) {
+            target = right;
+            pos -= mid;
+        }
+    }
+
+    for(int i = target->count; i > pos; --i) moveItem(target, i - 1, target, i);
+    ::new(static_cast<void*>(&target->items[pos])) Item(std::move(fresh));
+    target->keys[pos] = item(target, pos).first;
+    ++target->count;
+    ++size_;
+
+    if(right != NULL) {
+        insertIntoParent(path, right->keys[0], right);
+    }
+}
+
+/**
+* Adds separator and the new node right after the child taken at the
+* last step of path, splitting inner nodes upward as they overflow
+*/
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+void BPlusTree<Key, Value, Compare, CacheLines>::insertIntoParent(Path& path, const Key& separator, NodeHeader* right)
+{
+    Key key = separator;
+    while(true) {
+        if(path.empty()) {
+            Inner* newRoot = newInner();
+            newRoot->keys[0] = key;
+            newRoot->children[0] = root_;
+            newRoot->children[1] = right;
+            newRoot->count = 1;
+            root_ = newRoot;
+            return;
+        }
+
+        Inner* node = path.back().node;
+        int pos = path.back().child;
+        path.pop_back();
+
+        if(node->count < InnerSlots) {
+            for(int i = node->count; i > pos; --i) {
+                node->keys[i] = node->keys[i - 1];
+                node->children[i + 1] = node->children[i];
+            }
+            node->keys[pos] = key;
+            node->children[pos + 1] = right;
+            ++node->count;
+            return;
+        }
+
+        // Full: lay out all InnerSlots + 1 keys, keep the lower half,
+        // move the upper half to a new node and push the middle key up
+        Key keys[InnerSlots + 1];
+        NodeHeader* children[InnerSlots + 2];
+        for(int i = 0, j = 0; i <= InnerSlots; ++i) {
+            keys[i] = (i == pos) ? key : node->keys[j++];
+        }
+        for(int i = 0, j = 0; i <= InnerSlots + 1; ++i) {
+            children[i] = (i == pos + 1) ? right : node->children[j++];
+        }
+
+        int mid = (InnerSlots + 1) / 2;
+        Inner* sibling = newInner();
+        node->count = static_cast<uint16_t>(mid);
+        for(int i = 0; i < mid; ++i) node->keys[i] = keys[i];
+        for(int i = 0; i <= mid; ++i) node->children[i] = children[i];
+        sibling->count = static_cast<uint16_t>(InnerSlots - mid);
+        for(int i = mid + 1; i <= InnerSlots; ++i) sibling->keys[i - mid - 1] = keys[i];
+        for(int i = mid + 1; i <= InnerSlots + 1; ++i) sibling->children[i - mid - 1] = children[i];
+
+        key = keys[mid];
+        right = sibling;
+    }
+}
+
+/**
+* Removes the key if present. A leaf left less than half full borrows
+* an item from a sibling, or else merges with it, and the parent is
+* fixed up the same way. Stale separators are harmless: they still
+* route every key to the right leaf.
+*/
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+void BPlusTree<Key, Value, Compare, CacheLines>::remove(const Key& key)
+{
+    if(root_ == NULL) return;
+
+    Path path;
+    Leaf* leaf = descend(key, &path);
+    int pos = Search::countLess(leaf->keys, leaf->count, key, comp_);
+    if(pos == leaf->count || comp_(key, leaf->keys[pos])) return;
+
+    item(leaf, pos).~Item();
+    for(int i = pos + 1; i < leaf->count; ++i) moveItem(leaf, i, leaf, i - 1);
+    --leaf->count;
+    --size_;
+
+    if(path.empty()) {
+        if(leaf->count == 0) {
+            delete leaf;
+            root_ = NULL;
+            head_ = tail_ = NULL;
+        }
+        return;
+    }
+    if(leaf->count < MinLeaf) {
+        fixLeafUnderflow(leaf, path);
+    }
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+void BPlusTree<Key, Value, Compare, CacheLines>::fixLeafUnderflow(Leaf* leaf, Path& path)
+{
+    Inner* parent = path.back().node;
+    int idx = path.back().child;
+    path.pop_back();
+    Leaf* left = (idx > 0) ? static_cast<Leaf*>(parent->children[idx - 1]) : NULL;
+    Leaf* right = (idx < parent->count) ? static_cast<Leaf*>(parent->children[idx + 1]) : NULL;
+
+    if(left != NULL && left->count > MinLeaf) {
+        for(int i = leaf->count; i > 0; --i) moveItem(leaf, i - 1, leaf, i);
+        moveItem(left, left->count - 1, leaf, 0);
+        --left->count;
+        ++leaf->count;
+        parent->keys[idx - 1] = leaf->keys[0];
+        return;
+    }
+    if(right != NULL && right->count > MinLeaf) {
+        moveItem(right, 0, leaf, leaf->count);
+        for(int i = 1; i < right->count; ++i) moveItem(right, i, right, i - 1);
+        --right->count;
+        ++leaf->count;
+        parent->keys[idx] = right->keys[0];
+        return;
+    }
+
+    // Merge the right one of the pair into the left one
+    Leaf* into = (left != NULL) ? left : leaf;
+    Leaf* from = (left != NULL) ? leaf : right;
+    int fromIdx = (left != NULL) ? idx : idx + 1;
+    for(int i = 0; i < from->count; ++i) moveItem(from, i, into, into->count + i);
+    into->count = static_cast<uint16_t>(into->count + from->count);
+    into->next = from->next;
+    if(from->next != NULL) from->next->prev = into;
+    else tail_ = into;
+    delete from;
+
+    removeFromInner(parent, fromIdx - 1, fromIdx);
+    if(parent == root_) {
+        if(parent->count == 0) {
+            root_ = parent->children[0];
+            delete parent;
+        }
+    }
+    else if(parent->count < MinInner) {
+        fixInnerUnderflow(parent, path);
+    }
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+void BPlusTree<Key, Value, Compare, CacheLines>::fixInnerUnderflow(Inner* node, Path& path)
+{
+    while(true) {
+        Inner* parent = path.back().node;
+        int idx = path.back().child;
+        path.pop_back();
+        Inner* left = (idx > 0) ? static_cast<Inner*>(parent->children[idx - 1]) : NULL;
+        Inner* right = (idx < parent->count) ? static_cast<Inner*>(parent->children[idx + 1]) : NULL;
+
+        if(left != NULL && left->count > MinInner) {
+            // Rotate right through the parent's separator
+            for(int i = node->count; i > 0; --i) node->keys[i] = node->keys[i - 1];
+            for(int i = node->count + 1; i > 0; --i) node->children[i] = node->children[i - 1];
+            node->keys[0] = parent->keys[idx - 1];
+            node->children[0] = left->children[left->count];
+            parent->keys[idx - 1] = left->keys[left->count - 1];
+            --left->count;
+            ++node->count;
+            return;
+        }
+        if(right != NULL && right->count > MinInner) {
+            // Rotate left through the parent's separator
+            node->keys[node->count] = parent->keys[idx];
+            node->children[node->count + 1] = right->children[0];
+            parent->keys[idx] = right->keys[0];
+            for(int i = 1; i < right->count; ++i) right->keys[i - 1] = right->keys[i];
+            for(int i = 1; i <= right->count; ++i) right->children[i - 1] = right->children[i];
+            --right->count;
+            ++node->count;
+            return;
+        }
+
+        // Merge the right one of the pair into the left one, pulling
+        // their separator down between them
+        Inner* into = (left != NULL) ? left : node;
+        Inner* from = (left != NULL) ? node : right;
+        int fromIdx = (left != NULL) ? idx : idx + 1;
+        into->keys[into->count] = parent->keys[fromIdx - 1];
+        for(int i = 0; i < from->count; ++i) into->keys[into->count + 1 + i] = from->keys[i];
+        for(int i = 0; i <= from->count; ++i) into->children[into->count + 1 + i] = from->children[i];
+        into->count = static_cast<uint16_t>(into->count + 1 + from->count);
+        delete from;
+
+        removeFromInner(parent, fromIdx - 1, fromIdx);
+        if(parent == root_) {
+            if(parent->count == 0) {
+                root_ = parent->children[0];
+                delete parent;
+            }
+            return;
+        }
+        if(parent->count >= MinInner) return;
+        node = parent;
+    }
+}
+
+/**
+* Drops key keyIndex and child childIndex from an inner node
+*/
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+void BPlusTree<Key, Value, Compare, CacheLines>::removeFromInner(Inner* node, int keyIndex, int childIndex)
+{
+    for(int i = keyIndex + 1; i < node->count; ++i) node->keys[i - 1] = node->keys[i];
+    for(int i = childIndex + 1; i <= node->count; ++i) node->children[i - 1] = node->children[i];
+    --node->count;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::iterator
+BPlusTree<Key, Value, Compare, CacheLines>::find(const Key& key) const
+{
+    if(root_ == NULL) return iterator(NULL, 0, this);
+    Leaf* leaf = descend(key, NULL);
+    int pos = Search::countLess(leaf->keys, leaf->count, key, comp_);
+    if(pos == leaf->count || comp_(key, leaf->keys[pos])) return iterator(NULL, 0, this);
+    return iterator(leaf, pos, this);
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+bool BPlusTree<Key, Value, Compare, CacheLines>::contains(const Key& key) const
+{
+    return find(key) != end();
+}
+
+/**
+* Returns a pointer to the value stored under key, or NULL if key is
+* not in the tree
+*/
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+Value* BPlusTree<Key, Value, Compare, CacheLines>::lookup(const Key& key)
+{
+    iterator it = find(key);
+    return it == end() ? NULL : &it->second;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+const Value* BPlusTree<Key, Value, Compare, CacheLines>::lookup(const Key& key) const
+{
+    iterator it = find(key);
+    return it == iterator(NULL, 0, this) ? NULL : &it->second;
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::iterator
+BPlusTree<Key, Value, Compare, CacheLines>::lower_bound(const Key& key) const
+{
+    if(root_ == NULL) return iterator(NULL, 0, this);
+    Leaf* leaf = descend(key, NULL);
+    return makeIterator(leaf, Search::countLess(leaf->keys, leaf->count, key, comp_));
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::iterator
+BPlusTree<Key, Value, Compare, CacheLines>::upper_bound(const Key& key) const
+{
+    if(root_ == NULL) return iterator(NULL, 0, this);
+    Leaf* leaf = descend(key, NULL);
+    return makeIterator(leaf, Search::countNotGreater(leaf->keys, leaf->count, key, comp_));
+}
+
+/**
+* Calls visit(item) on every item with a key in [lo, hi), in key order:
+* one descent, then straight along the linked leaves
+*/
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+template<typename Visitor>
+void BPlusTree<Key, Value, Compare, CacheLines>::scan(const Key& lo, const Key& hi, Visitor visit) const
+{
+    if(root_ == NULL || !comp_(lo, hi)) return;
+    Leaf* leaf = descend(lo, NULL);
+    int i = Search::countLess(leaf->keys, leaf->count, lo, comp_);
+    while(leaf != NULL) {
+        int stop = Search::countLess(leaf->keys, leaf->count, hi, comp_);
+        for(; i < stop; ++i) visit(item(leaf, i));
+        if(stop < leaf->count) return;
+        leaf = leaf->next;
+        i = 0;
+    }
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::iterator
+BPlusTree<Key, Value, Compare, CacheLines>::begin()
+{
+    return iterator(head_, 0, this);
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::iterator
+BPlusTree<Key, Value, Compare, CacheLines>::end()
+{
+    return iterator(NULL, 0, this);
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::const_iterator
+BPlusTree<Key, Value, Compare, CacheLines>::begin() const
+{
+    return const_iterator(head_, 0, this);
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::const_iterator
+BPlusTree<Key, Value, Compare, CacheLines>::end() const
+{
+    return const_iterator(NULL, 0, this);
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::const_iterator
+BPlusTree<Key, Value, Compare, CacheLines>::cbegin() const
+{
+    return begin();
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::const_iterator
+BPlusTree<Key, Value, Compare, CacheLines>::cend() const
+{
+    return end();
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::reverse_iterator
+BPlusTree<Key, Value, Compare, CacheLines>::rbegin()
+{
+    return reverse_iterator(end());
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::reverse_iterator
+BPlusTree<Key, Value, Compare, CacheLines>::rend()
+{
+    return reverse_iterator(begin());
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::const_reverse_iterator
+BPlusTree<Key, Value, Compare, CacheLines>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+typename BPlusTree<Key, Value, Compare, CacheLines>::const_reverse_iterator
+BPlusTree<Key, Value, Compare, CacheLines>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+bool BPlusTree<Key, Value, Compare, CacheLines>::isBalanced() const
+{
+    return verify().balanced;
+}
+
+/**
+* Checks that keys are sorted within and across nodes, that every
+* separator bounds its subtrees, that all leaves sit at the same depth,
+* that non-root nodes are at least half full and that the leaf chain
+* visits every item in order. height is the number of levels.
+*/
+template<typename Key, typename Value, typename Compare, size_t CacheLines>
+TreeReport BPlusTree<Key, Value, Compare, CacheLines>::verify() const
+{
+    struct Frame
+    {
+        const NodeHeader* node;
+        int depth;
+        const Key* lo;  // keys must be >= *lo, if set
+        const Key* hi;  // and < *hi, if set
+    };
+
+    TreeReport report;
+    if(root_ == NULL) {
+        if(head_ != NULL || tail_ != NULL || size_ != 0) {
+            report.valid = false;
+            report.error = "empty tree has leaves or a non-zero size";
+        }
+        return report;
+    }
+
+    std::vector<Frame> stack;
+    Frame first = { root_, 1, NULL, NULL };
+    stack.push_back(first);
+    int leafDepth = -1;
+    std::vector<const Leaf*> leaves;
+
+    while(!stack.empty()) {
+        Frame f = stack.back();
+        stack.pop_back();
+        const Key* keys = f.node->leaf ? static_cast<const Leaf*>(f.node)->keys : static_cast<const Inner*>(f.node)->keys;
+        int n = f.node->count;
+        int minimum = f.node->leaf ? MinLeaf : MinInner;
+        if(f.node != root_ && n < minimum) {
+            report.valid = false;
+            report.error = "non-root node is less than half full";
+            return report;
+        }
+        for(int i = 0; i < n; ++i) {
+            if((i > 0 && !comp_(keys[i - 1], keys[i])) ||
+               (f.lo != NULL && comp_(keys[i], *f.lo)) ||
+               (f.hi != NULL && !comp_(keys[i], *f.hi))) {
+                report.valid = false;
+                report.error = "keys are out of order or outside their separators";
+                return report;
+            }
+        }
+
+        if(f.node->leaf) {
+            const Leaf* leaf = static_cast<const Leaf*>(f.node);
+            report.nodeCount += n;
+            for(int i = 0; i < n; ++i) {
+                if(comp_(leaf->keys[i], item(const_cast<Leaf*>(leaf), i).first) ||
+                   comp_(item(const_cast<Leaf*>(leaf), i).first, leaf->keys[i])) {
+                    report.valid = false;
+                    report.error = "leaf key array does not match its items";
+                    return report;
+                }
+            }
+            if(leafDepth == -1) leafDepth = f.depth;
+            else if(leafDepth != f.depth) {
+                report.balanced = false;
+                report.valid = false;
+                report.error = "leaves are at different depths";
+                return report;
+            }
+            leaves.push_back(leaf);
+            continue;
+        }
+
+        const Inner* inner = static_cast<const Inner*>(f.node);
+        if(n == 0) {
+            report.valid = false;
+            report.error = "inner node has no keys";
+            return report;
+        }
+        // Push right to left so that leaves come off the stack in order
+        for(int i = n; i >= 0; --i) {
+            Frame child = { inner->children[i], f.depth + 1,
+                            i > 0 ? &inner->keys[i - 1] : f.lo,
+                            i < n ? &inner->keys[i] : f.hi };
+            stack.push_back(child);
+        }
+    }
+
+    const Leaf* prev = NULL;
+    for(size_t i = 0; i < leaves.size(); ++i) {
+        if(leaves[i]->prev != prev || (prev != NULL && prev->next != leaves[i])) {
+            report.valid = false;
+            report.error = "leaf chain does not match the tree";
+            return report;
+        }
+        prev = leaves[i];
+    }
+    if(head_ != leaves.front() || tail_ != leaves.back() || tail_->next != NULL) {
+        report.valid = false;
+        report.error = "leaf chain ends do not match the tree";
+        return report;
+    }
+    if(report.nodeCount != size_) {
+        report.valid = false;
+        report.error = "item count does not match size()";
+        return report;
+    }
+    report.height = leafDepth;
+    return report;
+}
+
+/*
+----------------------------------------------
+End implementations for the BPlusTree class.
+----------------------------------------------
+*/
+
+#endif
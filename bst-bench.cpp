@@ -0,0 +1,1171 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <sstream>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bst.h"
+#include "bstparallel.h"
+#include "bstio.h"
+#include "avlbst.h"
+#include "rbbst.h"
+#include "splaybst.h"
+#include "slaballoc.h"
+#include "compactavl.h"
+#include "frozentree.h"
+#include "bplustree.h"
+#include "concurrentavl.h"
+#include "persistentavl.h"
+#include "multiwriteravl.h"
+#include "mappedavl.h"
+#include "durableavl.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+// Nanoseconds per operation for `ops` operations started at `start`
+static double nsPerOp(Clock::time_point start, size_t ops)
+{
+    chrono::duration<double, nano> elapsed = Clock::now() - start;
+    return elapsed.count() / ops;
+}
+
+// A borrowed view of characters, e.g. a token in a parse buffer
+struct CharRange
+{
+    const char* data;
+    size_t size;
+};
+
+// Orders strings and also compares them against CharRange in place
+struct StringLess
+{
+    typedef void is_transparent;
+    static int compare(const char* a, size_t na, const char* b, size_t nb)
+    {
+        int r = memcmp(a, b, min(na, nb));
+        return r != 0 ? r : (na < nb ? -1 : (na > nb ? 1 : 0));
+    }
+    bool operator()(const string& a, const string& b) const { return a < b; }
+    bool operator()(const string& a, const CharRange& b) const { return compare(a.data(), a.size(), b.data, b.size) < 0; }
+    bool operator()(const CharRange& a, const string& b) const { return compare(a.data, a.size, b.data(), b.size()) < 0; }
+};
+
+static vector<int> shuffledKeys(size_t n, unsigned seed)
+{
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) keys[i] = (int)i;
+    shuffle(keys.begin(), keys.end(), mt19937(seed));
+    return keys;
+}
+
+// Per-op cost of AVLTree insert/find/remove as the tree grows. With
+// O(log n) updates these numbers should grow only slowly with n.
+static void benchAVLScaling()
+{
+    cout << "AVLTree<int,int> per-op cost (ns)" << endl;
+    cout << setw(10) << "n" << setw(12) << "insert"
+         << setw(12) << "find" << setw(12) << "remove" << endl;
+
+    for(size_t n = 10000; n <= 1000000; n *= 10) {
+        vector<int> keys = shuffledKeys(n, 42);
+        AVLTree<int,int> tree;
+
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < n; ++i) tree.insert(make_pair(keys[i], keys[i]));
+        double insertNs = nsPerOp(start, n);
+
+        long sum = 0;
+        start = Clock::now();
+        for(size_t i = 0; i < n; ++i) sum += tree.find(keys[i])->second;
+        double findNs = nsPerOp(start, n);
+
+        start = Clock::now();
+        for(size_t i = 0; i < n; ++i) tree.remove(keys[i]);
+        double removeNs = nsPerOp(start, n);
+
+        cout << setw(10) << n << fixed << setprecision(1)
+             << setw(12) << insertNs << setw(12) << findNs
+             << setw(12) << removeNs << "   (checksum " << sum << ")" << endl;
+    }
+    cout << endl;
+}
+
+// Builds a tree, churns it with remove/insert pairs and tears it down,
+// timing each phase. Used to compare node allocators.
+template<typename Tree>
+static void benchChurn(const char* name, size_t n)
+{
+    vector<int> keys = shuffledKeys(n, 7);
+    Tree* tree = new Tree;
+
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) tree->insert(make_pair(keys[i], keys[i]));
+    double buildNs = nsPerOp(start, n);
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree->remove(keys[i]);
+        tree->insert(make_pair(keys[i], keys[i]));
+    }
+    double churnNs = nsPerOp(start, n);
+
+    start = Clock::now();
+    delete tree;
+    chrono::duration<double, milli> teardown = Clock::now() - start;
+
+    cout << setw(10) << name << fixed << setprecision(1)
+         << setw(12) << buildNs << setw(12) << churnNs
+         << setw(14) << teardown.count() << endl;
+}
+
+static void benchAllocators()
+{
+    const size_t n = 1000000;
+    cout << "AVLTree<int,int> allocators, n = " << n << endl;
+    cout << setw(10) << "allocator" << setw(12) << "insert ns"
+         << setw(12) << "churn ns" << setw(14) << "teardown ms" << endl;
+    benchChurn<AVLTree<int,int> >("default", n);
+    benchChurn<AVLTree<int,int,less<int>,SlabAllocator<pair<const int,int> > > >("slab", n);
+    cout << endl;
+}
+
+// Node footprint and the cost of a pointer-chasing lookup
+static void benchNodeLayout()
+{
+    const size_t n = 1000000;
+    cout << "Node layout" << endl;
+    cout << "  sizeof(Node<int,int>)    = " << sizeof(Node<int,int>) << endl;
+    cout << "  sizeof(AVLNode<int,int>) = " << sizeof(AVLNode<int,int>) << endl;
+
+    vector<int> keys = shuffledKeys(n, 11);
+    AVLTree<int,int,less<int>,SlabAllocator<pair<const int,int> > > tree;
+    for(size_t i = 0; i < n; ++i) tree.insert(make_pair(keys[i], keys[i]));
+
+    shuffle(keys.begin(), keys.end(), mt19937(12));
+    long sum = 0;
+    Clock::time_point start = Clock::now();
+    for(int rep = 0; rep < 3; ++rep) {
+        for(size_t i = 0; i < n; ++i) sum += tree.find(keys[i])->second;
+    }
+    cout << "  find, n = " << n << ": " << fixed << setprecision(1)
+         << nsPerOp(start, 3 * n) << " ns/op   (checksum " << sum << ")" << endl;
+    cout << endl;
+}
+
+// Reloading a sorted snapshot: one insert per key vs. the range constructor
+static void benchSortedLoad()
+{
+    typedef AVLTree<int,int,less<int>,SlabAllocator<pair<const int,int> > > SlabAVL;
+    const size_t n = 1000000;
+    vector<pair<int,int> > items(n);
+    for(size_t i = 0; i < n; ++i) items[i] = make_pair((int)i, (int)i);
+
+    cout << "Sorted load, n = " << n << " (teardown not included)" << endl;
+    {
+        Clock::time_point start = Clock::now();
+        SlabAVL tree;
+        for(size_t i = 0; i < n; ++i) tree.insert(items[i]);
+        cout << "  insert loop:       " << fixed << setprecision(1)
+             << nsPerOp(start, n) << " ns/key" << endl;
+    }
+    {
+        Clock::time_point start = Clock::now();
+        SlabAVL tree(items.begin(), items.end());
+        cout << "  range constructor: " << fixed << setprecision(1)
+             << nsPerOp(start, n) << " ns/key" << endl;
+    }
+    cout << endl;
+}
+
+// Batches of random keys into a 1M-key tree: per-pair insert loop vs.
+// insert(first, last), which merges once the batch is large enough
+static void benchBatchInsert()
+{
+    typedef AVLTree<int,int,less<int>,SlabAllocator<pair<const int,int> > > SlabAVL;
+    const size_t n = 1000000;
+    vector<int> keys = shuffledKeys(2 * n, 21);
+    vector<pair<int,int> > base(n);
+    for(size_t i = 0; i < n; ++i) base[i] = make_pair(2 * (int)i, 0);
+
+    cout << "Batch insert into " << n << " keys (ns per batch pair)" << endl;
+    cout << setw(10) << "batch" << setw(12) << "loop" << setw(12) << "batched" << endl;
+    for(size_t m = 10000; m <= 1000000; m *= 10) {
+        vector<pair<int,int> > batch(m);
+        for(size_t i = 0; i < m; ++i) batch[i] = make_pair(keys[i], 1);
+
+        SlabAVL loopTree(base.begin(), base.end());
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < m; ++i) loopTree.insert(batch[i]);
+        double loopNs = nsPerOp(start, m);
+
+        SlabAVL batchTree(base.begin(), base.end());
+        start = Clock::now();
+        batchTree.insert(batch.begin(), batch.end());
+        double batchNs = nsPerOp(start, m);
+
+        cout << setw(10) << m << fixed << setprecision(1)
+             << setw(12) << loopNs << setw(12) << batchNs << endl;
+    }
+    cout << endl;
+}
+
+// Order-statistic queries on a 1M-key tree
+static void benchOrderStatistics()
+{
+    const size_t n = 1000000;
+    vector<int> keys = shuffledKeys(n, 31);
+    AVLTree<int,int,less<int>,SlabAllocator<pair<const int,int> > > tree;
+    for(size_t i = 0; i < n; ++i) tree.insert(make_pair(keys[i], keys[i]));
+
+    cout << "Order statistics, n = " << tree.size() << endl;
+    size_t sum = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) sum += tree.rank(keys[i]);
+    cout << "  rank:   " << fixed << setprecision(1) << nsPerOp(start, n) << " ns/op" << endl;
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) sum += tree.select((size_t)keys[i])->second;
+    cout << "  select: " << fixed << setprecision(1) << nsPerOp(start, n) << " ns/op" << endl;
+
+    start = Clock::now();
+    for(size_t i = 0; i + 1 < n; i += 2) sum += tree.count(min(keys[i], keys[i + 1]), max(keys[i], keys[i + 1]));
+    cout << "  count:  " << fixed << setprecision(1) << nsPerOp(start, n / 2)
+         << " ns/op   (checksum " << sum << ")" << endl;
+    cout << endl;
+}
+
+// Looking up borrowed character ranges in a string-keyed tree.
+// std::less<string> needs a std::string built for every probe (these
+// keys are too long for the small-string buffer); a transparent
+// comparator compares against the range in place.
+template<typename Tree, typename Probe>
+static double benchStringFind(const vector<string>& keys, const vector<int>& order, Probe probe)
+{
+    Tree tree;
+    for(size_t i = 0; i < keys.size(); ++i) tree.insert(make_pair(keys[i], (int)i));
+    size_t hits = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < order.size(); ++i) {
+        const string& k = keys[order[i]];
+        CharRange range = { k.data(), k.size() };
+        hits += tree.find(probe(range)) != tree.end();
+    }
+    double ns = nsPerOp(start, order.size());
+    if(hits != order.size()) cout << "  missed keys!" << endl;
+    return ns;
+}
+
+static string toString(const CharRange& r) { return string(r.data, r.size); }
+static CharRange asRange(const CharRange& r) { return r; }
+
+static void benchHeterogeneousFind()
+{
+    cout << "find(CharRange) on string keys (ns/op)" << endl;
+    cout << setw(10) << "n" << setw(20) << "std::less<string>" << setw(14) << "transparent" << endl;
+    for(size_t n = 1000; n <= 1000000; n *= 10) {
+        vector<string> keys(n);
+        for(size_t i = 0; i < n; ++i) keys[i] = "customer-record-" + to_string(i);
+        vector<int> order = shuffledKeys(n, 41);
+        for(size_t i = 0; order.size() < 1000000; ++i) order.push_back(order[i]);
+
+        double plain = benchStringFind<AVLTree<string,int> >(keys, order, toString);
+        double transparent = benchStringFind<AVLTree<string,int,StringLess> >(keys, order, asRange);
+        cout << setw(10) << n << fixed << setprecision(1)
+             << setw(20) << plain << setw(14) << transparent << endl;
+    }
+    cout << endl;
+}
+
+// Full traversals forwards and backwards. Each step walks to the
+// successor or predecessor, which visits every edge twice per pass, so
+// the cost per step should stay flat as n grows (apart from cache
+// effects). The last column fetches the 10 largest entries through
+// rbegin() instead of copying the tree into a vector.
+static void benchTraversal()
+{
+    cout << "Traversal cost (ns per step)" << endl;
+    cout << setw(10) << "n" << setw(12) << "forward" << setw(12) << "reverse"
+         << setw(16) << "last 10 copy" << setw(16) << "last 10 rbegin" << endl;
+    for(size_t n = 1000; n <= 1000000; n *= 10) {
+        vector<pair<int,int> > items(n);
+        for(size_t i = 0; i < n; ++i) items[i] = make_pair((int)i, (int)i);
+        const AVLTree<int,int> tree(items.begin(), items.end());
+        const size_t passes = 10000000 / n;
+
+        long long sum = 0;
+        Clock::time_point start = Clock::now();
+        for(size_t p = 0; p < passes; ++p) {
+            for(AVLTree<int,int>::const_iterator it = tree.begin(); it != tree.end(); ++it) sum += it->second;
+        }
+        double forward = nsPerOp(start, passes * n);
+
+        start = Clock::now();
+        for(size_t p = 0; p < passes; ++p) {
+            for(AVLTree<int,int>::const_reverse_iterator it = tree.rbegin(); it != tree.rend(); ++it) sum += it->second;
+        }
+        double reverse = nsPerOp(start, passes * n);
+
+        const size_t queries = 100;
+        start = Clock::now();
+        for(size_t q = 0; q < queries; ++q) {
+            vector<pair<int,int> > all(tree.begin(), tree.end());
+            for(size_t i = all.size() - 10; i < all.size(); ++i) sum += all[i].second;
+        }
+        double copyUs = nsPerOp(start, queries) / 1000;
+
+        start = Clock::now();
+        for(size_t q = 0; q < queries; ++q) {
+            AVLTree<int,int>::const_reverse_iterator it = tree.rbegin();
+            for(int i = 0; i < 10; ++i, ++it) sum += it->second;
+        }
+        double rbeginUs = nsPerOp(start, queries) / 1000;
+
+        cout << setw(10) << n << fixed << setprecision(2)
+             << setw(12) << forward << setw(12) << reverse
+             << setw(13) << copyUs << " us" << setw(13) << rbeginUs << " us"
+             << "   (checksum " << sum << ")" << endl;
+    }
+    cout << endl;
+}
+
+// AVLTree against CompactAVLTree for 32-bit keys and values. Bytes per
+// node count the pool's spare capacity, but not malloc's per-block
+// header, which the default allocator adds to every AVLNode.
+template<typename Tree>
+static void benchCompactRow(const char* name, const vector<uint32_t>& keys, double bytesPerNode)
+{
+    const size_t n = keys.size();
+    Tree tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) tree.insert(make_pair(keys[i], keys[i]));
+    double insertNs = nsPerOp(start, n);
+
+    size_t sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) sum += tree.find(keys[(i * 7919) % n])->second;
+    double findNs = nsPerOp(start, n);
+
+    start = Clock::now();
+    for(typename Tree::const_iterator it = tree.begin(); it != tree.end(); ++it) sum += it->second;
+    double scanNs = nsPerOp(start, n);
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) tree.remove(keys[i]);
+    double removeNs = nsPerOp(start, n);
+
+    cout << setw(10) << name << fixed << setprecision(1) << setw(10) << bytesPerNode
+         << setw(10) << insertNs << setw(10) << findNs << setw(10) << scanNs
+         << setw(10) << removeNs << "   (checksum " << sum << ")" << endl;
+}
+
+static void benchCompact()
+{
+    const size_t n = 1000000;
+    vector<uint32_t> keys(n);
+    for(size_t i = 0; i < n; ++i) keys[i] = (uint32_t)i;
+    shuffle(keys.begin(), keys.end(), mt19937(51));
+
+    size_t pool = 16;
+    while(pool < n) pool *= 2;
+    typedef CompactAVLTree<uint32_t,uint32_t> Compact;
+
+    cout << "Compact node pool, n = " << n << " (ns/op)" << endl;
+    cout << setw(10) << "tree" << setw(10) << "bytes" << setw(10) << "insert"
+         << setw(10) << "find" << setw(10) << "scan" << setw(10) << "remove" << endl;
+    benchCompactRow<AVLTree<uint32_t,uint32_t> >("AVLTree", keys, sizeof(AVLNode<uint32_t,uint32_t>));
+    benchCompactRow<Compact>("compact", keys, (double)pool * Compact::nodeBytes() / n);
+    cout << endl;
+}
+
+// Lookups in a live AVLTree against its freeze() snapshot, with the
+// same shuffled probes. Half of the probes miss.
+static void benchFrozen()
+{
+    cout << "Frozen snapshot vs live tree (ns/op)" << endl;
+    cout << setw(10) << "n" << setw(12) << "live find" << setw(14) << "frozen find"
+         << setw(12) << "live lb" << setw(14) << "frozen lb" << setw(14) << "freeze ms" << endl;
+    for(size_t n = 1000; n <= 1000000; n *= 10) {
+        vector<pair<int,int> > items(n);
+        for(size_t i = 0; i < n; ++i) items[i] = make_pair(2 * (int)i, (int)i);
+        AVLTree<int,int> tree;
+        vector<int> order = shuffledKeys(n, 61);
+        for(size_t i = 0; i < n; ++i) tree.insert(items[order[i]]);
+
+        Clock::time_point start = Clock::now();
+        FrozenTree<int,int> frozen = tree.freeze();
+        double freezeMs = nsPerOp(start, 1) / 1e6;
+
+        const size_t probes = 2000000;
+        vector<int> keys(probes);
+        mt19937 rng(62);
+        for(size_t i = 0; i < probes; ++i) keys[i] = (int)(rng() % (2 * n));
+
+        size_t sum = 0;
+        start = Clock::now();
+        for(size_t i = 0; i < probes; ++i) sum += tree.find(keys[i]) != tree.end();
+        double liveFind = nsPerOp(start, probes);
+
+        start = Clock::now();
+        for(size_t i = 0; i < probes; ++i) sum += frozen.find(keys[i]) != frozen.end();
+        double frozenFind = nsPerOp(start, probes);
+
+        start = Clock::now();
+        for(size_t i = 0; i < probes; ++i) sum += tree.lower_bound(keys[i]) != tree.end();
+        double liveLb = nsPerOp(start, probes);
+
+        start = Clock::now();
+        for(size_t i = 0; i < probes; ++i) sum += frozen.lower_bound(keys[i]) != frozen.end();
+        double frozenLb = nsPerOp(start, probes);
+
+        cout << setw(10) << n << fixed << setprecision(1)
+             << setw(12) << liveFind << setw(14) << frozenFind
+             << setw(12) << liveLb << setw(14) << frozenLb
+             << setw(14) << freezeMs << "   (checksum " << sum << ")" << endl;
+    }
+    cout << endl;
+}
+
+// The B+ tree and AVLTree swapped behind one typedef. "range" reads
+// 100 items from a lower_bound; the "B+ scalar" row uses a plain
+// comparator struct, which turns off the SSE2 in-node search.
+struct PlainIntLess
+{
+    bool operator()(int a, int b) const { return a < b; }
+};
+
+// Key is the tree's key type; the int keys are converted to it
+template<typename Tree, typename Key = int>
+static void benchHeadToHeadRow(const char* name, const vector<int>& keys)
+{
+    const size_t n = keys.size();
+    Tree tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) tree.insert(make_pair(Key(keys[i]), keys[i]));
+    double insertNs = nsPerOp(start, n);
+
+    size_t sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) sum += tree.find(Key(keys[(i * 7919) % n]))->second;
+    double findNs = nsPerOp(start, n);
+
+    const size_t ranges = n / 10;
+    start = Clock::now();
+    for(size_t i = 0; i < ranges; ++i) {
+        typename Tree::iterator it = tree.lower_bound(Key(keys[(i * 7919) % n]));
+        for(int j = 0; j < 100 && it != tree.end(); ++j, ++it) sum += it->second;
+    }
+    double rangeNs = nsPerOp(start, ranges);
+
+    start = Clock::now();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) sum += it->second;
+    double scanNs = nsPerOp(start, n);
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) tree.remove(Key(keys[i]));
+    double removeNs = nsPerOp(start, n);
+
+    cout << setw(10) << name << fixed << setprecision(1) << setw(10) << insertNs
+         << setw(10) << findNs << setw(10) << rangeNs << setw(10) << scanNs
+         << setw(10) << removeNs << "   (checksum " << sum << ")" << endl;
+}
+
+static void benchBPlusTree()
+{
+    for(size_t n = 10000; n <= 1000000; n *= 10) {
+        vector<int> keys = shuffledKeys(n, 71);
+        cout << "B+ tree vs AVLTree, n = " << n << " (ns/op)" << endl;
+        cout << setw(10) << "tree" << setw(10) << "insert" << setw(10) << "find"
+             << setw(10) << "range" << setw(10) << "scan" << setw(10) << "remove" << endl;
+        benchHeadToHeadRow<AVLTree<int,int> >("AVLTree", keys);
+        benchHeadToHeadRow<BPlusTree<int,int> >("B+ tree", keys);
+        benchHeadToHeadRow<BPlusTree<int,int,PlainIntLess> >("B+ scalar", keys);
+        // 64-bit keys have no vectorized search and always take the
+        // binary search, as any key type but int32_t/uint32_t does
+        benchHeadToHeadRow<BPlusTree<int64_t,int>, int64_t>("B+ int64", keys);
+        cout << endl;
+    }
+}
+
+// One find() per key against findBatch() over the same batches of 256
+// shuffled probes, half of them misses
+static void benchFindBatch()
+{
+    const size_t batch = 256;
+    cout << "Batched lookups, " << batch << " keys per batch (ns/key)" << endl;
+    cout << setw(10) << "n" << setw(12) << "find" << setw(12) << "findBatch" << endl;
+    for(size_t n = 1000; n <= 1000000; n *= 10) {
+        AVLTree<int,int> tree;
+        vector<int> order = shuffledKeys(n, 81);
+        for(size_t i = 0; i < n; ++i) tree.insert(make_pair(2 * order[i], order[i]));
+
+        const size_t probes = 2000000 / batch * batch;
+        vector<int> keys(probes);
+        mt19937 rng(82);
+        for(size_t i = 0; i < probes; ++i) keys[i] = (int)(rng() % (2 * n));
+
+        size_t sum = 0;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < probes; ++i) {
+            AVLTree<int,int>::iterator it = tree.find(keys[i]);
+            if(it != tree.end()) sum += it->second;
+        }
+        double findNs = nsPerOp(start, probes);
+
+        vector<int> group(batch);
+        vector<AVLTree<int,int>::iterator> found;
+        start = Clock::now();
+        for(size_t i = 0; i < probes; i += batch) {
+            group.assign(keys.begin() + i, keys.begin() + i + batch);
+            tree.findBatch(group, found);
+            for(size_t j = 0; j < batch; ++j) {
+                if(found[j] != tree.end()) sum += found[j]->second;
+            }
+        }
+        double batchNs = nsPerOp(start, probes);
+
+        cout << setw(10) << n << fixed << setprecision(1) << setw(12) << findNs
+             << setw(12) << batchNs << "   (checksum " << sum << ")" << endl;
+    }
+    cout << endl;
+}
+
+// AVLTree behind one mutex, the way callers share it today
+class LockedAVLTree
+{
+public:
+    void insert(const pair<const int,int>& item)
+    {
+        lock_guard<mutex> lock(lock_);
+        tree_.insert(item);
+    }
+    void remove(int key)
+    {
+        lock_guard<mutex> lock(lock_);
+        tree_.remove(key);
+    }
+    bool find(int key, int& value) const
+    {
+        lock_guard<mutex> lock(lock_);
+        const int* found = tree_.lookup(key);
+        if(found == NULL) return false;
+        value = *found;
+        return true;
+    }
+private:
+    AVLTree<int,int> tree_;
+    mutable mutex lock_;
+};
+
+// Total lookups per microsecond across `readers` threads, optionally
+// with one thread writing (insert/remove of keys the readers never ask
+// for) the whole time
+template<typename Tree>
+static double readThroughput(Tree& tree, size_t n, int readers, bool writing)
+{
+    const size_t perReader = 1000000;
+    atomic<bool> stop(false);
+    thread writer;
+    if(writing) {
+        writer = thread([&]() {
+            mt19937 rng(91);
+            while(!stop.load(memory_order_relaxed)) {
+                int key = (int)(n + rng() % n);
+                if(rng() % 2) tree.insert(make_pair(key, key));
+                else tree.remove(key);
+            }
+        });
+    }
+
+    vector<thread> threads;
+    vector<size_t> hits(readers);
+    Clock::time_point start = Clock::now();
+    for(int r = 0; r < readers; ++r) {
+        threads.push_back(thread([&, r]() {
+            mt19937 rng(92 + r);
+            for(size_t i = 0; i < perReader; ++i) {
+                int value;
+                hits[r] += tree.find((int)(rng() % n), value);
+            }
+        }));
+    }
+    for(size_t i = 0; i < threads.size(); ++i) threads[i].join();
+    double us = nsPerOp(start, 1) / 1000;
+    stop = true;
+    if(writing) writer.join();
+    return readers * perReader / us;
+}
+
+static void benchConcurrentReads()
+{
+    const size_t n = 100000;
+    LockedAVLTree locked;
+    ConcurrentAVLTree<int,int> optimistic;
+    for(size_t i = 0; i < n; ++i) {
+        locked.insert(make_pair((int)i, (int)i));
+        optimistic.insert(make_pair((int)i, (int)i));
+    }
+
+    cout << "Concurrent reads, n = " << n << ", " << thread::hardware_concurrency()
+         << " hardware threads (lookups/us, all readers)" << endl;
+    cout << setw(10) << "readers" << setw(10) << "mutex" << setw(12) << "optimistic"
+         << setw(16) << "mutex+writer" << setw(16) << "optim.+writer" << endl;
+    for(int readers = 1; readers <= 8; readers *= 2) {
+        cout << setw(10) << readers << fixed << setprecision(2)
+             << setw(10) << readThroughput(locked, n, readers, false)
+             << setw(12) << readThroughput(optimistic, n, readers, false)
+             << setw(16) << readThroughput(locked, n, readers, true)
+             << setw(16) << readThroughput(optimistic, n, readers, true) << endl;
+    }
+    cout << endl;
+}
+
+// One set operation on a and b, done item by item with insert/remove
+// and with the join-based member; milliseconds for each
+template<typename Loop, typename Join>
+static void benchSetRow(const char* name, const vector<pair<int,int> >& a, const vector<pair<int,int> >& b,
+                        Loop loop, Join join)
+{
+    AVLTree<int,int> x(a.begin(), a.end()), y(b.begin(), b.end());
+    Clock::time_point start = Clock::now();
+    loop(x, y);
+    double loopMs = nsPerOp(start, 1) / 1e6;
+    size_t loopSize = x.size();
+
+    AVLTree<int,int> u(a.begin(), a.end()), v(b.begin(), b.end());
+    start = Clock::now();
+    join(u, v);
+    double joinMs = nsPerOp(start, 1) / 1e6;
+
+    cout << setw(14) << name << setw(10) << b.size() << fixed << setprecision(2)
+         << setw(12) << loopMs << setw(12) << joinMs
+         << "   (sizes " << loopSize << " " << u.size() << ")" << endl;
+}
+
+static void benchSetOperations()
+{
+    const size_t n = 1000000;
+    vector<pair<int,int> > a;
+    for(size_t i = 0; i < n; ++i) a.push_back(make_pair((int)(2 * i), 0));
+
+    cout << "Set operations on AVLTree, n = " << n << ", " << thread::hardware_concurrency()
+         << " hardware threads (ms)" << endl;
+    cout << setw(14) << "operation" << setw(10) << "m" << setw(12) << "loop" << setw(12) << "join-based" << endl;
+    for(size_t m = 1000; m <= n; m *= 1000) {
+        // Every third number over the same range, so about a third of
+        // b's keys are also in a
+        vector<pair<int,int> > b;
+        size_t step = 2 * n / m;
+        for(size_t i = 0; i < m; ++i) b.push_back(make_pair((int)(i * step + (i % 3)), 1));
+
+        benchSetRow("union", a, b,
+                    [](AVLTree<int,int>& x, AVLTree<int,int>& y) {
+                        for(AVLTree<int,int>::iterator it = y.begin(); it != y.end(); ++it) {
+                            if(!x.contains(it->first)) x.insert(*it);
+                        }
+                    },
+                    [](AVLTree<int,int>& x, AVLTree<int,int>& y) { x.setUnion(y); });
+        benchSetRow("intersection", a, b,
+                    [](AVLTree<int,int>& x, AVLTree<int,int>& y) {
+                        vector<int> drop;
+                        for(AVLTree<int,int>::iterator it = x.begin(); it != x.end(); ++it) {
+                            if(!y.contains(it->first)) drop.push_back(it->first);
+                        }
+                        for(size_t i = 0; i < drop.size(); ++i) x.remove(drop[i]);
+                    },
+                    [](AVLTree<int,int>& x, AVLTree<int,int>& y) { x.setIntersection(y); });
+        benchSetRow("difference", a, b,
+                    [](AVLTree<int,int>& x, AVLTree<int,int>& y) {
+                        for(AVLTree<int,int>::iterator it = y.begin(); it != y.end(); ++it) x.remove(it->first);
+                    },
+                    [](AVLTree<int,int>& x, AVLTree<int,int>& y) { x.setDifference(y); });
+    }
+    cout << endl;
+}
+
+// Summing every value of a large AVLTree: the iterator loop against
+// parallel_reduce and parallel_for_each on pools of 1..8 threads (the
+// calling thread included), in ns per item
+static void benchParallelTraversal()
+{
+    const size_t n = 5000000;
+    vector<pair<int,long> > items;
+    for(size_t i = 0; i < n; ++i) items.push_back(make_pair((int)i, (long)(i % 1000)));
+    AVLTree<int,long> tree(items.begin(), items.end());
+    vector<int> keys = shuffledKeys(n, 131);
+    for(size_t i = 0; i < n / 10; ++i) {
+        tree.remove(keys[i]);
+        tree.insert(make_pair(keys[i], (long)(keys[i] % 1000)));
+    }
+
+    cout << "Parallel traversal, n = " << n << ", " << thread::hardware_concurrency()
+         << " hardware threads (ns/item)" << endl;
+    long sum = 0;
+    Clock::time_point start = Clock::now();
+    for(AVLTree<int,long>::const_iterator it = tree.begin(); it != tree.end(); ++it) sum += it->second;
+    cout << "  iterator loop " << fixed << setprecision(2) << nsPerOp(start, n) << "   (sum " << sum << ")" << endl;
+
+    cout << setw(10) << "threads" << setw(12) << "reduce" << setw(12) << "unordered"
+         << setw(12) << "for_each" << endl;
+    for(unsigned threads = 1; threads <= 8; threads *= 2) {
+        WorkStealingPool pool(threads - 1);
+        auto value = [](const pair<const int,long>& item) { return item.second; };
+        auto add = [](long a, long b) { return a + b; };
+
+        start = Clock::now();
+        long ordered = tree.parallel_reduce(0L, value, add, true, pool);
+        double orderedNs = nsPerOp(start, n);
+
+        start = Clock::now();
+        long unordered = tree.parallel_reduce(0L, value, add, false, pool);
+        double unorderedNs = nsPerOp(start, n);
+
+        atomic<long> total(0);
+        start = Clock::now();
+        tree.parallel_for_each([&total](pair<const int,long>& item) {
+            if(item.second == 999) total.fetch_add(1, memory_order_relaxed);
+        }, pool);
+        double forEachNs = nsPerOp(start, n);
+
+        cout << setw(10) << threads << setw(12) << orderedNs << setw(12) << unorderedNs
+             << setw(12) << forEachNs << "   (sums " << ordered << " " << unordered << " " << total << ")" << endl;
+    }
+    cout << endl;
+}
+
+// Total operations per microsecond across `threads` threads, each
+// doing a mix of inserts, removes and finds (one third each) over the
+// shared key range [0, 2n)
+template<typename Tree>
+static double mixedThroughput(Tree& tree, size_t n, int threads)
+{
+    const size_t perThread = 200000;
+    vector<thread> workers;
+    vector<size_t> hits(threads);
+    Clock::time_point start = Clock::now();
+    for(int t = 0; t < threads; ++t) {
+        workers.push_back(thread([&, t]() {
+            mt19937 rng(121 + t);
+            for(size_t i = 0; i < perThread; ++i) {
+                int key = (int)(rng() % (2 * n));
+                int value;
+                switch(rng() % 3) {
+                    case 0: tree.insert(make_pair(key, key)); break;
+                    case 1: tree.remove(key); break;
+                    default: hits[t] += tree.find(key, value); break;
+                }
+            }
+        }));
+    }
+    for(size_t i = 0; i < workers.size(); ++i) workers[i].join();
+    double us = nsPerOp(start, 1) / 1000;
+    return threads * perThread / us;
+}
+
+static void benchMultiWriter()
+{
+    const size_t n = 100000;
+    cout << "Mixed insert/remove/find, n = " << n << ", " << thread::hardware_concurrency()
+         << " hardware threads (ops/us, all threads)" << endl;
+    cout << setw(10) << "threads" << setw(10) << "mutex" << setw(14) << "multi-writer" << endl;
+    for(int threads = 1; threads <= 32; threads *= 2) {
+        LockedAVLTree locked;
+        MultiWriterAVLTree<int,int> concurrent;
+        vector<int> keys = shuffledKeys(2 * n, 122);
+        for(size_t i = 0; i < n; ++i) {
+            locked.insert(make_pair(keys[i], keys[i]));
+            concurrent.insert(make_pair(keys[i], keys[i]));
+        }
+        cout << setw(10) << threads << fixed << setprecision(2)
+             << setw(10) << mixedThroughput(locked, n, threads)
+             << setw(14) << mixedThroughput(concurrent, n, threads) << endl;
+    }
+    cout << endl;
+}
+
+// Ingestion into AVLTree and PersistentAVLTree, the latter also while
+// a fresh snapshot is taken (and the previous one dropped) every 1000
+// inserts; then the cost of a consistent view: a full O(n) copy of the
+// AVLTree against an O(1) snapshot.
+static void benchPersistent()
+{
+    const size_t n = 1000000;
+    vector<int> keys = shuffledKeys(n, 101);
+    cout << "Persistent AVL, n = " << n << endl;
+
+    AVLTree<int,int> tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) tree.insert(make_pair(keys[i], keys[i]));
+    double avlNs = nsPerOp(start, n);
+
+    PersistentAVLTree<int,int> plain;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) plain.insert(make_pair(keys[i], keys[i]));
+    double plainNs = nsPerOp(start, n);
+
+    PersistentAVLTree<int,int> ingest;
+    PersistentAVLTree<int,int>::Snapshot view = ingest.snapshot();
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        ingest.insert(make_pair(keys[i], keys[i]));
+        if(i % 1000 == 0) view = ingest.snapshot();
+    }
+    double snapshotNs = nsPerOp(start, n);
+
+    start = Clock::now();
+    AVLTree<int,int> copy(tree.begin(), tree.end());
+    double copyUs = nsPerOp(start, 1) / 1000;
+
+    const int views = 100000;
+    start = Clock::now();
+    for(int i = 0; i < views; ++i) view = plain.snapshot();
+    double viewUs = nsPerOp(start, views) / 1000;
+
+    cout << fixed << setprecision(1)
+         << "  insert ns/op: AVLTree " << avlNs << ", persistent " << plainNs
+         << ", persistent + snapshot every 1000 " << snapshotNs << endl;
+    cout << setprecision(3)
+         << "  consistent view us: AVLTree copy " << copyUs << ", snapshot() " << viewUs
+         << "   (sizes " << copy.size() << " " << view.size() << ")" << endl << endl;
+}
+
+// Saving a tree and restoring it: a binary snapshot reloaded by
+// load(), which builds the balanced tree straight from the stream,
+// against text pairs rebuilt by inserting them one by one
+static void benchSnapshot()
+{
+    const size_t n = 5000000;
+    vector<int> keys = shuffledKeys(n, 151);
+    AVLTree<int,int> tree;
+    for(size_t i = 0; i < n; ++i) tree.insert(make_pair(keys[i], keys[i] / 3));
+
+    cout << "Snapshot save + restore, n = " << n << " (ms, in memory)" << endl;
+    Clock::time_point start = Clock::now();
+    stringstream binary;
+    tree.save(binary);
+    double saveMs = nsPerOp(start, 1) / 1e6;
+    start = Clock::now();
+    AVLTree<int,int> loaded;
+    loaded.load(binary);
+    double loadMs = nsPerOp(start, 1) / 1e6;
+
+    start = Clock::now();
+    stringstream text;
+    for(AVLTree<int,int>::const_iterator it = tree.begin(); it != tree.end(); ++it) {
+        text << it->first << ' ' << it->second << '\n';
+    }
+    double writeMs = nsPerOp(start, 1) / 1e6;
+    start = Clock::now();
+    AVLTree<int,int> rebuilt;
+    int key, value;
+    while(text >> key >> value) rebuilt.insert(make_pair(key, value));
+    double rebuildMs = nsPerOp(start, 1) / 1e6;
+
+    cout << fixed << setprecision(1)
+         << "  binary save " << saveMs << ", load " << loadMs << "   (" << binary.str().size() / 1000000 << " MB)" << endl
+         << "  text write " << writeMs << ", insert rebuild " << rebuildMs << "   (" << text.str().size() / 1000000 << " MB)" << endl
+         << "  (sizes " << loaded.size() << " " << rebuilt.size() << ")" << endl << endl;
+}
+
+// Startup cost of a large read-mostly table: reopening a mapped tree
+// against loading a snapshot file, each followed by a batch of finds,
+// then the steady-state find cost and the cost of flushing updates.
+// Files are in the page cache, so this is the deserialization cost.
+static void benchMapped()
+{
+    const size_t n = 5000000;
+    const char* mappedPath = "/tmp/bst-bench-mapped.avl";
+    const char* snapshotPath = "/tmp/bst-bench-snapshot.bin";
+    vector<int> keys = shuffledKeys(n, 161);
+    remove(mappedPath);
+    {
+        MappedAVLTree<int,int> mapped(mappedPath);
+        mapped.reserve(n);
+        AVLTree<int,int> tree;
+        for(size_t i = 0; i < n; ++i) {
+            mapped.insert(make_pair(keys[i], keys[i] / 3));
+            tree.insert(make_pair(keys[i], keys[i] / 3));
+        }
+        mapped.flush();
+        int fd = open(snapshotPath, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        tree.save(fd);
+        close(fd);
+    }
+
+    const size_t probes = 1000;
+    cout << "Mapped tree, n = " << n << endl;
+    long found = 0;
+    Clock::time_point start = Clock::now();
+    {
+        MappedAVLTree<int,int> mapped(mappedPath, MappedAVLTree<int,int>::ReadOnly);
+        for(size_t i = 0; i < probes; ++i) found += mapped.contains(keys[i * 997 % n]);
+    }
+    double mappedMs = nsPerOp(start, 1) / 1e6;
+    start = Clock::now();
+    {
+        AVLTree<int,int> tree;
+        int fd = open(snapshotPath, O_RDONLY);
+        tree.load(fd);
+        close(fd);
+        for(size_t i = 0; i < probes; ++i) found += tree.find(keys[i * 997 % n]) != tree.end();
+    }
+    double loadMs = nsPerOp(start, 1) / 1e6;
+    cout << fixed << setprecision(2) << "  open + " << probes << " finds (ms): mapped reopen " << mappedMs
+         << ", snapshot load " << loadMs << "   (found " << found << ")" << endl;
+
+    MappedAVLTree<int,int> mapped(mappedPath);
+    AVLTree<int,int> tree;
+    int fd = open(snapshotPath, O_RDONLY);
+    tree.load(fd);
+    close(fd);
+    found = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) found += mapped.contains(keys[i]);
+    double mappedNs = nsPerOp(start, n);
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) found += tree.find(keys[i]) != tree.end();
+    double treeNs = nsPerOp(start, n);
+    cout << "  find ns/op: mapped " << mappedNs << ", AVLTree " << treeNs << "   (found " << found << ")" << endl;
+
+    const size_t updates = 10000;
+    start = Clock::now();
+    for(size_t i = 0; i < updates; ++i) mapped.insert(make_pair(keys[i], -1));
+    double updateNs = nsPerOp(start, updates);
+    start = Clock::now();
+    mapped.flush();
+    double flushMs = nsPerOp(start, 1) / 1e6;
+    cout << "  " << updates << " updates: " << updateNs << " ns/op, then flush() " << flushMs << " ms" << endl << endl;
+    remove(mappedPath);
+    remove(snapshotPath);
+}
+
+// Cost of making changes durable: a plain AVLTree insert against a
+// logged insert that waits for its sync, from one thread and from
+// several sharing syncs by group commit, and against Deferred mode;
+// then the time to recover from a long log and to checkpoint
+template<typename Tree>
+static double durableInserts(Tree& tree, int threads, int perThread)
+{
+    vector<thread> workers;
+    Clock::time_point start = Clock::now();
+    for(int t = 0; t < threads; ++t) {
+        workers.push_back(thread([&tree, t, perThread]() {
+            for(int i = 0; i < perThread; ++i) tree.insert(make_pair(t * perThread + i, i));
+        }));
+    }
+    for(size_t i = 0; i < workers.size(); ++i) workers[i].join();
+    return nsPerOp(start, (size_t)threads * perThread) / 1000;
+}
+
+static void benchDurable()
+{
+    typedef DurableAVLTree<int,int> Durable;
+    const string path = "/tmp/bst-bench-durable";
+    const char* files[] = { ".ckpt", ".wal", ".lock" };
+    auto removeFiles = [&]() { for(int i = 0; i < 3; ++i) remove((path + files[i]).c_str()); };
+
+    cout << "Durable inserts (us/op)" << endl;
+    AVLTree<int,int> plain;
+    Clock::time_point start = Clock::now();
+    for(int i = 0; i < 100000; ++i) plain.insert(make_pair(i, i));
+    cout << fixed << setprecision(3) << "  AVLTree, no log           " << nsPerOp(start, 100000) / 1000 << endl;
+
+    for(int threads = 1; threads <= 16; threads *= 4) {
+        removeFiles();
+        Durable tree(path);
+        double us = durableInserts(tree, threads, 4000 / threads);
+        cout << "  Immediate, " << setw(2) << threads << " threads     " << us
+             << "   (" << tree.commitCount() << " syncs for 4000 inserts)" << endl;
+    }
+    removeFiles();
+    {
+        Durable tree(path, Durable::Deferred);
+        start = Clock::now();
+        for(int i = 0; i < 200000; ++i) tree.insert(make_pair(i, i));
+        tree.sync();
+        cout << "  Deferred, 1 thread        " << nsPerOp(start, 200000) / 1000
+             << "   (" << tree.commitCount() << " syncs for 200000 inserts)" << endl;
+    }
+
+    start = Clock::now();
+    Durable recovered(path);
+    double recoverMs = nsPerOp(start, 1) / 1e6;
+    start = Clock::now();
+    recovered.checkpoint();
+    double checkpointMs = nsPerOp(start, 1) / 1e6;
+    cout << setprecision(1) << "  recover " << recovered.recoveredRecords() << " records " << recoverMs
+         << " ms, checkpoint " << checkpointMs << " ms" << endl << endl;
+    removeFiles();
+}
+
+// One row of benchRedBlack: per-op cost of inserting shuffled and
+// ascending keys, finding every key, two mixes of finds, inserts and
+// removes over the full tree, and removing every key
+template<typename Tree>
+static void benchBalancedRow(const char* name, const vector<int>& keys, const vector<uint32_t>& mix)
+{
+    size_t n = keys.size();
+    Tree tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) tree.insert(make_pair(keys[i], keys[i]));
+    double insertNs = nsPerOp(start, n);
+    int height = tree.verify().height;
+
+    long sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) sum += tree.find(keys[i])->second;
+    double findNs = nsPerOp(start, n);
+
+    // mix holds (key << 8 | percentile); below readPercent is a find,
+    // then inserts and removes split the rest evenly
+    double mixNs[2];
+    const uint32_t readPercent[2] = { 80, 10 };
+    for(int m = 0; m < 2; ++m) {
+        start = Clock::now();
+        for(size_t i = 0; i < mix.size(); ++i) {
+            int key = (int)(mix[i] >> 8);
+            uint32_t roll = (mix[i] & 0xFF) % 100;
+            if(roll < readPercent[m]) sum += tree.find(key) != tree.end();
+            else if((roll - readPercent[m]) % 2 == 0) tree.insert(make_pair(key, key));
+            else tree.remove(key);
+        }
+        mixNs[m] = nsPerOp(start, mix.size());
+    }
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) tree.remove(keys[i]);
+    double removeNs = nsPerOp(start, n);
+
+    Tree ascending;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) ascending.insert(make_pair((int)i, (int)i));
+    double ascendingNs = nsPerOp(start, n);
+
+    cout << setw(10) << name << fixed << setprecision(1) << setw(10) << insertNs << setw(10) << ascendingNs
+         << setw(10) << findNs << setw(10) << mixNs[0] << setw(10) << mixNs[1] << setw(10) << removeNs
+         << setw(8) << height << "   (checksum " << sum << ")" << endl;
+}
+
+static void benchRedBlack()
+{
+    const size_t n = 1000000;
+    vector<int> keys = shuffledKeys(n, 171);
+    vector<uint32_t> mix(2 * n);
+    mt19937 rng(173);
+    for(size_t i = 0; i < mix.size(); ++i) mix[i] = (uint32_t)(rng() % (2 * n)) << 8 | (rng() & 0xFF);
+
+    cout << "AVLTree vs RBTree, n = " << n << " (ns/op; mixes are % finds, rest inserts/removes)" << endl;
+    cout << setw(10) << "tree" << setw(10) << "insert" << setw(10) << "ascend" << setw(10) << "find"
+         << setw(10) << "80% find" << setw(10) << "10% find" << setw(10) << "remove" << setw(8) << "height" << endl;
+    benchBalancedRow<AVLTree<int,int> >("AVLTree", keys, mix);
+    benchBalancedRow<RBTree<int,int> >("RBTree", keys, mix);
+    cout << endl;
+}
+
+// ops Zipf-distributed draws from keys with exponent s (0 is uniform):
+// the key of rank r, counting from 0, is drawn with weight 1/(r+1)^s.
+// Ranks are assigned to keys in shuffled order, so hot keys are
+// scattered over the key space. If drift is nonzero, the ranking moves
+// by drift keys every 64K draws, so the hot set keeps changing.
+static vector<int> zipfKeys(const vector<int>& keys, size_t ops, double s, size_t drift, unsigned seed)
+{
+    size_t n = keys.size();
+    vector<double> cdf(n);
+    double total = 0;
+    for(size_t r = 0; r < n; ++r) {
+        total += 1.0 / pow((double)(r + 1), s);
+        cdf[r] = total;
+    }
+    mt19937 rng(seed);
+    uniform_real_distribution<double> uniform(0, total);
+    vector<int> out(ops);
+    for(size_t i = 0; i < ops; ++i) {
+        size_t rank = lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+        if(rank >= n) rank = n - 1;
+        out[i] = keys[(rank + (i >> 16) * drift) % n];
+    }
+    return out;
+}
+
+// One row of benchSplay: ns per find for each workload, over a tree
+// built from keys in their (shuffled) order
+template<typename Tree>
+static void benchSkewedRow(const char* name, const vector<int>& keys, const vector<vector<int> >& workloads)
+{
+    Tree tree;
+    for(size_t i = 0; i < keys.size(); ++i) tree.insert(make_pair(keys[i], keys[i]));
+
+    long sum = 0;
+    cout << setw(10) << name << fixed << setprecision(1);
+    for(size_t w = 0; w < workloads.size(); ++w) {
+        const vector<int>& ops = workloads[w];
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < ops.size(); ++i) sum += tree.find(ops[i])->second;
+        cout << setw(12) << nsPerOp(start, ops.size());
+    }
+    cout << "   (checksum " << sum << ")" << endl;
+}
+
+static void benchSplay()
+{
+    const size_t n = 1000000;
+    const size_t ops = 2000000;
+    vector<int> keys = shuffledKeys(n, 181);
+    vector<int> ranked = shuffledKeys(n, 183);
+
+    const char* labels[] = { "uniform", "s=0.8", "s=0.99", "s=1.2", "s=1.5", "0.99 drift" };
+    vector<vector<int> > workloads;
+    workloads.push_back(zipfKeys(ranked, ops, 0.0, 0, 191));
+    workloads.push_back(zipfKeys(ranked, ops, 0.8, 0, 193));
+    workloads.push_back(zipfKeys(ranked, ops, 0.99, 0, 197));
+    workloads.push_back(zipfKeys(ranked, ops, 1.2, 0, 199));
+    workloads.push_back(zipfKeys(ranked, ops, 1.5, 0, 209));
+    workloads.push_back(zipfKeys(ranked, ops, 0.99, 1000, 211));
+
+    cout << "AVLTree vs SplayTree find, n = " << n << ", " << ops
+         << " Zipf-distributed finds per workload (ns/op)" << endl;
+    cout << setw(10) << "tree";
+    for(size_t w = 0; w < workloads.size(); ++w) cout << setw(12) << labels[w];
+    cout << endl;
+    benchSkewedRow<AVLTree<int,int> >("AVLTree", keys, workloads);
+    benchSkewedRow<SplayTree<int,int> >("SplayTree", keys, workloads);
+    cout << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    benchAVLScaling();
+    benchAllocators();
+    benchNodeLayout();
+    benchSortedLoad();
+    benchBatchInsert();
+    benchOrderStatistics();
+    benchHeterogeneousFind();
+    benchTraversal();
+    benchCompact();
+    benchFrozen();
+    benchBPlusTree();
+    benchFindBatch();
+    benchConcurrentReads();
+    benchPersistent();
+    benchMultiWriter();
+    benchSetOperations();
+    benchParallelTraversal();
+    benchSnapshot();
+    benchMapped();
+    benchDurable();
+    benchRedBlack();
+    benchSplay();
+    return 0;
+}
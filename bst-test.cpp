@@ -1,10 +1,58 @@
 #include <iostream>
 #include <map>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstdio>
+#include <stdexcept>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "bst.h"
+#include "bstparallel.h"
+#include "bstio.h"
 #include "avlbst.h"
+#include "rbbst.h"
+#include "splaybst.h"
+#include "slaballoc.h"
+#include "compactavl.h"
+#include "frozentree.h"
+#include "bplustree.h"
+#include "concurrentavl.h"
+#include "persistentavl.h"
+#include "multiwriteravl.h"
+#include "mappedavl.h"
+#include "durableavl.h"
+#include <thread>
 
 using namespace std;
 
+// Orders strings and also compares them against C strings directly
+struct StringLess
+{
+    typedef void is_transparent;
+    bool operator()(const std::string& a, const std::string& b) const { return a < b; }
+    bool operator()(const std::string& a, const char* b) const { return a.compare(b) < 0; }
+    bool operator()(const char* a, const std::string& b) const { return b.compare(a) > 0; }
+};
+
+// A value whose copies start failing once copiesLeft runs out
+static int copiesLeft = -1;
+struct FragileValue
+{
+    int v;
+    FragileValue(int x = 0) : v(x) { }
+    FragileValue(const FragileValue& other) : v(other.v)
+    {
+        if(copiesLeft == 0) throw std::runtime_error("copy failed");
+        if(copiesLeft > 0) --copiesLeft;
+    }
+    FragileValue& operator=(const FragileValue& other) = default;
+};
+
+std::ostream& operator<<(std::ostream& os, const FragileValue& value)
+{
+    return os << value.v;
+}
 
 int main(int argc, char *argv[])
 {
@@ -25,6 +73,12 @@ int main(int argc, char *argv[])
     }
     cout << "Erasing b" << endl;
     bt.remove('b');
+    // A plain BST may be unbalanced and still valid: only balanced drops
+    bt.insert(std::make_pair('b',2));
+    bt.insert(std::make_pair('c',3));
+    TreeReport chain = bt.verify();
+    cout << "BST chain verify: valid " << chain.valid << ", balanced " << chain.balanced
+         << ", error \"" << chain.error << "\"" << endl;
 
     // AVL Tree Tests
     AVLTree<char,int> at;
@@ -44,5 +98,469 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    // AVL balance under a larger mixed workload
+    AVLTree<int,int> big;
+    for(int i = 0; i < 1000; ++i) {
+        big.insert(std::make_pair((i * 7919) % 1000, i));
+    }
+    for(int i = 0; i < 1000; i += 3) {
+        big.remove(i);
+    }
+    cout << "\nAVLTree balanced after 1000 inserts / 334 removes: "
+         << big.isBalanced() << endl;
+    TreeReport report = big.verify();
+    cout << "AVLTree verify: valid " << report.valid << ", height " << report.height
+         << ", nodes " << report.nodeCount << endl;
+
+    // The same workload on a red-black tree
+    RBTree<int,int> red;
+    for(int i = 0; i < 1000; ++i) {
+        red.insert(std::make_pair((i * 7919) % 1000, i));
+    }
+    for(int i = 0; i < 1000; i += 3) {
+        red.remove(i);
+    }
+    report = red.verify();
+    cout << "RBTree verify: valid " << report.valid << ", height " << report.height
+         << ", nodes " << report.nodeCount << ", find(1) " << red.find(1)->second << endl;
+
+    // Splay tree: ascending inserts leave a path, and each find roughly
+    // halves the depth of the nodes it passes
+    SplayTree<int,int> splay;
+    for(int i = 0; i < 1000; ++i) {
+        splay.insert(std::make_pair(i, i));
+    }
+    cout << "SplayTree height after ascending inserts " << splay.verify().height;
+    cout << ", find(0) " << splay.find(0)->second;
+    report = splay.verify();
+    cout << ", then height " << report.height << ", valid " << report.valid << endl;
+    splay.remove(500);
+    cout << "SplayTree after remove(500): size " << splay.size() << ", find(500) at end "
+         << (splay.find(500) == splay.end()) << ", valid " << splay.verify().valid << endl;
+    // Updating a key that is already there splays it as well, through
+    // every form of insert
+    SplayTree<int,int> updated;
+    for(int i = 0; i < 1000; ++i) {
+        updated.insert(std::make_pair(i, i));
+    }
+    cout << "SplayTree updates: height " << updated.verify().height;
+    updated.insert(std::make_pair(0, -1));
+    cout << ", after insert(make_pair) " << updated.verify().height;
+    updated[1] = -1;
+    cout << ", after operator[] " << updated.verify().height;
+    updated.emplace(2, -1);
+    cout << ", after emplace " << updated.verify().height << ", valid " << updated.verify().valid << endl;
+
+    // AVL tree backed by the slab allocator
+    AVLTree<int,int,std::less<int>,SlabAllocator<std::pair<const int,int> > > slab;
+    for(int i = 0; i < 1000; ++i) {
+        slab.insert(std::make_pair(i, i));
+    }
+    for(int i = 0; i < 1000; i += 2) {
+        slab.remove(i);
+    }
+    report = slab.verify();
+    cout << "Slab AVLTree verify: valid " << report.valid << ", balanced " << report.balanced
+         << ", nodes " << report.nodeCount << endl;
+    slab.clear();
+    cout << "Slab AVLTree empty after clear: " << slab.empty() << endl;
+
+    // Two trees on one slab pool: clearing or destroying one must not
+    // free the pages that still hold the other's nodes. The trees rebind
+    // copies of the item-typed allocator, and the copies share its pool.
+    typedef SlabAllocator<std::pair<const int,int> > NodePool;
+    NodePool nodePool;
+    AVLTree<int,int,std::less<int>,NodePool> first(std::less<int>(), nodePool);
+    {
+        AVLTree<int,int,std::less<int>,NodePool> second(std::less<int>(), nodePool);
+        for(int i = 0; i < 100; ++i) {
+            first.insert(std::make_pair(i, i));
+            second.insert(std::make_pair(100 + i, i));
+        }
+        first.join(second);
+        second.insert(std::make_pair(1000, 0));
+    }
+    AVLTree<int,int,std::less<int>,NodePool> third(std::less<int>(), nodePool);
+    third.insert(std::make_pair(1, 1));
+    third.clear();
+    SlabAllocator<AVLNode<int,int> > rebound(nodePool);
+    cout << "Shared slab pool: size " << first.size() << ", find(150) " << first.find(150)->second
+         << ", valid " << first.verify().valid << ", pages " << nodePool.pageCount()
+         << ", rebound back equal " << (NodePool(rebound) == nodePool) << endl;
+
+    // Bulk construction from an unsorted range with a duplicate key
+    std::pair<int,int> items[] = {
+        std::make_pair(5,50), std::make_pair(1,10), std::make_pair(9,90),
+        std::make_pair(3,30), std::make_pair(5,55), std::make_pair(7,70)
+    };
+    AVLTree<int,int> built(items, items + 6);
+    cout << "\nAVLTree built from range:";
+    for(AVLTree<int,int>::iterator it = built.begin(); it != built.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    report = built.verify();
+    cout << "\nBuilt AVLTree verify: valid " << report.valid << ", height " << report.height << endl;
+
+    // Batched insert that overwrites existing keys and merges new ones
+    std::vector<std::pair<int,int> > batch;
+    for(int i = 0; i < 200; ++i) {
+        batch.push_back(std::make_pair(i % 100, i));
+    }
+    built.insert(batch.begin(), batch.end());
+    report = built.verify();
+    cout << "Batched insert: nodes " << report.nodeCount << ", valid " << report.valid
+         << ", balanced " << report.balanced << ", built[5] = " << built[5] << endl;
+
+    // A merge whose node copies throw leaves every existing value alone
+    AVLTree<int,FragileValue> fragile;
+    std::vector<std::pair<int,FragileValue> > fragileBatch;
+    for(int i = 0; i < 100; ++i) {
+        fragile.insert(std::make_pair(i, FragileValue(i)));
+        fragileBatch.push_back(std::make_pair(50 + i, FragileValue(-1)));
+    }
+    copiesLeft = 20;
+    try {
+        fragile.insert(fragileBatch.begin(), fragileBatch.end());
+    }
+    catch(const std::runtime_error&) {
+        cout << "Failed merge: ";
+    }
+    copiesLeft = -1;
+    cout << "size " << fragile.size() << ", [75] " << fragile.find(75)->second.v
+         << ", valid " << fragile.verify().valid << endl;
+
+    // Order statistics
+    cout << "size " << built.size() << ", rank(42) " << built.rank(42)
+         << ", select(10) " << built.select(10)->first
+         << ", count(10, 20) " << built.count(10, 20) << endl;
+
+    // Bounds and range scans
+    AVLTree<int,int> evens;
+    for(int i = 0; i < 20; i += 2) {
+        evens.insert(std::make_pair(i, i * i));
+    }
+    cout << "lower_bound(5) " << evens.lower_bound(5)->first
+         << ", upper_bound(6) " << evens.upper_bound(6)->first
+         << ", equal_range(7) empty " << (evens.equal_range(7).first == evens.equal_range(7).second)
+         << endl;
+    cout << "scan [4, 12):";
+    evens.scan(4, 12, [](std::pair<const int,int>& item) {
+        cout << " " << item.first;
+    });
+    cout << endl;
+
+    // Move-aware insertion and operator[] default-inserting on a miss
+    AVLTree<std::string,std::string> names;
+    std::string longKey(40, 'k');
+    names.insert(std::make_pair(longKey, std::string("moved")));
+    names.emplace("alpha", "a");
+    names.try_emplace("alpha", "not used");
+    names.insert_or_assign("beta", "b");
+    names["gamma"] += "g";
+    cout << "names:";
+    for(AVLTree<std::string,std::string>::iterator it = names.begin(); it != names.end(); ++it) {
+        cout << " " << it->first.substr(0, 5) << "=" << it->second;
+    }
+    cout << ", size " << names.size() << endl;
+
+    // Transparent comparator: string literals are looked up directly,
+    // without building a std::string for every probe
+    AVLTree<std::string,int,StringLess> ages;
+    ages.insert(std::make_pair(std::string("ann"), 31));
+    ages.insert(std::make_pair(std::string("bob"), 27));
+    cout << "contains(\"bob\"): " << ages.contains("bob")
+         << ", find(\"cid\") is end: " << (ages.find("cid") == ages.end()) << endl;
+    const int* age = ages.lookup("ann");
+    cout << "lookup(\"ann\"): " << (age != NULL ? *age : -1)
+         << ", lookup(\"zed\") is NULL: " << (ages.lookup("zed") == NULL) << endl;
+
+    // A reversed order through a custom comparator
+    AVLTree<int,int,std::greater<int> > desc;
+    for(int i = 1; i <= 5; ++i) desc.insert(std::make_pair(i, i));
+    cout << "descending:";
+    for(AVLTree<int,int,std::greater<int> >::iterator it = desc.begin(); it != desc.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << ", valid " << desc.verify().valid << endl;
+
+    // Walking backwards: the three largest keys, and --end()
+    cout << "latest 3:";
+    int shown = 0;
+    for(AVLTree<int,int>::reverse_iterator it = evens.rbegin(); it != evens.rend() && shown < 3; ++it, ++shown) {
+        cout << " " << it->first;
+    }
+    const AVLTree<int,int>& constEvens = evens;
+    AVLTree<int,int>::const_iterator last = constEvens.end();
+    --last;
+    cout << ", --end() " << last->first << endl;
+
+    // Compact mode: the same operations on an index-linked node pool
+    CompactAVLTree<uint32_t,uint32_t> compact;
+    for(uint32_t i = 0; i < 1000; ++i) compact.insert(std::make_pair(i, 2 * i));
+    for(uint32_t i = 0; i < 1000; i += 3) compact.remove(i);
+    TreeReport compactReport = compact.verify();
+    cout << "compact: size " << compact.size() << ", valid " << compactReport.valid
+         << ", balanced " << compactReport.balanced << ", find(500) " << compact.find(500)->second
+         << ", node bytes " << CompactAVLTree<uint32_t,uint32_t>::nodeBytes()
+         << " vs " << sizeof(AVLNode<uint32_t,uint32_t>) << endl;
+
+    // A frozen snapshot answers the same queries from an array layout
+    FrozenTree<int,int> frozen = evens.freeze();
+    cout << "frozen: size " << frozen.size() << ", find(8) " << frozen.find(8)->second
+         << ", lower_bound(9) " << frozen.lower_bound(9)->first
+         << ", contains(7) " << frozen.contains(7) << ", items:";
+    for(FrozenTree<int,int>::const_iterator it = frozen.begin(); it != frozen.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // The B+ tree takes the same calls, so a typedef picks the tree
+    typedef BPlusTree<int,int> Index;
+    Index index;
+    for(int i = 0; i < 1000; ++i) index.insert(std::make_pair(i, i * i));
+    for(int i = 0; i < 1000; i += 2) index.remove(i);
+    TreeReport indexReport = index.verify();
+    cout << "B+ tree: size " << index.size() << ", valid " << indexReport.valid
+         << ", height " << indexReport.height << ", find(7) " << index.find(7)->second
+         << ", lower_bound(500) " << index.lower_bound(500)->first << ", last 3:";
+    shown = 0;
+    for(Index::reverse_iterator it = index.rbegin(); it != index.rend() && shown < 3; ++it, ++shown) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // Many lookups at once; results line up with the probes
+    std::vector<int> probes;
+    probes.push_back(4);
+    probes.push_back(5);
+    probes.push_back(18);
+    std::vector<AVLTree<int,int>::iterator> found;
+    evens.findBatch(probes, found);
+    cout << "findBatch:";
+    for(size_t i = 0; i < probes.size(); ++i) {
+        cout << " " << probes[i] << "->";
+        if(found[i] == evens.end()) cout << "missing";
+        else cout << found[i]->second;
+    }
+    cout << endl;
+
+    // Above 16384 nodes findBatch interleaves its searches; check every
+    // probe against find(), with misses, repeats and a ragged last batch
+    AVLTree<int,int> large;
+    for(int i = 0; i < 20000; ++i) large.insert(std::make_pair(2 * i, i));
+    std::vector<int> manyProbes;
+    for(int i = 0; i < 5003; ++i) manyProbes.push_back((i * 7919) % 40010 - 3);
+    manyProbes.push_back(manyProbes[0]);
+    manyProbes.push_back(manyProbes[0]);
+    std::vector<AVLTree<int,int>::iterator> manyFound;
+    large.findBatch(manyProbes, manyFound);
+    size_t mismatches = 0, hits = 0;
+    for(size_t i = 0; i < manyProbes.size(); ++i) {
+        if(manyFound[i] != large.find(manyProbes[i])) ++mismatches;
+        if(manyFound[i] != large.end()) ++hits;
+    }
+    cout << "findBatch on " << large.size() << " nodes: " << manyProbes.size() << " probes, "
+         << hits << " hits, " << mismatches << " mismatches against find()" << endl;
+
+    // Whole subtrees move between trees: split/join and set operations
+    AVLTree<int,int> low, high, multiples;
+    for(int i = 1; i <= 10; ++i) low.insert(std::make_pair(i, i));
+    for(int i = 3; i <= 15; i += 3) multiples.insert(std::make_pair(i, -i));
+    low.split(6, high);
+    cout << "split at 6: " << low.size() << " + " << high.size();
+    low.join(high);
+    AVLTree<int,int> probe(multiples.begin(), multiples.end()), common(low.begin(), low.end());
+    common.setIntersection(probe);
+    low.setUnion(multiples);
+    cout << "; union size " << low.size() << ", [12] " << low[12] << ", [3] " << low[3]
+         << "; intersection size " << common.size() << ", valid " << (low.verify().valid && common.verify().valid) << endl;
+
+    // Slab trees with pools of their own copy the items that change trees
+    typedef AVLTree<int,int,std::less<int>,SlabAllocator<std::pair<const int,int> > > SlabAVL;
+    SlabAVL slabLow, slabHigh, slabOdd;
+    for(int i = 1; i <= 10; ++i) slabLow.insert(std::make_pair(i, i));
+    for(int i = 1; i <= 15; i += 2) slabOdd.insert(std::make_pair(i, -i));
+    slabLow.split(6, slabHigh);
+    cout << "slab split at 6: " << slabLow.size() << " + " << slabHigh.size();
+    slabLow.join(slabHigh);
+    slabLow.setUnion(slabOdd);
+    cout << "; union size " << slabLow.size() << ", [13] " << slabLow[13] << ", others empty "
+         << (slabHigh.empty() && slabOdd.empty()) << ", valid " << slabLow.verify().valid << endl;
+
+    // Subtrees are traversed by a pool of threads
+    AVLTree<int,int> squares;
+    for(int i = 1; i <= 10000; ++i) squares.insert(std::make_pair(i, i * i % 97));
+    WorkStealingPool pool(3);
+    squares.parallel_for_each([](std::pair<const int,int>& item) { item.second += 1; }, pool);
+    long total = squares.parallel_reduce(0L, [](const std::pair<const int,int>& item) { return (long)item.second; },
+                                         [](long a, long b) { return a + b; }, false, pool);
+    std::string digits = squares.parallel_reduce(std::string(),
+                                                 [](const std::pair<const int,int>& item) {
+                                                     return item.first <= 5 ? std::to_string(item.first) : std::string();
+                                                 },
+                                                 [](const std::string& a, const std::string& b) { return a + b; },
+                                                 true, pool);
+    long expected = 0;
+    for(AVLTree<int,int>::iterator it = squares.begin(); it != squares.end(); ++it) expected += it->second;
+    cout << "parallel: sum matches " << (total == expected) << ", ordered keys " << digits << endl;
+
+    // A snapshot reloads into a balanced tree without any rotations
+    std::stringstream snapshot;
+    squares.save(snapshot);
+    AVLTree<int,int> reloaded;
+    reloaded.load(snapshot);
+    cout << "snapshot: size " << reloaded.size() << ", [77] " << reloaded[77] << ", same items "
+         << std::equal(squares.begin(), squares.end(), reloaded.begin()) << ", valid " << reloaded.verify().valid << endl;
+
+    // A mapped tree is usable again as soon as its file is reopened
+    const char* mappedPath = "/tmp/bst-test-mapped.avl";
+    std::remove(mappedPath);
+    {
+        MappedAVLTree<int,int> mapped(mappedPath);
+        for(int i = 1; i <= 1000; ++i) mapped.insert(std::make_pair(i, i * 3));
+        mapped.remove(500);
+        mapped.flush();
+    }
+    {
+        MappedAVLTree<int,int> mapped(mappedPath, MappedAVLTree<int,int>::ReadOnly);
+        cout << "mapped: size " << mapped.size() << ", find(7) " << mapped.find(7)->second
+             << ", contains(500) " << mapped.contains(500) << ", valid " << mapped.verify().valid << endl;
+    }
+    // A writer that dies before flush() leaves the file dirty: it can no
+    // longer be opened read-write, but can still be read if it verifies
+    pid_t child = fork();
+    if(child == 0) {
+        MappedAVLTree<int,int> mapped(mappedPath);
+        mapped.insert(std::make_pair(5000, 1));
+        _exit(0);
+    }
+    waitpid(child, NULL, 0);
+    bool refused = false;
+    try {
+        MappedAVLTree<int,int> mapped(mappedPath);
+    }
+    catch(std::runtime_error&) {
+        refused = true;
+    }
+    {
+        MappedAVLTree<int,int> mapped(mappedPath, MappedAVLTree<int,int>::ReadOnly);
+        cout << "mapped after crash: read-write refused " << refused << ", read-only size " << mapped.size()
+             << ", contains(5000) " << mapped.contains(5000) << ", valid " << mapped.verify().valid << endl;
+    }
+    std::remove(mappedPath);
+
+    // A durable tree replays its log when reopened
+    const std::string durablePath = "/tmp/bst-test-durable";
+    const char* durableFiles[] = { ".ckpt", ".wal", ".lock" };
+    for(int i = 0; i < 3; ++i) std::remove((durablePath + durableFiles[i]).c_str());
+    {
+        DurableAVLTree<int,std::string> durable(durablePath);
+        for(int i = 1; i <= 10; ++i) durable.insert(std::make_pair(i, std::string(i, '*')));
+        durable.checkpoint();
+        durable.insert(std::make_pair(11, std::string("eleven")));
+        durable.remove(3);
+    }
+    {
+        DurableAVLTree<int,std::string> durable(durablePath);
+        std::string value;
+        durable.find(11, value);
+        cout << "durable: size " << durable.size() << ", replayed " << durable.recoveredRecords() << ", [11] " << value
+             << ", contains(3) " << durable.contains(3) << ", valid " << durable.verify().valid << endl;
+    }
+    for(int i = 0; i < 3; ++i) std::remove((durablePath + durableFiles[i]).c_str());
+
+    // Readers share a tree with a writer without taking its lock
+    ConcurrentAVLTree<int,std::string> shared;
+    for(int i = 0; i < 100; ++i) shared.insert(std::make_pair(i, std::string("v")));
+    std::thread writer([&shared]() {
+        for(int i = 100; i < 200; ++i) shared.insert(std::make_pair(i, std::string("w")));
+        for(int i = 0; i < 100; i += 2) shared.remove(i);
+    });
+    int oddHits = 0;
+    for(int i = 1; i < 100; i += 2) {
+        std::string value;
+        oddHits += shared.find(i, value) && value == "v";
+    }
+    writer.join();
+    cout << "concurrent: odd keys always found " << (oddHits == 50) << ", size " << shared.size()
+         << ", contains(2) " << shared.contains(2) << ", valid " << shared.verify().valid << endl;
+
+    // Writers on disjoint key ranges run at once; each keeps its odd keys
+    MultiWriterAVLTree<int,int> ingest;
+    std::vector<std::thread> writers;
+    for(int w = 0; w < 4; ++w) {
+        writers.push_back(std::thread([&ingest, w]() {
+            for(int i = 0; i < 1000; ++i) ingest.insert(std::make_pair(w * 1000 + i, w));
+            for(int i = 0; i < 1000; i += 2) ingest.remove(w * 1000 + i);
+        }));
+    }
+    for(size_t w = 0; w < writers.size(); ++w) writers[w].join();
+    int owner = -1;
+    cout << "multi-writer: size " << ingest.size() << ", contains(2000) " << ingest.contains(2000)
+         << ", find(2001) " << (ingest.find(2001, owner) ? owner : -1)
+         << ", valid " << ingest.verify().valid << endl;
+
+    // Writers on overlapping keys race over the same paths; every round must
+    // leave a balanced tree whose size matches what lookups find
+    bool allValid = true;
+    for(int round = 0; round < 20; ++round) {
+        MultiWriterAVLTree<int,int> contested;
+        std::vector<std::thread> racers;
+        for(int w = 0; w < 8; ++w) {
+            racers.push_back(std::thread([&contested, w, round]() {
+                unsigned int seed = 2654435761u * (round * 8 + w + 1);
+                for(int i = 0; i < 3000; ++i) {
+                    seed = seed * 1103515245u + 12345u;
+                    int key = (seed >> 8) % 4000;
+                    if((seed >> 4) % 3 == 0) contested.remove(key);
+                    else if((seed >> 4) % 3 == 1) contested.insert(std::make_pair(key, w));
+                    else contested.contains(key);
+                }
+            }));
+        }
+        for(size_t w = 0; w < racers.size(); ++w) racers[w].join();
+        size_t found = 0;
+        for(int key = 0; key < 4000; ++key) found += contested.contains(key);
+        allValid = allValid && contested.verify().valid && found == contested.size();
+    }
+    cout << "multi-writer overlapping: rounds 20, all valid " << allValid << endl;
+
+    // A snapshot keeps its view while the tree moves on
+    PersistentAVLTree<int,int> ledger;
+    for(int i = 1; i <= 5; ++i) ledger.insert(std::make_pair(i, 10 * i));
+    PersistentAVLTree<int,int>::Snapshot before = ledger.snapshot();
+    ledger.insert(std::make_pair(3, 333));
+    ledger.insert(std::make_pair(6, 60));
+    ledger.remove(1);
+    cout << "snapshot:";
+    for(PersistentAVLTree<int,int>::const_iterator it = before.begin(); it != before.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << "; live:";
+    for(PersistentAVLTree<int,int>::const_iterator it = ledger.begin(); it != ledger.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << "; valid " << (before.verify().valid && ledger.verify().valid) << endl;
+
+    // Copies that throw partway through a path leave both versions whole
+    PersistentAVLTree<int,FragileValue> journal;
+    for(int i = 0; i < 100; ++i) journal.insert(std::make_pair(i, FragileValue(i)));
+    PersistentAVLTree<int,FragileValue>::Snapshot kept = journal.snapshot();
+    int failures = 0;
+    for(int key = 0; key < 200; key += 10) {
+        copiesLeft = 3;
+        try {
+            if(key < 100) journal.remove(key);
+            else journal.insert(std::make_pair(key, FragileValue(-1)));
+        }
+        catch(const std::runtime_error&) {
+            ++failures;
+        }
+        copiesLeft = -1;
+    }
+    for(int i = 0; i < 100; i += 3) journal.remove(i);
+    cout << "Failed path copies: " << failures << ", tree size " << journal.size() << ", snapshot size " << kept.size()
+         << ", snapshot [50] " << kept.lookup(50)->v << ", valid " << (journal.verify().valid && kept.verify().valid) << endl;
+
     return 0;
 }
@@ -3,24 +3,36 @@
 
 #include <iostream>
 #include <exception>
+#include <stdexcept>
 #include <cstdlib>
+#include <cstdint>
 #include <utility>
 #include <algorithm> // for std::max
 #include <cmath>     // for std::abs
+#include <string>
+#include <vector>
+#include <memory>      // for std::allocator
+#include <type_traits>
+#include <tuple>
+#include <iterator>
+#include <functional> // for std::less
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * Future kinds of search trees, such as Red Black trees,
+ * Splay trees, and AVL trees, derive their own node class
+ * from this one and redefine the getters for parent/left/right
+ * to return their own type. Nothing here is virtual: a tree is
+ * instantiated with its concrete node type (see BinarySearchTree),
+ * so every call resolves statically and nodes carry no vptr.
  */
 template <typename Key, typename Value>
 class Node
 {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    template<typename... Args>
+    Node(Node<Key, Value>* parent, Args&&... args);
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -28,20 +40,25 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
     void setRight(Node<Key, Value>* right);
     void setValue(const Value &value);
 
+    // Number of nodes in the subtree rooted here, including this one
+    uint32_t getSize() const;
+    void setSize(uint32_t size);
+
 protected:
     std::pair<const Key, Value> item_;
     Node<Key, Value>* parent_;
     Node<Key, Value>* left_;
     Node<Key, Value>* right_;
+    uint32_t size_;    // 32 bits leaves room for a derived node's fields in the padding
 };
 
 /*
@@ -58,18 +75,24 @@ Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* par
     item_(key, value),
     parent_(parent),
     left_(NULL),
-    right_(NULL)
+    right_(NULL),
+    size_(1)
 {
 
 }
 
 /**
-* Destructor, which does not need to do anything since the pointers inside of a node
-* are only used as references to existing nodes. The nodes pointed to by parent/left/right
-* are freed by the BinarySearchTree.
+* Constructs the item in place from args, as std::pair's constructors
+* would, e.g. (key, value) or (std::piecewise_construct, keyArgs, valueArgs).
 */
 template<typename Key, typename Value>
-Node<Key, Value>::~Node()
+template<typename... Args>
+Node<Key, Value>::Node(Node<Key, Value>* parent, Args&&... args) :
+    item_(std::forward<Args>(args)...),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL),
+    size_(1)
 {
 
 }
@@ -120,7 +143,7 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const
@@ -129,7 +152,7 @@ Node<Key, Value>* Node<Key, Value>::getParent() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
@@ -138,7 +161,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
@@ -182,38 +205,142 @@ void Node<Key, Value>::setValue(const Value& value)
     item_.second = value;
 }
 
+/**
+* A getter for the size of the subtree rooted at this node.
+*/
+template<typename Key, typename Value>
+uint32_t Node<Key, Value>::getSize() const
+{
+    return size_;
+}
+
+/**
+* A setter for the size of the subtree rooted at this node.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setSize(uint32_t size)
+{
+    size_ = size;
+}
+
 /*
   ---------------------------------------
   End implementations for the Node class.
   ---------------------------------------
 */
 
+// Defined in frozentree.h, which has to be included to call freeze()
+template <typename Key, typename Value, typename Compare>
+class FrozenTree;
+
+// Defined in threadpool.h; bstparallel.h has to be included to call
+// parallel_for_each() or parallel_reduce()
+class WorkStealingPool;
+
+// Defined in treeio.h; bstio.h has to be included to call save() or
+// load()
+struct BinaryCodec;
+
+/**
+* The result of BinarySearchTree::verify(). valid covers the invariants
+* of the tree at hand (key ordering, parent/child links, subtree sizes and
+* anything a derived tree stores per node, e.g. AVL balance factors);
+* balanced is the height-balance property on its own. Trees that promise
+* that property (the AVL trees) count its loss as invalid too; a plain
+* BST, a red-black or a splay tree need not have it, so there it only
+* clears balanced. error describes the violation that made the tree
+* invalid and is empty exactly when valid is true.
+*/
+struct TreeReport
+{
+    TreeReport() : valid(true), balanced(true), height(0), nodeCount(0) { }
+
+    bool valid;
+    bool balanced;
+    int height;
+    size_t nodeCount;
+    std::string error;
+};
+
+/**
+* Detects allocators that can hand back all of their memory at once
+* through a release() member, such as SlabAllocator in slaballoc.h.
+* They also say through soleOwner() whether anyone else allocates from
+* the same memory, in which case it must not be released.
+*/
+template <typename A>
+class HasBulkRelease
+{
+    template <typename U> static char test(decltype(&U::release), decltype(&U::soleOwner));
+    template <typename U> static long test(...);
+public:
+    static const bool value = sizeof(test<A>(0, 0)) == sizeof(char);
+};
+
 /**
 * A templated unbalanced binary search tree.
+*
+* Keys are ordered by Compare, a strict weak ordering as for std::map.
+* Each descent calls it once per level and tests for equality only once
+* at the end. If Compare declares is_transparent, find, contains,
+* lower_bound and upper_bound also take any key type Compare accepts.
+*
+* Nodes are obtained from Alloc rebound to the node type, so a pool
+* allocator such as SlabAllocator can be plugged in; the default behaves
+* like plain new/delete. NodeType is the node class the tree is made of
+* and is only set by derived trees, e.g. AVLTree uses AVLNode.
 */
-template <typename Key, typename Value>
+template <typename Key, typename Value,
+          typename Compare = std::less<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value> >,
+          typename NodeType = Node<Key, Value> >
 class BinarySearchTree
 {
 public:
     BinarySearchTree();
+    explicit BinarySearchTree(const Compare& comp);
+    BinarySearchTree(const Compare& comp, const Alloc& alloc);
+    template<typename ForwardIt>
+    BinarySearchTree(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
     virtual ~BinarySearchTree();
     virtual void insert(const std::pair<const Key, Value>& keyValuePair);
+    void insert(std::pair<const Key, Value>&& keyValuePair);
+    template<typename K, typename V>
+    void insert(std::pair<K, V>&& keyValuePair);
+    template<typename ForwardIt>
+    void insert(ForwardIt first, ForwardIt last);
     virtual void remove(const Key& key);
+    template<typename ForwardIt>
+    void assign(ForwardIt first, ForwardIt last);
     void clear();
     bool isBalanced() const;
+    TreeReport verify() const;
     void print() const;
     bool empty() const;
+    size_t size() const;
 
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+    template<typename PPKey, typename PPValue, typename PPCompare, typename PPAlloc, typename PPNode>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPCompare, PPAlloc, PPNode> & tree);
 
 public:
+    class const_iterator;
+
     /**
     * An internal iterator class for traversing the contents of the BST.
+    * It is bidirectional: each step is a successor/predecessor walk,
+    * which is amortized O(1) over a full traversal. The end iterator
+    * holds no node, so it remembers its tree to let --end() reach the
+    * largest item.
     */
     class iterator
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key,Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -223,37 +350,207 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class BinarySearchTree<Key, Value, Compare, Alloc, NodeType>;
+        friend class const_iterator;
+        iterator(NodeType* ptr, const BinarySearchTree* tree);
+        NodeType* current_;
+        const BinarySearchTree* tree_;
+    };
+
+    /**
+    * The read-only counterpart of iterator. An iterator converts to a
+    * const_iterator, and the two can be compared with each other.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key,Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        friend bool operator==(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs.current_ == rhs.current_;
+        }
+        friend bool operator!=(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs.current_ != rhs.current_;
+        }
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
-        Node<Key, Value> *current_;
+        friend class BinarySearchTree<Key, Value, Compare, Alloc, NodeType>;
+        const_iterator(NodeType* ptr, const BinarySearchTree* tree);
+        NodeType* current_;
+        const BinarySearchTree* tree_;
     };
 
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
 public:
-    iterator begin() const;
-    iterator end() const;
+    iterator begin();
+    iterator end();
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin();
+    reverse_iterator rend();
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj);
     iterator find(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+    void findBatch(const std::vector<Key>& keys, std::vector<iterator>& out) const;
+    bool contains(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    bool contains(const K& key) const;
+    Value* lookup(const Key& key);
+    const Value* lookup(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) const;
+    iterator upper_bound(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    template<typename Visitor>
+    void scan(const Key& lo, const Key& hi, Visitor visit) const;
+    template<typename Function>
+    void parallel_for_each(Function f);
+    template<typename Function>
+    void parallel_for_each(Function f, WorkStealingPool& pool);
+    template<typename Function>
+    void parallel_for_each(Function f) const;
+    template<typename Function>
+    void parallel_for_each(Function f, WorkStealingPool& pool) const;
+    template<typename T, typename Map, typename Combine>
+    T parallel_reduce(T identity, Map map, Combine combine, bool ordered = true) const;
+    template<typename T, typename Map, typename Combine>
+    T parallel_reduce(T identity, Map map, Combine combine, bool ordered, WorkStealingPool& pool) const;
+    size_t rank(const Key& key) const;
+    iterator select(size_t k) const;
+    size_t count(const Key& lo, const Key& hi) const;
+    Compare key_comp() const;
+    FrozenTree<Key, Value, Compare> freeze() const;
+    template<typename Codec = BinaryCodec>
+    void save(std::ostream& out, const Codec& codec = Codec()) const;
+    template<typename Codec = BinaryCodec>
+    void save(int fd, const Codec& codec = Codec()) const;
+    template<typename Codec = BinaryCodec>
+    void load(std::istream& in, const Codec& codec = Codec());
+    template<typename Codec = BinaryCodec>
+    void load(int fd, const Codec& codec = Codec());
     Value& operator[](const Key& key);
+    Value& operator[](Key&& key);
     Value const & operator[](const Key& key) const;
 
 protected:
     // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const;
-    Node<Key, Value>* getSmallestNode() const;
-    static Node<Key, Value>* predecessor(Node<Key, Value>* current);
-    static Node<Key, Value>* successor(Node<Key, Value>* current);
+    NodeType* internalFind(const Key& k) const;
+    template<typename K>
+    NodeType* findNode(const K& k) const;
+    NodeType* findInsertPos(const Key& k, NodeType*& parent, bool& left) const;
+    iterator makeIterator(NodeType* node) const;
+    void linkNode(NodeType* node, NodeType* parent, bool left);
+    virtual void afterInsert(NodeType* node);
+    virtual void afterHit(NodeType* node);
+    template<typename P>
+    void insertPair(P&& keyValuePair);
+    template<typename K, typename... Args>
+    std::pair<iterator, bool> tryEmplaceKey(K&& key, Args&&... args);
+    template<typename K, typename M>
+    std::pair<iterator, bool> insertOrAssignKey(K&& key, M&& obj);
+    template<typename K>
+    NodeType* internalLowerBound(const K& k) const;
+    template<typename K>
+    NodeType* internalUpperBound(const K& k) const;
+    NodeType* getSmallestNode() const;
+    NodeType* getLargestNode() const;
+    static void prefetchNode(const NodeType* node);
+    static NodeType* predecessor(NodeType* current);
+    static NodeType* successor(NodeType* current);
+    static size_t subtreeSize(NodeType* node);
+    static void updateSize(NodeType* node);
+    static void adjustSizes(NodeType* node, int delta);
 
     // Provided helper functions
-    virtual void printRoot (Node<Key, Value> *r) const;
-    virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2);
+    virtual void printRoot (NodeType* r) const;
+    virtual void nodeSwap( NodeType* n1, NodeType* n2);
 
     // Additional helper
-    void clearHelper(Node<Key,Value>* node);
+    void clearHelper(NodeType* node);
+    void destroyHelper(NodeType* node);
+    void clearNodes(std::false_type);
+    void clearNodes(std::true_type);
+    virtual const char* verifyNode(NodeType* node, int leftHeight, int rightHeight) const;
+    template<typename ForwardIt>
+    void sortRange(ForwardIt first, ForwardIt last, std::vector<ForwardIt>& order) const;
+    NodeType* linkBalanced(NodeType* const* nodes, size_t count, NodeType* parent, int& height);
+    template<typename Codec>
+    NodeType* loadBalanced(std::istream& in, const Codec& codec, uint64_t count, NodeType* parent,
+                           NodeType*& last, int& height);
+    virtual void initBuiltNode(NodeType* node, int leftHeight, int rightHeight);
+
+    // Node allocation
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<NodeType> NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeAllocTraits;
+
+    template<typename... Args>
+    NodeType* createNode(NodeType* parent, Args&&... args);
+    void destroyNode(NodeType* node);
+
+    // Batches smaller than this are always inserted one pair at a time
+    static const size_t MinMergeBatch = 64;
+
+    // A stretch of consecutive items, the unit of parallel traversal
+    struct Run
+    {
+        NodeType* first;
+        size_t count;
+    };
+
+    // Parallel traversals hand out runs of at most this many items
+    static const size_t ParallelChunk = 4096;
+
+    void partitionRuns(std::vector<Run>& runs) const;
+    template<typename Visit>
+    void forEachRun(Visit visit, WorkStealingPool& pool) const;
 
 protected:
-    Node<Key, Value>* root_;
-    // You should not need other data members
+    NodeType* root_;
+    NodeAlloc alloc_;
+    Compare comp_;
 };
 
 /*
@@ -263,29 +560,32 @@ Begin implementations for the BinarySearchTree::iterator class.
 */
 
 /**
-* Explicit constructor that initializes an iterator with a given node pointer.
+* Explicit constructor that initializes an iterator with a given node
+* pointer (NULL for the end) and the tree the node belongs to.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::iterator(NodeType* ptr, const BinarySearchTree* tree)
 {
     current_ = ptr;
+    tree_ = tree;
 }
 
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::iterator() 
 {
     current_ = NULL;
+    tree_ = NULL;
 }
 
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
 std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator*() const
 {
     return current_->getItem();
 }
@@ -293,9 +593,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
 std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator->() const
 {
     return &(current_->getItem());
 }
@@ -303,10 +603,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 /**
 * Checks if 'this' iterator's internals have the same value as 'rhs'
 */
-template<class Key, class Value>
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator& rhs) const
 {
     return current_ == rhs.current_;
 }
@@ -314,10 +614,10 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 /**
 * Checks if 'this' iterator's internals have a different value as 'rhs'
 */
-template<class Key, class Value>
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator& rhs) const
 {
     return current_ != rhs.current_;
 }
@@ -325,14 +625,49 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator&
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator++()
+{
+    current_ = BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::successor(current_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Moves the iterator back one item in in-order sequencing. Decrementing
+* the end iterator moves it to the largest item.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator&
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator--()
 {
-    current_ = BinarySearchTree<Key,Value>::successor(current_);
+    if(current_ == NULL) {
+        current_ = tree_->getLargestNode();
+    }
+    else {
+        current_ = BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::predecessor(current_);
+    }
     return *this;
 }
 
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --(*this);
+    return old;
+}
+
 /*
 -------------------------------------------------------------
 End implementations for the BinarySearchTree::iterator class.
@@ -340,309 +675,1442 @@ End implementations for the BinarySearchTree::iterator class.
 */
 
 /*
------------------------------------------------------
-Begin implementations for the BinarySearchTree class.
------------------------------------------------------
+-------------------------------------------------------------------
+Begin implementations for the BinarySearchTree::const_iterator class.
+-------------------------------------------------------------------
 */
 
-/**
-* Default constructor for a BinarySearchTree, which sets the root to NULL.
-*/
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::const_iterator(NodeType* ptr, const BinarySearchTree* tree)
 {
-    root_ = NULL;
+    current_ = ptr;
+    tree_ = tree;
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::const_iterator()
 {
-    clear();
+    current_ = NULL;
+    tree_ = NULL;
 }
 
 /**
- * Returns true if tree is empty
+* Converting constructor, so that an iterator can be used wherever a
+* const_iterator is expected.
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::const_iterator(const iterator& it)
 {
-    return root_ == NULL;
+    current_ = it.current_;
+    tree_ = it.tree_;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+const std::pair<const Key,Value> &
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::operator*() const
 {
-    printRoot(root_);
-    std::cout << "\n";
+    return current_->getItem();
 }
 
-/**
-* Returns an iterator to the "smallest" item in the tree
-*/
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+const std::pair<const Key,Value> *
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::operator->() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return begin;
+    return &(current_->getItem());
 }
 
-
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator&
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::operator++()
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
-    return end;
+    current_ = BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::successor(current_);
+    return *this;
 }
 
-/**
-* Returns an iterator to the item with the given key, k
-* or the end iterator if k does not exist in the tree
-*/
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::operator++(int)
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
-    return it;
+    const_iterator old(*this);
+    ++(*this);
+    return old;
 }
 
-/**
- * @precondition The key exists in the map
- * Returns the value associated with the key
- */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator&
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::operator--()
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    if(current_ == NULL) {
+        current_ = tree_->getLargestNode();
+    }
+    else {
+        current_ = BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::predecessor(current_);
+    }
+    return *this;
 }
 
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator::operator--(int)
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    const_iterator old(*this);
+    --(*this);
+    return old;
 }
 
 /*
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+-------------------------------------------------------------------
+End implementations for the BinarySearchTree::const_iterator class.
+-------------------------------------------------------------------
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
-{
-    if(root_ == NULL) {
-        root_ = new Node<Key,Value>(keyValuePair.first, keyValuePair.second, NULL);
-        return;
-    }
-
-    Node<Key,Value>* curr = root_;
-    Node<Key,Value>* parent = NULL;
-
-    while(curr != NULL) {
-        parent = curr;
-        if(keyValuePair.first == curr->getKey()) {
-            curr->setValue(keyValuePair.second); // overwrite value
-            return;
-        }
-        else if(keyValuePair.first < curr->getKey()) {
-            curr = curr->getLeft();
-        }
-        else {
-            curr = curr->getRight();
-        }
-    }
 
-    Node<Key,Value>* newNode =
-        new Node<Key,Value>(keyValuePair.first, keyValuePair.second, parent);
+/*
+-----------------------------------------------------
+Begin implementations for the BinarySearchTree class.
+-----------------------------------------------------
+*/
 
-    if(keyValuePair.first < parent->getKey()) parent->setLeft(newNode);
-    else parent->setRight(newNode);
+/**
+* Default constructor for a BinarySearchTree, which sets the root to NULL.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::BinarySearchTree() 
+{
+    root_ = NULL;
 }
 
 /**
-* A remove method to remove a specific key from a Binary Search Tree.
-* Recall: The writeup specifies that if a node has 2 children you
-* should swap with the predecessor and then remove.
+* Constructor for an empty tree ordered by the given comparator.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::BinarySearchTree(const Compare& comp) :
+    comp_(comp)
 {
-    Node<Key,Value>* node = internalFind(key);
-    if(node == NULL) return;
-
-
-    if(node->getLeft() != NULL && node->getRight() != NULL) {
-        Node<Key,Value>* pred = predecessor(node);
-        nodeSwap(node, pred);
-    }
-
-
-    Node<Key,Value>* child =
-        (node->getLeft() != NULL ? node->getLeft() : node->getRight());
-
-    if(child != NULL) {
-        child->setParent(node->getParent());
-    }
-
-    if(node->getParent() == NULL) {
-
-        root_ = child;
-    }
-    else if(node == node->getParent()->getLeft()) {
-        node->getParent()->setLeft(child);
-    }
-    else {
-        node->getParent()->setRight(child);
-    }
-
-    delete node;
+    root_ = NULL;
 }
 
-
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+/**
+* Constructor for an empty tree that takes its nodes from a copy of
+* alloc, for allocators that carry state.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::BinarySearchTree(const Compare& comp, const Alloc& alloc) :
+    alloc_(alloc),
+    comp_(comp)
 {
-    if(current == NULL) return NULL;
-
-
-    if(current->getLeft() != NULL) {
-        Node<Key,Value>* temp = current->getLeft();
-        while(temp->getRight() != NULL) temp = temp->getRight();
-        return temp;
-    }
+    root_ = NULL;
+}
 
+/**
+* Builds a balanced tree from the pairs in [first, last); see assign().
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename ForwardIt>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::BinarySearchTree(ForwardIt first, ForwardIt last, const Compare& comp) :
+    comp_(comp)
+{
+    root_ = NULL;
+    assign(first, last);
+}
 
-    Node<Key,Value>* parent = current->getParent();
-    while(parent != NULL && current == parent->getLeft()) {
-        current = parent;
-        parent = parent->getParent();
-    }
-    return parent;
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::~BinarySearchTree()
+{
+    clear();
 }
 
+/**
+ * Returns true if tree is empty
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+bool BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::empty() const
+{
+    return root_ == NULL;
+}
 
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current)
+/**
+ * Returns the number of keys in the tree in O(1)
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+size_t BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::size() const
 {
-    if(current == NULL) return NULL;
+    return subtreeSize(root_);
+}
 
-    
-    if(current->getRight() != NULL) {
-        Node<Key,Value>* temp = current->getRight();
-        while(temp->getLeft() != NULL) temp = temp->getLeft();
-        return temp;
-    }
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::print() const
+{
+    printRoot(root_);
+    std::cout << "\n";
+}
 
-    
-    Node<Key,Value>* parent = current->getParent();
-    while(parent != NULL && current == parent->getRight()) {
-        current = parent;
-        parent = parent->getParent();
-    }
-    return parent;
+/**
+* Returns an iterator to the "smallest" item in the tree
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::begin()
+{
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator begin(getSmallestNode(), this);
+    return begin;
 }
 
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::end()
 {
-    clearHelper(root_);
-    root_ = NULL;
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator end(NULL, this);
+    return end;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clearHelper(Node<Key,Value>* node)
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::begin() const
 {
-    if(node == NULL) return;
-    clearHelper(node->getLeft());
-    clearHelper(node->getRight());
-    delete node;
+    return const_iterator(getSmallestNode(), this);
 }
 
-
-template<typename Key, typename Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::end() const
 {
-    Node<Key,Value>* curr = root_;
-    if(curr == NULL) return NULL;
-    while(curr->getLeft() != NULL) curr = curr->getLeft();
-    return curr;
+    return const_iterator(NULL, this);
 }
 
-
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::cbegin() const
 {
-    Node<Key,Value>* curr = root_;
-    while(curr != NULL) {
-        if(key == curr->getKey()) return curr;
-        else if(key < curr->getKey()) curr = curr->getLeft();
-        else curr = curr->getRight();
-    }
-    return NULL;
+    return begin();
 }
 
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::cend() const
+{
+    return end();
+}
 
-template<typename Key, typename Value>
-int height(Node<Key,Value>* node)
+/**
+* Reverse iteration starts at the "largest" item. rbegin() wraps end(),
+* so it relies on --end() reaching that item.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::rbegin()
 {
-    if(node == NULL) return 0;
-    int lh = height<Key,Value>(node->getLeft());
-    int rh = height<Key,Value>(node->getRight());
-    return 1 + std::max(lh, rh);
+    return reverse_iterator(end());
 }
 
-template<typename Key, typename Value>
-bool isBalancedHelper(Node<Key,Value>* node)
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::rend()
 {
-    if(node == NULL) return true;
+    return reverse_iterator(begin());
+}
 
-    int lh = height<Key,Value>(node->getLeft());
-    int rh = height<Key,Value>(node->getRight());
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
 
-    if(std::abs(lh - rh) > 1) return false;
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
 
-    return isBalancedHelper<Key,Value>(node->getLeft()) &&
-           isBalancedHelper<Key,Value>(node->getRight());
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::crbegin() const
+{
+    return rbegin();
 }
 
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::crend() const
 {
-    return isBalancedHelper<Key,Value>(root_);
+    return rend();
 }
 
 /**
- * nodeSwap provided to you.
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::find(const Key & k) const
+{
+    NodeType* curr = internalFind(k);
+    BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator it(curr, this);
+    return it;
+}
+
+/**
+* Heterogeneous find, only available when Compare is transparent:
+* k can be any type Compare orders against Key, e.g. a const char*
+* for string keys, and is never converted to Key
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::find(const K& k) const
+{
+    return iterator(findNode(k), this);
+}
+
+/**
+* Looks up every key in keys and stores the result of find(keys[i]) in
+* out[i]. A single find waits on one cache miss per level before it
+* knows which child to load next. Here up to BatchWidth searches are in
+* flight at once: each round moves every search down one level and
+* prefetches the child it lands on, so the misses of different keys
+* overlap. A finished search hands its slot to the next key. Trees
+* small enough to stay in cache gain nothing from this and are searched
+* one key at a time.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::findBatch(const std::vector<Key>& keys, std::vector<iterator>& out) const
+{
+    static const size_t BatchWidth = 16;
+    static const size_t CacheResident = 16384;
+    struct Search
+    {
+        size_t index;
+        NodeType* curr;
+        NodeType* best;  // smallest key seen that is not less than the probe
+    };
+
+    out.assign(keys.size(), iterator(NULL, this));
+    if(size() <= CacheResident) {
+        for(size_t i = 0; i < keys.size(); ++i) out[i] = iterator(internalFind(keys[i]), this);
+        return;
+    }
+    Search searches[BatchWidth];
+    size_t active = 0;
+    size_t next = 0;
+    for(; active < BatchWidth && next < keys.size(); ++active, ++next) {
+        Search s = { next, root_, NULL };
+        searches[active] = s;
+    }
+    prefetchNode(root_);
+
+    while(active > 0) {
+        for(size_t i = 0; i < active; ) {
+            Search& s = searches[i];
+            const Key& k = keys[s.index];
+            if(s.curr == NULL) {
+                if(s.best != NULL && !comp_(k, s.best->getKey())) {
+                    out[s.index] = iterator(s.best, this);
+                }
+                if(next < keys.size()) {
+                    s.index = next++;
+                    s.curr = root_;
+                    s.best = NULL;
+                    ++i;
+                }
+                else {
+                    s = searches[--active];
+                }
+                continue;
+            }
+            if(comp_(s.curr->getKey(), k)) {
+                s.curr = s.curr->getRight();
+            }
+            else {
+                s.best = s.curr;
+                s.curr = s.curr->getLeft();
+            }
+            prefetchNode(s.curr);
+            ++i;
+        }
+    }
+}
+
+/**
+* Returns true if key is in the tree
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+bool BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::contains(const Key& key) const
+{
+    return findNode(key) != NULL;
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K, typename C, typename>
+bool BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::contains(const K& key) const
+{
+    return findNode(key) != NULL;
+}
+
+/**
+* Returns a pointer to the value stored under key, or NULL if key is
+* not in the tree. Unlike operator[] it neither inserts nor throws.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+Value* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::lookup(const Key& key)
+{
+    NodeType* curr = findNode(key);
+    return curr == NULL ? NULL : &curr->getValue();
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+const Value* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::lookup(const Key& key) const
+{
+    NodeType* curr = findNode(key);
+    return curr == NULL ? NULL : &curr->getValue();
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than
+* key, or the end iterator if there is none
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::lower_bound(const Key& key) const
+{
+    return iterator(internalLowerBound(key), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than
+* key, or the end iterator if there is none
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::upper_bound(const Key& key) const
+{
+    return iterator(internalUpperBound(key), this);
+}
+
+/**
+* Heterogeneous lower_bound and upper_bound, only available when
+* Compare is transparent
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::lower_bound(const K& key) const
+{
+    return iterator(internalLowerBound(key), this);
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::upper_bound(const K& key) const
+{
+    return iterator(internalUpperBound(key), this);
+}
+
+/**
+* Returns the range of items with the given key: empty if the key is
+* absent, otherwise the one matching item
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator>
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::equal_range(const Key& key) const
+{
+    return std::make_pair(lower_bound(key), upper_bound(key));
+}
+
+/**
+* Calls visit(item) on every item with a key in [lo, hi), in key
+* order. Costs O(log n + k) for k visited items: one descent to find
+* the start, then successor steps.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename Visitor>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::scan(const Key& lo, const Key& hi, Visitor visit) const
+{
+    for(NodeType* curr = internalLowerBound(lo);
+        curr != NULL && comp_(curr->getKey(), hi);
+        curr = successor(curr)) {
+        visit(curr->getItem());
+    }
+}
+
+/**
+* Returns the number of keys strictly less than key, in O(log n)
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+size_t BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::rank(const Key& key) const
+{
+    size_t r = 0;
+    NodeType* curr = root_;
+    while(curr != NULL) {
+        if(comp_(curr->getKey(), key)) {
+            r += subtreeSize(curr->getLeft()) + 1;
+            curr = curr->getRight();
+        }
+        else {
+            curr = curr->getLeft();
+        }
+    }
+    return r;
+}
+
+/**
+* Returns an iterator to the k-th smallest key (counting from 0),
+* or the end iterator if k >= size(), in O(log n)
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::select(size_t k) const
+{
+    NodeType* curr = root_;
+    while(curr != NULL) {
+        size_t leftSize = subtreeSize(curr->getLeft());
+        if(k < leftSize) {
+            curr = curr->getLeft();
+        }
+        else if(k == leftSize) {
+            break;
+        }
+        else {
+            k -= leftSize + 1;
+            curr = curr->getRight();
+        }
+    }
+    return iterator(curr, this);
+}
+
+/**
+* Returns a copy of the comparator that orders the keys
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+Compare BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Returns the number of keys in [lo, hi), in O(log n)
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+size_t BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::count(const Key& lo, const Key& hi) const
+{
+    if(!comp_(lo, hi)) return 0;
+    return rank(hi) - rank(lo);
+}
+
+/**
+ * Returns the value associated with the key, inserting a
+ * default-constructed value first if the key is missing.
+ * Costs a single descent either way.
+ */
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+Value& BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::operator[](const Key& key)
+{
+    return tryEmplaceKey(key).first->second;
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+Value& BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::operator[](Key&& key)
+{
+    return tryEmplaceKey(std::move(key)).first->second;
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
  */
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+Value const & BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::operator[](const Key& key) const
+{
+    NodeType* curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/*
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    insertPair(keyValuePair);
+}
+
+/**
+* Like insert(const pair&), but moves the value into the tree
+* (the key is const here and has to be copied).
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    insertPair(std::move(keyValuePair));
+}
+
+/**
+* Like insert(const pair&), but moves both key and value into the tree.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K, typename V>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert(std::pair<K, V>&& keyValuePair)
+{
+    insertPair(std::move(keyValuePair));
+}
+
+/**
+* Shared body of the insert overloads: overwrites the value if the key
+* exists, otherwise builds a node from the (possibly moved) pair.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename P>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insertPair(P&& keyValuePair)
+{
+    NodeType* parent;
+    bool left;
+    NodeType* node = findInsertPos(keyValuePair.first, parent, left);
+    if(node != NULL) {
+        node->getValue() = std::forward<P>(keyValuePair).second; // overwrite value
+        afterHit(node);
+        return;
+    }
+    linkNode(createNode(parent, std::forward<P>(keyValuePair)), parent, left);
+}
+
+/**
+* Constructs an item in place from args. Unlike insert, an existing key
+* is left untouched; the returned flag says whether an item was added.
+* The node is built before the key is known, so a duplicate costs an
+* allocation; use try_emplace when the key is at hand.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool> BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::emplace(Args&&... args)
+{
+    NodeType* node = createNode(NULL, std::forward<Args>(args)...);
+    NodeType* parent;
+    bool left;
+    NodeType* existing = findInsertPos(node->getKey(), parent, left);
+    if(existing != NULL) {
+        destroyNode(node);
+        afterHit(existing);
+        return std::make_pair(iterator(existing, this), false);
+    }
+    node->setParent(parent);
+    linkNode(node, parent, left);
+    return std::make_pair(iterator(node, this), true);
+}
+
+/**
+* Inserts key with a value constructed from args, unless the key
+* already exists, in which case nothing (not even the value) is built.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool> BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::try_emplace(const Key& key, Args&&... args)
+{
+    return tryEmplaceKey(key, std::forward<Args>(args)...);
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool> BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::try_emplace(Key&& key, Args&&... args)
+{
+    return tryEmplaceKey(std::move(key), std::forward<Args>(args)...);
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K, typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool> BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::tryEmplaceKey(K&& key, Args&&... args)
+{
+    NodeType* parent;
+    bool left;
+    NodeType* node = findInsertPos(key, parent, left);
+    if(node != NULL) {
+        afterHit(node);
+        return std::make_pair(iterator(node, this), false);
+    }
+    node = createNode(parent, std::piecewise_construct,
+                      std::forward_as_tuple(std::forward<K>(key)),
+                      std::forward_as_tuple(std::forward<Args>(args)...));
+    linkNode(node, parent, left);
+    return std::make_pair(iterator(node, this), true);
+}
+
+/**
+* Assigns obj to the value of key if it exists, otherwise inserts it.
+* The flag is true if an item was added.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool> BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert_or_assign(const Key& key, M&& obj)
+{
+    return insertOrAssignKey(key, std::forward<M>(obj));
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool> BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert_or_assign(Key&& key, M&& obj)
+{
+    return insertOrAssignKey(std::move(key), std::forward<M>(obj));
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K, typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator, bool> BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insertOrAssignKey(K&& key, M&& obj)
+{
+    NodeType* parent;
+    bool left;
+    NodeType* node = findInsertPos(key, parent, left);
+    if(node != NULL) {
+        node->getValue() = std::forward<M>(obj);
+        afterHit(node);
+        return std::make_pair(iterator(node, this), false);
+    }
+    node = createNode(parent, std::forward<K>(key), std::forward<M>(obj));
+    linkNode(node, parent, left);
+    return std::make_pair(iterator(node, this), true);
+}
+
+/**
+* Looks for k in a single descent. Returns its node if present;
+* otherwise returns NULL and sets parent/left to the spot where a
+* node for k has to be linked (parent is NULL for an empty tree).
+* Compares once per level: the last node the descent went right from
+* holds the largest key not greater than k, so k is present exactly
+* when that node's key is also not less than k.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::findInsertPos(const Key& k, NodeType*& parent, bool& left) const
+{
+    parent = NULL;
+    left = false;
+    NodeType* candidate = NULL;
+    NodeType* curr = root_;
+    while(curr != NULL) {
+        parent = curr;
+        left = comp_(k, curr->getKey());
+        if(left) {
+            curr = curr->getLeft();
+        }
+        else {
+            candidate = curr;
+            curr = curr->getRight();
+        }
+    }
+    if(candidate != NULL && !comp_(candidate->getKey(), k)) return candidate;
+    return NULL;
+}
+
+/**
+* An iterator at node (end() for NULL), for derived trees that look up
+* nodes themselves
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+typename BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::makeIterator(NodeType* node) const
+{
+    return iterator(node, this);
+}
+
+/**
+* Links a freshly created node into the spot found by findInsertPos()
+* and lets the tree restore its invariants.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::linkNode(NodeType* node, NodeType* parent, bool left)
+{
+    if(parent == NULL) root_ = node;
+    else if(left) parent->setLeft(node);
+    else parent->setRight(node);
+    afterInsert(node);
+}
+
+/**
+* Hook called after every single-node insertion with the new node,
+* already linked. A plain BST only needs to update subtree sizes;
+* balanced trees override this to retrace and rotate.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::afterInsert(NodeType* node)
+{
+    adjustSizes(node->getParent(), 1);
+}
+
+/**
+* Hook called when insert, emplace, try_emplace, insert_or_assign or
+* operator[] finds its key already in the tree, with that key's node.
+* The shape of the tree is unchanged, so most trees have nothing to
+* do; a self-adjusting tree overrides this to restructure around it.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::afterHit(NodeType*)
+{
+
+}
+
+/**
+* The size of a possibly empty subtree.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+size_t BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::subtreeSize(NodeType* node)
+{
+    return node == NULL ? 0 : node->getSize();
+}
+
+/**
+* Recomputes a node's subtree size from its children, e.g. after a rotation.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::updateSize(NodeType* node)
+{
+    node->setSize(static_cast<uint32_t>(
+        subtreeSize(node->getLeft()) + subtreeSize(node->getRight()) + 1));
+}
+
+/**
+* Adds delta to the subtree size of node and of all its ancestors.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::adjustSizes(NodeType* node, int delta)
+{
+    for(; node != NULL; node = node->getParent()) {
+        node->setSize(static_cast<uint32_t>(node->getSize() + delta));
+    }
+}
+
+/**
+* Replaces the contents of the tree with the key/value pairs in
+* [first, last), building a perfectly balanced tree in O(n) when the
+* range is already sorted by key. Unsorted input is sorted first
+* (O(n log n)). As with insert, the last pair wins for duplicate keys.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename ForwardIt>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::assign(ForwardIt first, ForwardIt last)
+{
+    std::vector<ForwardIt> order;
+    sortRange(first, last, order);
+
+    // The old contents go first so their memory can be reused (and a
+    // bulk-releasing allocator does not free the new nodes). If a copy
+    // throws, the tree is left empty.
+    clear();
+    std::vector<NodeType*> nodes;
+    nodes.reserve(order.size());
+    try {
+        for(size_t i = 0; i < order.size(); ++i) {
+            if(i + 1 < order.size() && !comp_(order[i]->first, order[i + 1]->first)) {
+                continue; // superseded by a later pair with the same key
+            }
+            nodes.push_back(createNode(NULL, order[i]->first, order[i]->second));
+        }
+    }
+    catch(...) {
+        for(size_t i = 0; i < nodes.size(); ++i) destroyNode(nodes[i]);
+        throw;
+    }
+
+    int height;
+    root_ = linkBalanced(nodes.empty() ? NULL : &nodes[0], nodes.size(), NULL, height);
+}
+
+/**
+* Inserts every pair in [first, last), overwriting existing keys (the
+* last pair wins for keys repeated in the batch). Small batches go
+* through insert() one pair at a time, costing O(m log n). Large ones
+* are sorted and merged with the existing in-order sequence, and the
+* whole tree is relinked in O(n + m) without any rebalancing. In the
+* merge, if copying a pair into a new node throws the tree is left
+* unchanged; existing keys get their new values only after the relink,
+* so if one of those assignments throws the tree holds every key of the
+* batch and only some of the new values.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename ForwardIt>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::insert(ForwardIt first, ForwardIt last)
+{
+    std::vector<ForwardIt> order;
+    sortRange(first, last, order);
+    size_t m = order.size();
+    if(m == 0) return;
+
+    // Merging wins once m * log2(n + m) exceeds n + m
+    size_t n = size();
+    size_t logm = 1;
+    while((size_t(1) << logm) <= n + m) ++logm;
+    if(m < MinMergeBatch || n + m > m * logm) {
+        for(size_t i = 0; i < m; ++i) {
+            insertPair(*order[i]);
+        }
+        return;
+    }
+
+    std::vector<NodeType*> nodes;
+    nodes.reserve(n + m);
+    std::vector<NodeType*> created;
+    std::vector<std::pair<NodeType*, ForwardIt> > overwritten;
+    NodeType* curr = getSmallestNode();
+    size_t i = 0;
+    try {
+        while(curr != NULL || i < m) {
+            if(i + 1 < m && !comp_(order[i]->first, order[i + 1]->first)) {
+                ++i; // superseded by a later pair with the same key
+            }
+            else if(i == m || (curr != NULL && comp_(curr->getKey(), order[i]->first))) {
+                nodes.push_back(curr);
+                curr = successor(curr);
+            }
+            else if(curr == NULL || comp_(order[i]->first, curr->getKey())) {
+                NodeType* node = createNode(NULL, order[i]->first, order[i]->second);
+                created.push_back(node);
+                nodes.push_back(node);
+                ++i;
+            }
+            else {
+                overwritten.push_back(std::make_pair(curr, order[i]));
+                nodes.push_back(curr);
+                curr = successor(curr);
+                ++i;
+            }
+        }
+    }
+    catch(...) {
+        // Nothing has been relinked or overwritten yet, so the tree is
+        // still intact
+        for(size_t j = 0; j < created.size(); ++j) destroyNode(created[j]);
+        throw;
+    }
+
+    int height;
+    root_ = linkBalanced(&nodes[0], nodes.size(), NULL, height);
+    for(size_t j = 0; j < overwritten.size(); ++j) {
+        overwritten[j].first->setValue(overwritten[j].second->second);
+    }
+}
+
+/**
+* Collects iterators to every pair in [first, last) into order, sorted
+* by key and stable so that equal keys keep their input order. Sorting
+* iterators rather than pairs avoids copying keys and values.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename ForwardIt>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::sortRange(ForwardIt first, ForwardIt last, std::vector<ForwardIt>& order) const
+{
+    for(ForwardIt it = first; it != last; ++it) {
+        order.push_back(it);
+    }
+
+    struct KeyLess
+    {
+        const Compare& comp;
+        bool operator()(const ForwardIt& a, const ForwardIt& b) const
+        {
+            return comp(a->first, b->first);
+        }
+    };
+    KeyLess less = { comp_ };
+    if(!std::is_sorted(order.begin(), order.end(), less)) {
+        std::stable_sort(order.begin(), order.end(), less);
+    }
+}
+
+/**
+* Links count nodes, given in key order, into a perfectly balanced
+* subtree under parent and returns its root, with its height in height.
+* Only pointers are rewritten, so this is O(n) and works equally for
+* freshly created nodes and for nodes taken out of an existing tree.
+* initBuiltNode() is called on every node once its subtrees are done.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::linkBalanced(NodeType* const* nodes, size_t count, NodeType* parent, int& height)
+{
+    if(count == 0) {
+        height = 0;
+        return NULL;
+    }
+
+    size_t mid = count / 2;
+    NodeType* node = nodes[mid];
+    int lh, rh;
+    node->setParent(parent);
+    node->setLeft(linkBalanced(nodes, mid, node, lh));
+    node->setRight(linkBalanced(nodes + mid + 1, count - mid - 1, node, rh));
+    node->setSize(static_cast<uint32_t>(count));
+    initBuiltNode(node, lh, rh);
+
+    height = 1 + std::max(lh, rh);
+    return node;
+}
+
+/**
+* Hook for derived trees to set up per-node data (e.g. AVL balance
+* factors) while linkBalanced() builds a tree. A plain BST has none.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::initBuiltNode(NodeType* /*node*/, int /*leftHeight*/, int /*rightHeight*/)
+{
+
+}
+
+/**
+* A remove method to remove a specific key from a Binary Search Tree.
+* Recall: The writeup specifies that if a node has 2 children you
+* should swap with the predecessor and then remove.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::remove(const Key& key)
+{
+    NodeType* node = internalFind(key);
+    if(node == NULL) return;
+
+
+    if(node->getLeft() != NULL && node->getRight() != NULL) {
+        NodeType* pred = predecessor(node);
+        nodeSwap(node, pred);
+    }
+
+
+    NodeType* child =
+        (node->getLeft() != NULL ? node->getLeft() : node->getRight());
+
+    if(child != NULL) {
+        child->setParent(node->getParent());
+    }
+
+    if(node->getParent() == NULL) {
+
+        root_ = child;
+    }
+    else if(node == node->getParent()->getLeft()) {
+        node->getParent()->setLeft(child);
+    }
+    else {
+        node->getParent()->setRight(child);
+    }
+
+    adjustSizes(node->getParent(), -1);
+    destroyNode(node);
+}
+
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+NodeType*
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::predecessor(NodeType* current)
+{
+    if(current == NULL) return NULL;
+
+
+    if(current->getLeft() != NULL) {
+        NodeType* temp = current->getLeft();
+        while(temp->getRight() != NULL) temp = temp->getRight();
+        return temp;
+    }
+
+
+    NodeType* parent = current->getParent();
+    while(parent != NULL && current == parent->getLeft()) {
+        current = parent;
+        parent = parent->getParent();
+    }
+    return parent;
+}
+
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+NodeType*
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::successor(NodeType* current)
+{
+    if(current == NULL) return NULL;
+
+    
+    if(current->getRight() != NULL) {
+        NodeType* temp = current->getRight();
+        while(temp->getLeft() != NULL) temp = temp->getLeft();
+        return temp;
+    }
+
+    
+    NodeType* parent = current->getParent();
+    while(parent != NULL && current == parent->getRight()) {
+        current = parent;
+        parent = parent->getParent();
+    }
+    return parent;
+}
+
+
+/**
+* Removes every node. Allocators that support bulk release get all
+* their pages back at once; the per-node walk is then only needed when
+* the nodes have non-trivial destructors to run. A pool shared with
+* other trees still holds their nodes, so then each node is freed on
+* its own.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::clear()
+{
+    clearNodes(std::integral_constant<bool, HasBulkRelease<NodeAlloc>::value>());
+    root_ = NULL;
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::clearNodes(std::false_type)
+{
+    clearHelper(root_);
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::clearNodes(std::true_type)
+{
+    if(!alloc_.soleOwner()) {
+        clearHelper(root_);
+        return;
+    }
+    if(!std::is_trivially_destructible<NodeType>::value) {
+        destroyHelper(root_);
+    }
+    alloc_.release();
+}
+
+/**
+* Frees every node of a subtree. A node with a left child is rotated
+* right first, flattening the subtree as it goes, so this needs no
+* stack however deep the tree is (a splay tree can be a path). Only the
+* child links are rewritten on the way.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::clearHelper(NodeType* node)
+{
+    while(node != NULL) {
+        NodeType* left = node->getLeft();
+        if(left != NULL) {
+            node->setLeft(left->getRight());
+            left->setRight(node);
+            node = left;
+        }
+        else {
+            NodeType* right = node->getRight();
+            destroyNode(node);
+            node = right;
+        }
+    }
+}
+
+/**
+* Runs the destructor of every node without returning its memory,
+* which is released afterwards in bulk.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::destroyHelper(NodeType* node)
+{
+    // Flattens the same way as clearHelper()
+    while(node != NULL) {
+        NodeType* left = node->getLeft();
+        if(left != NULL) {
+            node->setLeft(left->getRight());
+            left->setRight(node);
+            node = left;
+        }
+        else {
+            NodeType* right = node->getRight();
+            NodeAllocTraits::destroy(alloc_, node);
+            node = right;
+        }
+    }
+}
+
+/**
+* Allocates a node through the tree's allocator and constructs it with
+* the given parent, forwarding args to the item's constructor.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename... Args>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::createNode(NodeType* parent, Args&&... args)
+{
+    NodeType* node = NodeAllocTraits::allocate(alloc_, 1);
+    try {
+        NodeAllocTraits::construct(alloc_, node, parent, std::forward<Args>(args)...);
+    }
+    catch(...) {
+        NodeAllocTraits::deallocate(alloc_, node, 1);
+        throw;
+    }
+    return node;
+}
+
+/**
+* Destroys a node and gives its memory back to the allocator.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::destroyNode(NodeType* node)
+{
+    NodeAllocTraits::destroy(alloc_, node);
+    NodeAllocTraits::deallocate(alloc_, node, 1);
+}
+
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+NodeType*
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::getSmallestNode() const
+{
+    NodeType* curr = root_;
+    if(curr == NULL) return NULL;
+    while(curr->getLeft() != NULL) curr = curr->getLeft();
+    return curr;
+}
+
+/**
+* Returns the node with the largest key, or NULL for an empty tree
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+NodeType*
+BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::getLargestNode() const
+{
+    NodeType* curr = root_;
+    if(curr == NULL) return NULL;
+    while(curr->getRight() != NULL) curr = curr->getRight();
+    return curr;
+}
+
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::internalFind(const Key& key) const
+{
+    return findNode(key);
+}
+
+/**
+* Returns the node whose key is equivalent to k, or NULL. The descent
+* is the lower_bound one, so there is a single comparison per level
+* and one more at the end to rule out a greater key.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::findNode(const K& k) const
+{
+    NodeType* node = internalLowerBound(k);
+    if(node != NULL && !comp_(k, node->getKey())) return node;
+    return NULL;
+}
+
+
+/**
+* Starts loading node into the cache without waiting for it
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::prefetchNode(const NodeType* node)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(node);
+#else
+    (void)node;
+#endif
+}
+
+/**
+* Returns the node with the smallest key that is not less than k, or NULL
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::internalLowerBound(const K& k) const
+{
+    NodeType* curr = root_;
+    NodeType* best = NULL;
+    while(curr != NULL) {
+        if(comp_(curr->getKey(), k)) {
+            curr = curr->getRight();
+        }
+        else {
+            best = curr;
+            curr = curr->getLeft();
+        }
+    }
+    return best;
+}
+
+/**
+* Returns the node with the smallest key greater than k, or NULL
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename K>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::internalUpperBound(const K& k) const
+{
+    NodeType* curr = root_;
+    NodeType* best = NULL;
+    while(curr != NULL) {
+        if(comp_(k, curr->getKey())) {
+            best = curr;
+            curr = curr->getLeft();
+        }
+        else {
+            curr = curr->getRight();
+        }
+    }
+    return best;
+}
+
 template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+int height(Node<Key,Value>* node)
+{
+    if(node == NULL) return 0;
+    int lh = height<Key,Value>(node->getLeft());
+    int rh = height<Key,Value>(node->getRight());
+    return 1 + std::max(lh, rh);
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+bool BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::isBalanced() const
+{
+    return verify().balanced;
+}
+
+/**
+* Checks every invariant of the tree (including the stored subtree
+* sizes) in a single O(n) in-order pass,
+* using an explicit stack so that even a degenerate tree cannot overflow
+* the call stack. Stops at the first violation; an imbalance alone
+* only clears balanced and does not stop the walk.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+TreeReport BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::verify() const
+{
+    struct Frame
+    {
+        NodeType* node;
+        int leftHeight;
+        size_t leftCount;
+        int stage;  // 0: not visited, 1: left subtree done, 2: right subtree done
+    };
+
+    TreeReport report;
+    if(root_ == NULL) return report;
+    if(root_->getParent() != NULL) {
+        report.valid = false;
+        report.error = "root has a non-null parent";
+        return report;
+    }
+
+    std::vector<Frame> stack;
+    Frame first = { root_, 0, 0, 0 };
+    stack.push_back(first);
+    NodeType* prev = NULL;  // in-order predecessor of the current node
+    int childHeight = 0;           // height of the subtree finished last
+    size_t childCount = 0;         // and its number of nodes
+
+    while(!stack.empty()) {
+        NodeType* node = stack.back().node;
+        NodeType* left = node->getLeft();
+        NodeType* right = node->getRight();
+
+        if(stack.back().stage == 0) {
+            ++report.nodeCount;
+            const char* linkError = NULL;
+            if(left != NULL && left == right) {
+                linkError = "node has the same left and right child";
+            }
+            else if((left != NULL && left->getParent() != node) ||
+                    (right != NULL && right->getParent() != node)) {
+                linkError = "child's parent pointer does not point back to its parent";
+            }
+            if(linkError != NULL) {
+                report.valid = false;
+                report.error = linkError;
+                return report;
+            }
+
+            stack.back().stage = 1;
+            if(left != NULL) {
+                Frame f = { left, 0, 0, 0 };
+                stack.push_back(f);
+                continue;
+            }
+            childHeight = 0;
+            childCount = 0;
+        }
+
+        if(stack.back().stage == 1) {
+            stack.back().leftHeight = childHeight;
+            stack.back().leftCount = childCount;
+            if(prev != NULL && !comp_(prev->getKey(), node->getKey())) {
+                report.valid = false;
+                report.error = "keys are not in strictly increasing order";
+                return report;
+            }
+            prev = node;
+
+            stack.back().stage = 2;
+            if(right != NULL) {
+                Frame f = { right, 0, 0, 0 };
+                stack.push_back(f);
+                continue;
+            }
+            childHeight = 0;
+            childCount = 0;
+        }
+
+        int lh = stack.back().leftHeight;
+        int rh = childHeight;
+        if(std::abs(lh - rh) > 1) {
+            report.balanced = false;
+        }
+        childCount += stack.back().leftCount + 1;
+        const char* nodeError = NULL;
+        if(node->getSize() != childCount) {
+            nodeError = "stored subtree size does not match its node count";
+        }
+        else {
+            nodeError = verifyNode(node, lh, rh);
+        }
+        if(nodeError != NULL) {
+            report.valid = false;
+            report.error = nodeError;
+            return report;
+        }
+
+        childHeight = 1 + std::max(lh, rh);
+        stack.pop_back();
+    }
+
+    report.height = childHeight;
+    return report;
+}
+
+/**
+* Hook for derived trees to check the data they store per node, given
+* the true heights of the node's subtrees. Returns a description of the
+* problem, or NULL if the node is fine. A plain BST has nothing extra.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+const char* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::verifyNode(
+    NodeType* /*node*/, int /*leftHeight*/, int /*rightHeight*/) const
+{
+    return NULL;
+}
+
+/**
+ * nodeSwap provided to you.
+ */
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::nodeSwap( NodeType* n1, NodeType* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
     }
-    Node<Key, Value>* n1p = n1->getParent();
-    Node<Key, Value>* n1r = n1->getRight();
-    Node<Key, Value>* n1lt = n1->getLeft();
+    NodeType* n1p = n1->getParent();
+    NodeType* n1r = n1->getRight();
+    NodeType* n1lt = n1->getLeft();
     bool n1isLeft = false;
     if(n1p != NULL && (n1 == n1p->getLeft())) n1isLeft = true;
-    Node<Key, Value>* n2p = n2->getParent();
-    Node<Key, Value>* n2r = n2->getRight();
-    Node<Key, Value>* n2lt = n2->getLeft();
+    NodeType* n2p = n2->getParent();
+    NodeType* n2r = n2->getRight();
+    NodeType* n2lt = n2->getLeft();
     bool n2isLeft = false;
     if(n2p != NULL && (n2 == n2p->getLeft())) n2isLeft = true;
 
 
-    Node<Key, Value>* temp;
+    NodeType* temp;
     temp = n1->getParent();
     n1->setParent(n2->getParent());
     n2->setParent(temp);
@@ -706,6 +2174,11 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
         this->root_ = n1;
     }
 
+    // Subtree sizes belong to the positions, which the nodes just traded
+    uint32_t tempSize = n1->getSize();
+    n1->setSize(n2->getSize());
+    n2->setSize(tempSize);
+
 }
 
 /**
@@ -0,0 +1,145 @@
+#ifndef BSTIO_H
+#define BSTIO_H
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include "bst.h"
+#include "treeio.h"
+
+/**
+* Binary snapshots of a BinarySearchTree, save() and load(). They are
+* kept out of bst.h along with the codecs and stream buffers they use;
+* include this header to call them.
+*/
+
+/**
+* Writes a binary snapshot of the tree to out (see SnapshotHeader): a
+* header, then every item in key order, streamed straight from an
+* in-order walk. Throws std::runtime_error if the stream fails.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename Codec>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::save(std::ostream& out, const Codec& codec) const
+{
+    SnapshotHeader header;
+    std::memcpy(header.magic, "BSTS", sizeof(header.magic));
+    header.version = SnapshotHeader::Version;
+    header.byteOrder = SnapshotHeader::ByteOrderMark;
+    header.codecTag = Codec::Tag;
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    header.count = size();
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for(NodeType* curr = getSmallestNode(); curr != NULL && out; curr = successor(curr)) {
+        codec.write(out, curr->getKey());
+        codec.write(out, curr->getValue());
+    }
+    if(!out) throw std::runtime_error("save: writing the snapshot failed");
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename Codec>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::save(int fd, const Codec& codec) const
+{
+    FdStreamBuf buffer(fd);
+    std::ostream out(&buffer);
+    save(out, codec);
+    if(buffer.pubsync() != 0) throw std::runtime_error("save: writing the snapshot failed");
+}
+
+/**
+* Replaces the contents of the tree with a snapshot written by save().
+* The items arrive in key order, so the tree is linked perfectly
+* balanced as they are read, in O(n) and without any rebalancing.
+* Throws std::runtime_error for a snapshot of another format, codec or
+* type, one that is cut short or whose keys are out of order; the tree
+* is then left empty.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename Codec>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::load(std::istream& in, const Codec& codec)
+{
+    // As in assign(), the old nodes go first
+    clear();
+
+    SnapshotHeader header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if(!in || std::memcmp(header.magic, "BSTS", sizeof(header.magic)) != 0) {
+        throw std::runtime_error("load: not a tree snapshot");
+    }
+    if(header.version != SnapshotHeader::Version || header.byteOrder != SnapshotHeader::ByteOrderMark) {
+        throw std::runtime_error("load: unsupported snapshot version or byte order");
+    }
+    if(header.codecTag != Codec::Tag || header.keySize != sizeof(Key) || header.valueSize != sizeof(Value)) {
+        throw std::runtime_error("load: snapshot was written for another codec or key/value type");
+    }
+    if(header.count > UINT32_MAX) {
+        throw std::runtime_error("load: snapshot holds more items than a tree can");
+    }
+
+    NodeType* last = NULL;
+    int height;
+    root_ = loadBalanced(in, codec, header.count, NULL, last, height);
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename Codec>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::load(int fd, const Codec& codec)
+{
+    FdStreamBuf buffer(fd);
+    std::istream in(&buffer);
+    load(in, codec);
+}
+
+/**
+* Reads count items and links them into a perfectly balanced subtree
+* under parent, like linkBalanced(), but building each node as it is
+* read: the left subtree first, then the node, then the right subtree.
+* last is the node read before, whose key must be smaller. If anything
+* fails, the nodes of this subtree are freed before rethrowing.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename Codec>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::loadBalanced(std::istream& in, const Codec& codec, uint64_t count,
+                                                                               NodeType* parent, NodeType*& last, int& height)
+{
+    if(count == 0) {
+        height = 0;
+        return NULL;
+    }
+
+    uint64_t mid = count / 2;
+    int lh, rh;
+    NodeType* left = loadBalanced(in, codec, mid, NULL, last, lh);
+    NodeType* node = NULL;
+    try {
+        Key key = codec.template read<Key>(in);
+        Value value = codec.template read<Value>(in);
+        if(!in) throw std::runtime_error("load: snapshot is cut short");
+        node = createNode(parent, std::move(key), std::move(value));
+        if(last != NULL && !comp_(last->getKey(), node->getKey())) {
+            throw std::runtime_error("load: snapshot keys are out of order");
+        }
+        last = node;
+        node->setRight(loadBalanced(in, codec, count - mid - 1, node, last, rh));
+    }
+    catch(...) {
+        clearHelper(left);
+        if(node != NULL) destroyNode(node);
+        throw;
+    }
+
+    node->setLeft(left);
+    if(left != NULL) left->setParent(node);
+    node->setSize(static_cast<uint32_t>(count));
+    initBuiltNode(node, lh, rh);
+
+    height = 1 + std::max(lh, rh);
+    return node;
+}
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef BSTPARALLEL_H
+#define BSTPARALLEL_H
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+#include "bst.h"
+#include "threadpool.h"
+
+/**
+* The parallel traversals of BinarySearchTree, parallel_for_each and
+* parallel_reduce. They are kept out of bst.h so that code which only
+* needs a search tree does not pull in the thread pool, or have to link
+* with -pthread. Include this header to call them.
+*/
+
+/**
+* Calls f(item) on every item, from the calling thread and the pool's
+* workers at once, so f must be safe to call concurrently. The calls
+* come in no particular order. f may change the values but not the
+* tree. Without a pool, WorkStealingPool::shared() does the work.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename Function>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::parallel_for_each(Function f)
+{
+    parallel_for_each(f, WorkStealingPool::shared());
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename Function>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::parallel_for_each(Function f, WorkStealingPool& pool)
+{
+    forEachRun([&f](NodeType* node) { f(node->getItem()); }, pool);
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename Function>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::parallel_for_each(Function f) const
+{
+    parallel_for_each(f, WorkStealingPool::shared());
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename Function>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::parallel_for_each(Function f, WorkStealingPool& pool) const
+{
+    forEachRun([&f](const NodeType* node) { f(node->getItem()); }, pool);
+}
+
+/**
+* Folds map(item) over every item with combine, which must be
+* associative and have identity as its neutral element; the stretches
+* are folded in parallel. If ordered, the partial results are combined
+* in key order, so combine need not be commutative. Otherwise each
+* thread folds everything it visits into one result of its own, which
+* saves a partial result per stretch, and combine must be commutative.
+* Without a pool, WorkStealingPool::shared() does the work.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename T, typename Map, typename Combine>
+T BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::parallel_reduce(T identity, Map map, Combine combine, bool ordered) const
+{
+    return parallel_reduce(identity, map, combine, ordered, WorkStealingPool::shared());
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename T, typename Map, typename Combine>
+T BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::parallel_reduce(T identity, Map map, Combine combine, bool ordered,
+                                                                          WorkStealingPool& pool) const
+{
+    // Padded so that threads writing neighbouring results do not share
+    // a cache line
+    struct Partial
+    {
+        explicit Partial(const T& v) : value(v) { }
+        T value;
+        char pad[64];
+    };
+
+    std::vector<Run> runs;
+    partitionRuns(runs);
+    if(runs.size() <= 1 || pool.size() == 0) {
+        T result = identity;
+        for(size_t i = 0; i < runs.size(); ++i) {
+            NodeType* curr = runs[i].first;
+            for(size_t j = 0; j < runs[i].count; ++j, curr = successor(curr)) {
+                result = combine(result, map(static_cast<const NodeType*>(curr)->getItem()));
+            }
+        }
+        return result;
+    }
+
+    std::vector<Partial> partials(ordered ? runs.size() : pool.size() + 1, Partial(identity));
+    std::mutex outsideLock;  // guards the slot shared by threads outside the pool
+    WorkStealingPool::TaskGroup group(pool);
+    for(size_t i = 0; i < runs.size(); ++i) {
+        group.run([&, i]() {
+            T acc = identity;
+            NodeType* curr = runs[i].first;
+            for(size_t j = 0; j < runs[i].count; ++j, curr = successor(curr)) {
+                acc = combine(acc, map(static_cast<const NodeType*>(curr)->getItem()));
+            }
+            if(ordered) {
+                partials[i].value = acc;
+                return;
+            }
+            unsigned slot = pool.currentSlot();
+            if(slot == pool.size()) {
+                std::lock_guard<std::mutex> lock(outsideLock);
+                partials[slot].value = combine(partials[slot].value, acc);
+            }
+            else {
+                partials[slot].value = combine(partials[slot].value, acc);
+            }
+        });
+    }
+    group.wait();
+
+    T result = identity;
+    for(size_t i = 0; i < partials.size(); ++i) result = combine(result, partials[i].value);
+    return result;
+}
+
+/**
+* Splits the items into runs of consecutive items, in key order: whole
+* subtrees of at most ParallelChunk items, and the nodes above them,
+* merged with their neighbours while a run stays within ParallelChunk.
+* Only the nodes above those subtrees are visited, so this costs
+* O(n / ParallelChunk) steps on a balanced tree.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::partitionRuns(std::vector<Run>& runs) const
+{
+    Run open = { NULL, 0 };
+    std::vector<NodeType*> stack;
+    NodeType* node = root_;
+    while(node != NULL || !stack.empty()) {
+        Run next;
+        if(node != NULL && subtreeSize(node) > ParallelChunk) {
+            stack.push_back(node);
+            node = node->getLeft();
+            continue;
+        }
+        if(node != NULL) {
+            next.count = subtreeSize(node);
+            while(node->getLeft() != NULL) node = node->getLeft();
+            next.first = node;
+            node = NULL;
+        }
+        else {
+            node = stack.back();
+            stack.pop_back();
+            next.first = node;
+            next.count = 1;
+            node = node->getRight();
+        }
+
+        if(open.count > 0 && open.count + next.count <= ParallelChunk) {
+            open.count += next.count;
+        }
+        else {
+            if(open.count > 0) runs.push_back(open);
+            open = next;
+        }
+    }
+    if(open.count > 0) runs.push_back(open);
+}
+
+/**
+* Calls visit(node) on every node, one task per run
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+template<typename Visit>
+void BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::forEachRun(Visit visit, WorkStealingPool& pool) const
+{
+    std::vector<Run> runs;
+    partitionRuns(runs);
+    if(runs.size() <= 1 || pool.size() == 0) {
+        for(size_t i = 0; i < runs.size(); ++i) {
+            NodeType* curr = runs[i].first;
+            for(size_t j = 0; j < runs[i].count; ++j, curr = successor(curr)) visit(curr);
+        }
+        return;
+    }
+
+    WorkStealingPool::TaskGroup group(pool);
+    for(size_t i = 0; i < runs.size(); ++i) {
+        group.run([&, i]() {
+            NodeType* curr = runs[i].first;
+            for(size_t j = 0; j < runs[i].count; ++j, curr = successor(curr)) visit(curr);
+        });
+    }
+    group.wait();
+}
+
+#endif
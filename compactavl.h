@@ -0,0 +1,760 @@
+#ifndef COMPACTAVL_H
+#define COMPACTAVL_H
+
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include "bst.h"
+#include "indexavl.h"
+
+/**
+* An AVL tree meant for small keys and values. Its nodes live in one
+* contiguous pool and refer to each other by 32-bit slot indices
+* instead of pointers. The balance factor is packed into the two low
+* bits of the parent link. A node is thus the item plus 12 bytes: 20
+* bytes for <uint32_t, uint32_t>, against 40 for an AVLNode. Removed
+* slots go on a free list and are reused by later inserts. The tree
+* algorithms are IndexAVLCore's; this class owns the pool.
+*
+* It supports only part of AVLTree's API:
+* - insert of a pair (copied or moved) and of a range, remove, clear,
+*   empty, size, isBalanced and verify;
+* - find, contains, lookup, lower_bound, upper_bound and key_comp, for
+*   Key only (no transparent lookups);
+* - iterators, const and reverse ones included.
+* There is no allocator parameter, range constructor, copy, assign,
+* operator[], emplace, try_emplace, insert_or_assign, equal_range,
+* scan, findBatch, order statistics (which would need a subtree size
+* in every node), split/join or set operations, parallel traversal,
+* freeze, or save/load. insert(first, last) inserts one pair at a time
+* in O(m log n), without AVLTree's merge path. Code that uses any of
+* the missing members will not compile if AVLTree is swapped out for
+* this class with a typedef. reserve, capacity and nodeBytes are its
+* own additions.
+*
+* Iterators hold a slot index, so they stay valid until their own item
+* is removed. Growing the pool moves the items, though, so plain pointers
+* and references into the tree are only stable after reserve().
+* The pool holds at most 2^30 - 2 nodes.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class CompactAVLTree : public IndexAVLCore<CompactAVLTree<Key, Value, Compare>, Key, Value, Compare>
+{
+    typedef IndexAVLCore<CompactAVLTree<Key, Value, Compare>, Key, Value, Compare> Core;
+    friend class IndexAVLCore<CompactAVLTree<Key, Value, Compare>, Key, Value, Compare>;
+    typedef typename Core::Item Item;
+    typedef typename Core::Slot Slot;
+    using Core::Nil;
+    using Core::FreeMark;
+
+public:
+    CompactAVLTree();
+    explicit CompactAVLTree(const Compare& comp);
+    CompactAVLTree(const CompactAVLTree&) = delete;
+    CompactAVLTree& operator=(const CompactAVLTree&) = delete;
+    ~CompactAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void insert(std::pair<const Key, Value>&& keyValuePair);
+    template<typename ForwardIt>
+    void insert(ForwardIt first, ForwardIt last);
+    void remove(const Key& key);
+    void clear();
+    void reserve(size_t n);
+    size_t capacity() const;
+    bool empty() const;
+    size_t size() const;
+    bool isBalanced() const;
+    TreeReport verify() const;
+    static size_t nodeBytes();
+
+    class const_iterator;
+
+    /**
+    * A bidirectional iterator over the items in key order. --end()
+    * reaches the largest item.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key,Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
+        iterator();
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class CompactAVLTree<Key, Value, Compare>;
+        friend class const_iterator;
+        iterator(uint32_t index, const CompactAVLTree* tree);
+        uint32_t index_;
+        const CompactAVLTree* tree_;
+    };
+
+    /**
+    * The read-only counterpart of iterator.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key,Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        friend bool operator==(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs.index_ == rhs.index_;
+        }
+        friend bool operator!=(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs.index_ != rhs.index_;
+        }
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class CompactAVLTree<Key, Value, Compare>;
+        const_iterator(uint32_t index, const CompactAVLTree* tree);
+        uint32_t index_;
+        const CompactAVLTree* tree_;
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    iterator begin();
+    iterator end();
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin();
+    reverse_iterator rend();
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+
+    iterator find(const Key& key) const;
+    bool contains(const Key& key) const;
+    Value* lookup(const Key& key);
+    const Value* lookup(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    Compare key_comp() const;
+
+private:
+    using Core::item;
+    using Core::key;
+    using Core::left;
+    using Core::isFree;
+    using Core::findInsertPos;
+    using Core::linkSlot;
+    using Core::unlinkSlot;
+    using Core::findIndex;
+    using Core::lowerBoundIndex;
+    using Core::upperBoundIndex;
+    using Core::smallestIndex;
+    using Core::largestIndex;
+    using Core::successor;
+    using Core::predecessor;
+    using Core::slots_;
+    using Core::comp_;
+
+    uint32_t& rootLink();
+    uint32_t rootLink() const;
+
+    // Pool management
+    uint32_t allocateSlot();
+    void freeSlot(uint32_t i);
+    void grow(size_t newCapacity);
+
+    template<typename P>
+    void insertPair(P&& keyValuePair);
+
+    uint32_t capacity_;
+    uint32_t used_;      // slots ever handed out; later ones are untouched
+    uint32_t freeList_;
+    uint32_t root_;
+    size_t size_;
+};
+
+/*
+------------------------------------------------------------
+Begin implementations for the CompactAVLTree::iterator class.
+------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+CompactAVLTree<Key, Value, Compare>::iterator::iterator(uint32_t index, const CompactAVLTree* tree)
+{
+    index_ = index;
+    tree_ = tree;
+}
+
+template<typename Key, typename Value, typename Compare>
+CompactAVLTree<Key, Value, Compare>::iterator::iterator()
+{
+    index_ = Nil;
+    tree_ = NULL;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::pair<const Key,Value> &
+CompactAVLTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return tree_->item(index_);
+}
+
+template<typename Key, typename Value, typename Compare>
+std::pair<const Key,Value> *
+CompactAVLTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return &(tree_->item(index_));
+}
+
+template<typename Key, typename Value, typename Compare>
+bool CompactAVLTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return index_ == rhs.index_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool CompactAVLTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return index_ != rhs.index_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator&
+CompactAVLTree<Key, Value, Compare>::iterator::operator++()
+{
+    index_ = tree_->successor(index_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Moves back one item; decrementing the end iterator moves it to the
+* largest item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator&
+CompactAVLTree<Key, Value, Compare>::iterator::operator--()
+{
+    index_ = (index_ == Nil) ? tree_->largestIndex() : tree_->predecessor(index_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+------------------------------------------------------------
+End implementations for the CompactAVLTree::iterator class.
+------------------------------------------------------------
+*/
+
+/*
+------------------------------------------------------------------
+Begin implementations for the CompactAVLTree::const_iterator class.
+------------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+CompactAVLTree<Key, Value, Compare>::const_iterator::const_iterator(uint32_t index, const CompactAVLTree* tree)
+{
+    index_ = index;
+    tree_ = tree;
+}
+
+template<typename Key, typename Value, typename Compare>
+CompactAVLTree<Key, Value, Compare>::const_iterator::const_iterator()
+{
+    index_ = Nil;
+    tree_ = NULL;
+}
+
+template<typename Key, typename Value, typename Compare>
+CompactAVLTree<Key, Value, Compare>::const_iterator::const_iterator(const iterator& it)
+{
+    index_ = it.index_;
+    tree_ = it.tree_;
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<const Key,Value> &
+CompactAVLTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return tree_->item(index_);
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<const Key,Value> *
+CompactAVLTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return &(tree_->item(index_));
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator&
+CompactAVLTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    index_ = tree_->successor(index_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator&
+CompactAVLTree<Key, Value, Compare>::const_iterator::operator--()
+{
+    index_ = (index_ == Nil) ? tree_->largestIndex() : tree_->predecessor(index_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+----------------------------------------------------------------
+End implementations for the CompactAVLTree::const_iterator class.
+----------------------------------------------------------------
+*/
+
+/*
+-----------------------------------------------------
+Begin implementations for the CompactAVLTree class.
+-----------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+CompactAVLTree<Key, Value, Compare>::CompactAVLTree() :
+    Core(Compare()),
+    capacity_(0),
+    used_(0),
+    freeList_(Nil),
+    root_(Nil),
+    size_(0)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+CompactAVLTree<Key, Value, Compare>::CompactAVLTree(const Compare& comp) :
+    Core(comp),
+    capacity_(0),
+    used_(0),
+    freeList_(Nil),
+    root_(Nil),
+    size_(0)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+CompactAVLTree<Key, Value, Compare>::~CompactAVLTree()
+{
+    clear();
+    ::operator delete(slots_);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool CompactAVLTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+size_t CompactAVLTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+/**
+* The number of nodes the pool can hold before it has to grow
+*/
+template<typename Key, typename Value, typename Compare>
+size_t CompactAVLTree<Key, Value, Compare>::capacity() const
+{
+    return capacity_;
+}
+
+/**
+* The bytes taken by one node in the pool, item included
+*/
+template<typename Key, typename Value, typename Compare>
+size_t CompactAVLTree<Key, Value, Compare>::nodeBytes()
+{
+    return sizeof(Slot);
+}
+
+template<typename Key, typename Value, typename Compare>
+Compare CompactAVLTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Grows the pool to hold at least n nodes. Afterwards inserts do not
+* move items until the tree holds more than n.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::reserve(size_t n)
+{
+    if(n > capacity_) grow(n);
+}
+
+/**
+* Destroys every item. The pool keeps its memory for reuse, like
+* std::vector::clear; the destructor frees it.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::clear()
+{
+    for(uint32_t i = 0; i < used_; ++i) {
+        if(!isFree(i)) item(i).~Item();
+    }
+    used_ = 0;
+    freeList_ = Nil;
+    root_ = Nil;
+    size_ = 0;
+}
+
+/**
+* The root link, for IndexAVLCore
+*/
+template<typename Key, typename Value, typename Compare>
+uint32_t& CompactAVLTree<Key, Value, Compare>::rootLink()
+{
+    return root_;
+}
+
+template<typename Key, typename Value, typename Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::rootLink() const
+{
+    return root_;
+}
+
+/**
+* Hands out a slot from the free list, or else the next untouched
+* slot, doubling the pool when it is full.
+*/
+template<typename Key, typename Value, typename Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::allocateSlot()
+{
+    if(freeList_ != Nil) {
+        uint32_t i = freeList_;
+        freeList_ = left(i);
+        return i;
+    }
+    if(used_ == capacity_) {
+        if(capacity_ >= Nil - 1) {
+            throw std::length_error("CompactAVLTree: too many nodes for 30-bit links");
+        }
+        grow(capacity_ == 0 ? 16 : static_cast<size_t>(capacity_) * 2);
+    }
+    return used_++;
+}
+
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::freeSlot(uint32_t i)
+{
+    item(i).~Item();
+    slots_[i].left = freeList_;
+    slots_[i].parentBalance = FreeMark;
+    freeList_ = i;
+}
+
+/**
+* Moves the pool into a bigger buffer. Items are moved only if that
+* cannot throw, and copied otherwise, so a failure leaves the tree as
+* it was.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::grow(size_t newCapacity)
+{
+    if(newCapacity > Nil - 1) newCapacity = Nil - 1;
+    Slot* fresh = static_cast<Slot*>(::operator new(newCapacity * sizeof(Slot)));
+    uint32_t i = 0;
+    try {
+        for(; i < used_; ++i) {
+            fresh[i].left = slots_[i].left;
+            fresh[i].right = slots_[i].right;
+            fresh[i].parentBalance = slots_[i].parentBalance;
+            if(!isFree(i)) {
+                ::new(static_cast<void*>(&fresh[i].item)) Item(std::move_if_noexcept(item(i)));
+            }
+        }
+    }
+    catch(...) {
+        while(i-- > 0) {
+            if(!isFree(i)) reinterpret_cast<Item*>(&fresh[i].item)->~Item();
+        }
+        ::operator delete(fresh);
+        throw;
+    }
+
+    for(i = 0; i < used_; ++i) {
+        if(!isFree(i)) item(i).~Item();
+    }
+    ::operator delete(slots_);
+    slots_ = fresh;
+    capacity_ = static_cast<uint32_t>(newCapacity);
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    insertPair(keyValuePair);
+}
+
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    insertPair(std::move(keyValuePair));
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename ForwardIt>
+void CompactAVLTree<Key, Value, Compare>::insert(ForwardIt first, ForwardIt last)
+{
+    for(; first != last; ++first) insertPair(*first);
+}
+
+/**
+* One descent, then the new slot is linked in and retraced
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename P>
+void CompactAVLTree<Key, Value, Compare>::insertPair(P&& keyValuePair)
+{
+    uint32_t p;
+    bool goLeft;
+    uint32_t existing = findInsertPos(keyValuePair.first, p, goLeft);
+    if(existing != Nil) {
+        item(existing).second = std::forward<P>(keyValuePair).second; // overwrite value
+        return;
+    }
+
+    uint32_t n = allocateSlot();
+    try {
+        ::new(static_cast<void*>(&slots_[n].item)) Item(std::forward<P>(keyValuePair));
+    }
+    catch(...) {
+        slots_[n].left = freeList_;
+        slots_[n].parentBalance = FreeMark;
+        freeList_ = n;
+        throw;
+    }
+    ++size_;
+    linkSlot(n, p, goLeft);
+}
+
+/**
+* Removes the key if present
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::remove(const Key& k)
+{
+    uint32_t n = findIndex(k);
+    if(n == Nil) return;
+    unlinkSlot(n);
+    freeSlot(n);
+    --size_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::find(const Key& k) const
+{
+    return iterator(findIndex(k), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool CompactAVLTree<Key, Value, Compare>::contains(const Key& k) const
+{
+    return findIndex(k) != Nil;
+}
+
+/**
+* Returns a pointer to the value stored under k, or NULL if k is not in
+* the tree
+*/
+template<typename Key, typename Value, typename Compare>
+Value* CompactAVLTree<Key, Value, Compare>::lookup(const Key& k)
+{
+    uint32_t i = findIndex(k);
+    return i == Nil ? NULL : &item(i).second;
+}
+
+template<typename Key, typename Value, typename Compare>
+const Value* CompactAVLTree<Key, Value, Compare>::lookup(const Key& k) const
+{
+    uint32_t i = findIndex(k);
+    return i == Nil ? NULL : &item(i).second;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::lower_bound(const Key& k) const
+{
+    return iterator(lowerBoundIndex(k), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::upper_bound(const Key& k) const
+{
+    return iterator(upperBoundIndex(k), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::begin()
+{
+    return iterator(smallestIndex(), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::end()
+{
+    return iterator(Nil, this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::begin() const
+{
+    return const_iterator(smallestIndex(), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(Nil, this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::cbegin() const
+{
+    return begin();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::cend() const
+{
+    return end();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::reverse_iterator
+CompactAVLTree<Key, Value, Compare>::rbegin()
+{
+    return reverse_iterator(end());
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::reverse_iterator
+CompactAVLTree<Key, Value, Compare>::rend()
+{
+    return reverse_iterator(begin());
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_reverse_iterator
+CompactAVLTree<Key, Value, Compare>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_reverse_iterator
+CompactAVLTree<Key, Value, Compare>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+template<typename Key, typename Value, typename Compare>
+bool CompactAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return verify().balanced;
+}
+
+/**
+* Checks links, key order, node count and stored balance factors, as
+* IndexAVLCore::verifySlots does
+*/
+template<typename Key, typename Value, typename Compare>
+TreeReport CompactAVLTree<Key, Value, Compare>::verify() const
+{
+    return this->verifySlots(used_, size_);
+}
+
+/*
+---------------------------------------------------
+End implementations for the CompactAVLTree class.
+---------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,404 @@
+#ifndef CONCURRENTAVL_H
+#define CONCURRENTAVL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "avlbst.h"
+#include "nodereclaimer.h"
+
+#if !defined(__GNUC__)
+#error "ConcurrentAVLTree needs the __atomic builtins (GCC or Clang) for its nodes' child links"
+#endif
+
+/**
+* The node of a ConcurrentAVLTree. It stores its child links atomically,
+* with release order, so that lock-free readers may follow them through
+* loadLeft()/loadRight() while a writer relinks the tree. Only this tree
+* pays for that: the other trees' nodes use plain stores, which the
+* compiler is free to reorder. As in AVLNode, the getters and setters
+* hide rather than override the base versions, and AVLTree calls them
+* on its NodeType, so every link a writer stores goes through here.
+*/
+template <typename Key, typename Value>
+class ConcurrentAVLNode : public AVLNode<Key, Value>
+{
+public:
+    template<typename... Args>
+    ConcurrentAVLNode(ConcurrentAVLNode<Key, Value>* parent, Args&&... args);
+
+    ConcurrentAVLNode<Key, Value>* getParent() const;
+    ConcurrentAVLNode<Key, Value>* getLeft() const;
+    ConcurrentAVLNode<Key, Value>* getRight() const;
+
+    void setLeft(Node<Key, Value>* left);
+    void setRight(Node<Key, Value>* right);
+
+    // Child links read by a thread that does not hold the writer's lock
+    ConcurrentAVLNode<Key, Value>* loadLeft() const;
+    ConcurrentAVLNode<Key, Value>* loadRight() const;
+};
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the ConcurrentAVLNode class.
+  ------------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+template<typename... Args>
+ConcurrentAVLNode<Key, Value>::ConcurrentAVLNode(ConcurrentAVLNode<Key, Value>* parent, Args&&... args) :
+    AVLNode<Key, Value>(parent, std::forward<Args>(args)...)
+{
+
+}
+
+template<typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLNode<Key, Value>::getParent() const
+{
+    return static_cast<ConcurrentAVLNode<Key, Value>*>(this->parent_);
+}
+
+template<typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLNode<Key, Value>::getLeft() const
+{
+    return static_cast<ConcurrentAVLNode<Key, Value>*>(this->left_);
+}
+
+template<typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLNode<Key, Value>::getRight() const
+{
+    return static_cast<ConcurrentAVLNode<Key, Value>*>(this->right_);
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLNode<Key, Value>::setLeft(Node<Key, Value>* left)
+{
+    __atomic_store_n(&this->left_, left, __ATOMIC_RELEASE);
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLNode<Key, Value>::setRight(Node<Key, Value>* right)
+{
+    __atomic_store_n(&this->right_, right, __ATOMIC_RELEASE);
+}
+
+/**
+* Acquire load of the left child, pairing with setLeft(): whatever was
+* written to the child before it was linked, its key included, is
+* visible to the caller.
+*/
+template<typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLNode<Key, Value>::loadLeft() const
+{
+    return static_cast<ConcurrentAVLNode<Key, Value>*>(__atomic_load_n(&this->left_, __ATOMIC_ACQUIRE));
+}
+
+template<typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLNode<Key, Value>::loadRight() const
+{
+    return static_cast<ConcurrentAVLNode<Key, Value>*>(__atomic_load_n(&this->right_, __ATOMIC_ACQUIRE));
+}
+
+/*
+  ----------------------------------------------------
+  End implementations for the ConcurrentAVLNode class.
+  ----------------------------------------------------
+*/
+
+/**
+* An AVLTree that many threads can read while one thread at a time
+* writes. Writers serialize on a mutex. Readers take no lock: they walk
+* the tree optimistically under a sequence lock, a version number that
+* is odd while a write is in progress, and retry when a write (and so
+* possibly a rotation) overlapped their walk. After MaxOptimisticReads
+* failed tries a reader takes the writers' mutex, so a write-heavy load
+* cannot starve it. Readers touch no shared cache line except the
+* version, which stays read-only between writes, so they scale with the
+* number of cores.
+*
+* Removed nodes are retired through NodeReclaimer rather than freed, so
+* a reader that raced with a remove never follows a dangling pointer.
+* Published nodes are never changed in place either: overwriting a key
+* replaces its node. A reader that validates its walk can therefore
+* copy the value out afterwards, and values of any type are safe.
+*
+* The optimistic walk follows child links that a writer may be changing
+* at the same moment, so every link it reads is an atomic one: the
+* tree's ConcurrentAVLNodes store child links with release order and the walk reads them with
+* acquire loads (loadLeft/loadRight), and the root is published in an
+* atomic of its own when each write ends. A walk that overlapped a
+* write may still take a wrong turn, or run in circles through a
+* half-done rotation; its result is thrown away, and it is cut off
+* after MaxDescent steps.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class ConcurrentAVLTree
+{
+public:
+    ConcurrentAVLTree();
+    explicit ConcurrentAVLTree(const Compare& comp);
+    ConcurrentAVLTree(const ConcurrentAVLTree&) = delete;
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&) = delete;
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    size_t size() const;
+    bool empty() const;
+    TreeReport verify() const;
+
+    static const int MaxOptimisticReads = 8;
+    static const int MaxDescent = 128;
+    // Removed nodes are reclaimed in batches of this many
+    static const size_t RetireBatch = 64;
+
+private:
+    typedef ConcurrentAVLNode<Key, Value> NodeType;
+    typedef RetiringAllocator<std::pair<const Key, Value> > Alloc;
+
+    // Opens up the root for the optimistic walk
+    class Tree : public AVLTree<Key, Value, Compare, Alloc, NodeType>
+    {
+    public:
+        Tree(const Compare& comp, const Alloc& alloc) : AVLTree<Key, Value, Compare, Alloc, NodeType>(comp, alloc) { }
+        NodeType* root() const { return this->root_; }
+    };
+
+    // Bumps the version to odd for the duration of a write, and back
+    // to even (one higher) when it ends, even if the write throws. The
+    // root is published just before that.
+    class WriteSection
+    {
+    public:
+        explicit WriteSection(ConcurrentAVLTree& owner);
+        ~WriteSection();
+    private:
+        ConcurrentAVLTree& owner_;
+        uint64_t start_;
+    };
+
+    bool optimisticFind(const Key& key, const NodeType*& node) const;
+    bool optimisticRead(const Key& key, const NodeType*& node) const;
+    void reclaimIfDue();
+
+    // Declared first so that it outlives the tree, whose destructor
+    // retires every node
+    mutable NodeReclaimer reclaimer_;
+    Tree tree_;
+    Compare comp_;
+    mutable std::mutex writeLock_;
+    std::atomic<uint64_t> version_;
+    // tree_'s root as of the last finished write, for the optimistic walk
+    std::atomic<const NodeType*> root_;
+};
+
+/*
+----------------------------------------------------
+Begin implementations for the ConcurrentAVLTree class.
+----------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::WriteSection::WriteSection(ConcurrentAVLTree& owner) :
+    owner_(owner),
+    start_(owner.version_.load(std::memory_order_relaxed))
+{
+    owner_.version_.store(start_ + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::WriteSection::~WriteSection()
+{
+    owner_.root_.store(owner_.tree_.root(), std::memory_order_release);
+    owner_.version_.store(start_ + 2, std::memory_order_release);
+}
+
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree() :
+    tree_(Compare(), Alloc(&reclaimer_)),
+    version_(0),
+    root_(NULL)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree(const Compare& comp) :
+    tree_(comp, Alloc(&reclaimer_)),
+    comp_(comp),
+    version_(0),
+    root_(NULL)
+{
+
+}
+
+/**
+* Inserts the pair. An existing key gets a new node holding the new
+* value, so concurrent readers see either the old value or the new one.
+* If building the new node throws, the old entry is gone.
+*/
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::lock_guard<std::mutex> lock(writeLock_);
+    {
+        WriteSection section(*this);
+        tree_.remove(keyValuePair.first);
+        tree_.insert(keyValuePair);
+    }
+    reclaimIfDue();
+}
+
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    std::lock_guard<std::mutex> lock(writeLock_);
+    {
+        WriteSection section(*this);
+        tree_.remove(key);
+    }
+    reclaimIfDue();
+}
+
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::clear()
+{
+    std::lock_guard<std::mutex> lock(writeLock_);
+    {
+        WriteSection section(*this);
+        tree_.clear();
+    }
+    reclaimer_.reclaim();
+}
+
+/**
+* Frees retired nodes once a batch has built up. Called with the write
+* lock held but outside the write section, so readers can finish.
+*/
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::reclaimIfDue()
+{
+    if(reclaimer_.retiredCount() >= RetireBatch) reclaimer_.reclaim();
+}
+
+/**
+* One unlocked walk from the root. Returns false if the walk ran longer
+* than any AVL tree is tall, which only happens if it raced a writer.
+*/
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::optimisticFind(const Key& key, const NodeType*& node) const
+{
+    const NodeType* curr = root_.load(std::memory_order_acquire);
+    const NodeType* best = NULL;
+    for(int steps = 0; curr != NULL; ++steps) {
+        if(steps == MaxDescent) return false;
+        if(comp_(curr->getKey(), key)) {
+            curr = curr->loadRight();
+        }
+        else {
+            best = curr;
+            curr = curr->loadLeft();
+        }
+    }
+    node = (best != NULL && !comp_(key, best->getKey())) ? best : NULL;
+    return true;
+}
+
+/**
+* Looks key up without locking, retrying while writers get in the way.
+* Returns false if every try raced a writer. Otherwise node is the
+* key's node, or NULL, as of a moment with no write in progress. Must be
+* called inside a ReclaimerSection, which keeps node allocated and unchanged
+* until the section ends.
+*/
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::optimisticRead(const Key& key, const NodeType*& node) const
+{
+    for(int attempt = 0; attempt < MaxOptimisticReads; ++attempt) {
+        uint64_t start = version_.load(std::memory_order_acquire);
+        if(start & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        bool finished = optimisticFind(key, node);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(finished && version_.load(std::memory_order_relaxed) == start) return true;
+    }
+    return false;
+}
+
+/**
+* Copies the value stored under key into value and returns true, or
+* returns false if key is not in the tree
+*/
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    {
+        ReclaimerSection section(reclaimer_);
+        const NodeType* node = NULL;
+        if(optimisticRead(key, node)) {
+            if(node == NULL) return false;
+            value = node->getValue();
+            return true;
+        }
+    }
+    // The read section must end first: a writer holding the lock may be
+    // waiting for this reader to leave
+    std::lock_guard<std::mutex> lock(writeLock_);
+    const Value* found = tree_.lookup(key);
+    if(found == NULL) return false;
+    value = *found;
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    {
+        ReclaimerSection section(reclaimer_);
+        const NodeType* node = NULL;
+        if(optimisticRead(key, node)) return node != NULL;
+    }
+    std::lock_guard<std::mutex> lock(writeLock_);
+    return tree_.contains(key);
+}
+
+template<typename Key, typename Value, typename Compare>
+size_t ConcurrentAVLTree<Key, Value, Compare>::size() const
+{
+    std::lock_guard<std::mutex> lock(writeLock_);
+    return tree_.size();
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size() == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+TreeReport ConcurrentAVLTree<Key, Value, Compare>::verify() const
+{
+    std::lock_guard<std::mutex> lock(writeLock_);
+    return tree_.verify();
+}
+
+/*
+--------------------------------------------------
+End implementations for the ConcurrentAVLTree class.
+--------------------------------------------------
+*/
+
+#endif
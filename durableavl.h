@@ -0,0 +1,777 @@
+#ifndef DURABLEAVL_H
+#define DURABLEAVL_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "avlbst.h"
+#include "bstio.h"
+#include "treeio.h"
+
+/**
+* An AVLTree whose inserts and removes survive a crash. Every change is
+* applied in memory and appended to a write-ahead log as a small binary
+* record. Opening the tree recovers it: the latest checkpoint is
+* loaded and the log replayed on top. checkpoint() saves the whole tree
+* and starts an empty log.
+*
+* Records are made durable by group commit. Changes queue their records
+* in memory; one thread at a time writes out everything queued and
+* syncs the log once, and every change in that batch is then durable.
+* Threads whose changes arrive while a sync is under way go into the
+* next batch, so concurrent writers share syncs instead of paying one
+* each. In Immediate mode insert() and remove() return once their
+* record is on disk. In Deferred mode they return at once, a background
+* thread commits every interval, and sync() waits for everything so
+* far, so a crash loses at most the last interval of changes.
+*
+* The files are path.ckpt (the generation number and a log offset,
+* then a save() snapshot), path.wal (a header with the same generation,
+* then the records) and path.lock, which keeps a second process out. A record
+* is its payload length and CRC-32, then the payload: a type byte and
+* the key, plus the value for inserts, encoded by Codec. A crash can
+* only tear the last record; recovery stops at the first record that
+* is cut short or fails its checksum and trims it off the log.
+*
+* If writing the log fails, the change stays in memory but the call
+* throws std::system_error, and so does every later change: the tree
+* can no longer promise durability. Reads take the same mutex as
+* writes. Changes are visible to readers before they are durable.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key>, typename Codec = BinaryCodec>
+class DurableAVLTree
+{
+public:
+    enum Durability { Immediate, Deferred };
+
+    explicit DurableAVLTree(const std::string& path, Durability mode = Immediate,
+                            std::chrono::milliseconds interval = std::chrono::milliseconds(5),
+                            const Compare& comp = Compare(), const Codec& codec = Codec());
+    DurableAVLTree(const DurableAVLTree&) = delete;
+    DurableAVLTree& operator=(const DurableAVLTree&) = delete;
+    ~DurableAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    void sync();
+    void checkpoint();
+
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    size_t size() const;
+    bool empty() const;
+    TreeReport verify() const;
+
+    uint64_t logBytes() const;
+    uint64_t commitCount() const;
+    size_t recoveredRecords() const;
+
+    // Longest record payload recovery accepts; anything longer is torn
+    static const uint32_t MaxRecordBytes = 1u << 30;
+
+private:
+    enum RecordType { InsertRecord = 1, RemoveRecord = 2, ClearRecord = 3 };
+
+    struct LogHeader
+    {
+        static const uint32_t Version = 1;
+
+        char magic[4];
+        uint32_t version;
+        uint32_t codecTag;
+        uint32_t keySize;
+        uint32_t valueSize;
+        uint32_t reserved;
+        uint64_t generation;
+    };
+
+    // Recovery and checkpoints
+    uint64_t loadCheckpoint(uint64_t& replayFrom);
+    void replayLog(uint64_t generation, uint64_t replayFrom);
+    void applyRecord(const std::string& payload);
+    void writeCheckpoint(const std::string& snapshot);
+    void startLog(uint64_t generation, const std::string& records = std::string());
+    void syncDirectory();
+    static std::system_error fileError(const char* what);
+    static void writeAll(int fd, const char* data, size_t size);
+
+    // Group commit
+    void beginRecord(RecordType type);
+    void queueRecord(std::unique_lock<std::mutex>& lock);
+    void commitThrough(std::unique_lock<std::mutex>& lock, uint64_t lsn);
+    void checkUsable() const;
+    void flusherLoop();
+
+    AVLTree<Key, Value, Compare> tree_;
+    Codec codec_;
+    std::string path_;
+    Durability mode_;
+    std::chrono::milliseconds interval_;
+    int lockFd_;
+    int logFd_;
+    uint64_t generation_;
+
+    mutable std::mutex lock_;
+    std::condition_variable committed_;
+    std::condition_variable flushWake_;
+    std::string record_;          // the record being encoded
+    StringAppendBuf recordBuf_;
+    std::ostream recordOut_;
+    std::string pending_;         // records queued for the next commit
+    uint64_t queuedLsn_;          // records queued so far
+    uint64_t durableLsn_;         // records known to be on disk
+    uint64_t logBytes_;
+    uint64_t commits_;
+    bool committing_;
+    bool checkpointing_;          // a checkpoint is being written outside the lock
+    std::string carry_;           // records queued since that checkpoint's snapshot
+    bool stopping_;
+    int failure_;                 // errno of a failed log write, or 0
+    size_t recovered_;
+    std::thread flusher_;
+};
+
+/*
+----------------------------------------------------
+Begin implementations for the DurableAVLTree class.
+----------------------------------------------------
+*/
+
+/**
+* Opens or creates the tree stored at path and recovers it. Throws
+* std::system_error if the files cannot be opened or another process
+* has them open, and std::runtime_error if the checkpoint or log is not
+* one of ours or is damaged beyond a torn last record.
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+DurableAVLTree<Key, Value, Compare, Codec>::DurableAVLTree(const std::string& path, Durability mode,
+                                                           std::chrono::milliseconds interval,
+                                                           const Compare& comp, const Codec& codec) :
+    tree_(comp),
+    codec_(codec),
+    path_(path),
+    mode_(mode),
+    interval_(interval),
+    lockFd_(-1),
+    logFd_(-1),
+    generation_(0),
+    recordBuf_(record_),
+    recordOut_(&recordBuf_),
+    queuedLsn_(0),
+    durableLsn_(0),
+    logBytes_(0),
+    commits_(0),
+    committing_(false),
+    checkpointing_(false),
+    stopping_(false),
+    failure_(0),
+    recovered_(0)
+{
+    try {
+        lockFd_ = ::open((path_ + ".lock").c_str(), O_RDWR | O_CREAT, 0644);
+        if(lockFd_ < 0) throw fileError("DurableAVLTree: cannot open the lock file");
+        if(::flock(lockFd_, LOCK_EX | LOCK_NB) != 0) throw fileError("DurableAVLTree: the tree is in use");
+
+        uint64_t replayFrom = 0;
+        generation_ = loadCheckpoint(replayFrom);
+        replayLog(generation_, replayFrom);
+        if(mode_ == Deferred) flusher_ = std::thread(&DurableAVLTree::flusherLoop, this);
+    }
+    catch(...) {
+        if(logFd_ >= 0) ::close(logFd_);
+        if(lockFd_ >= 0) ::close(lockFd_);
+        throw;
+    }
+}
+
+/**
+* Commits whatever is still queued; errors are lost here, so callers
+* that care call sync() first
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+DurableAVLTree<Key, Value, Compare, Codec>::~DurableAVLTree()
+{
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        stopping_ = true;
+    }
+    flushWake_.notify_all();
+    if(flusher_.joinable()) flusher_.join();
+    try {
+        sync();
+    }
+    catch(...) {
+    }
+    ::close(logFd_);
+    ::close(lockFd_);
+}
+
+/**
+* Loads path.ckpt into the tree and returns its generation, or 0 if
+* there is no checkpoint yet. replayFrom is the offset in the previous
+* generation's log where the records newer than the snapshot start.
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+uint64_t DurableAVLTree<Key, Value, Compare, Codec>::loadCheckpoint(uint64_t& replayFrom)
+{
+    int fd = ::open((path_ + ".ckpt").c_str(), O_RDONLY);
+    if(fd < 0) {
+        if(errno == ENOENT) return 0;
+        throw fileError("DurableAVLTree: cannot open the checkpoint");
+    }
+    uint64_t generation = 0;
+    try {
+        FdStreamBuf buffer(fd);
+        std::istream in(&buffer);
+        in.read(reinterpret_cast<char*>(&generation), sizeof(generation));
+        in.read(reinterpret_cast<char*>(&replayFrom), sizeof(replayFrom));
+        if(!in) throw std::runtime_error("DurableAVLTree: checkpoint is cut short");
+        tree_.load(in, codec_);
+    }
+    catch(...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+    return generation;
+}
+
+/**
+* Replays the records of path.wal, if it belongs to this checkpoint,
+* then trims off a torn last record and leaves the log open for
+* appending. A log one generation older is still the one that was live
+* while a checkpoint() wrote this snapshot, and that checkpoint crashed
+* before switching logs: its records from replayFrom on are newer than
+* the snapshot, so they are replayed and moved into a fresh log. Any
+* older log was already folded into the checkpoint.
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::replayLog(uint64_t generation, uint64_t replayFrom)
+{
+    std::string logPath = path_ + ".wal";
+    int fd = ::open(logPath.c_str(), O_RDWR);
+    if(fd < 0) {
+        if(errno != ENOENT) throw fileError("DurableAVLTree: cannot open the log");
+        startLog(generation);
+        return;
+    }
+
+    uint64_t goodBytes = 0;
+    bool stale = false;
+    bool previous = false;
+    std::string carried;  // the replayed records of a previous generation's log
+    try {
+        struct stat info;
+        if(::fstat(fd, &info) != 0) throw fileError("DurableAVLTree: cannot stat the log");
+        uint64_t fileBytes = static_cast<uint64_t>(info.st_size);
+
+        FdStreamBuf buffer(fd);
+        std::istream in(&buffer);
+        LogHeader header;
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if(!in || std::memcmp(header.magic, "BSTW", sizeof(header.magic)) != 0 ||
+           header.version != LogHeader::Version) {
+            throw std::runtime_error("DurableAVLTree: not a tree log");
+        }
+        if(header.codecTag != Codec::Tag || header.keySize != sizeof(Key) || header.valueSize != sizeof(Value)) {
+            throw std::runtime_error("DurableAVLTree: log was written for another codec or key/value type");
+        }
+        if(header.generation > generation) {
+            throw std::runtime_error("DurableAVLTree: log is newer than the checkpoint");
+        }
+        previous = header.generation + 1 == generation && replayFrom >= sizeof(header);
+        stale = header.generation < generation && !previous;
+        goodBytes = sizeof(header);
+        if(previous) {
+            goodBytes = std::min(replayFrom, fileBytes);
+            in.ignore(static_cast<std::streamsize>(goodBytes - sizeof(header)));
+        }
+
+        std::string payload;
+        while(!stale) {
+            uint32_t frame[2];  // payload length, CRC-32
+            // A zero length is torn too: a crash can leave a zero-filled
+            // tail. So is a length running past the end of the file,
+            // which is checked before anything is allocated for it.
+            if(!in.read(reinterpret_cast<char*>(frame), sizeof(frame)) || frame[0] == 0 ||
+               frame[0] > MaxRecordBytes || frame[0] > fileBytes - goodBytes - sizeof(frame)) break;
+            payload.resize(frame[0]);
+            if(!in.read(&payload[0], frame[0]) || crc32(payload.data(), payload.size()) != frame[1]) break;
+            applyRecord(payload);
+            ++recovered_;
+            goodBytes += sizeof(frame) + frame[0];
+            if(previous) {
+                carried.append(reinterpret_cast<const char*>(frame), sizeof(frame));
+                carried.append(payload);
+            }
+        }
+    }
+    catch(...) {
+        ::close(fd);
+        throw;
+    }
+
+    if(stale || previous) {
+        ::close(fd);
+        startLog(generation, carried);
+        return;
+    }
+    if(::ftruncate(fd, static_cast<off_t>(goodBytes)) != 0 || ::fsync(fd) != 0) {
+        int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "DurableAVLTree: cannot trim the log");
+    }
+    ::close(fd);
+    logFd_ = ::open(logPath.c_str(), O_WRONLY | O_APPEND);
+    if(logFd_ < 0) throw fileError("DurableAVLTree: cannot open the log");
+    logBytes_ = goodBytes;
+}
+
+/**
+* Applies one checked record to the tree. A record that passed its
+* checksum but does not decode is not a torn write, so it throws.
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::applyRecord(const std::string& payload)
+{
+    MemoryReadBuf buffer;
+    buffer.reset(payload.data(), payload.size());
+    std::istream in(&buffer);
+    char type = 0;
+    in.get(type);
+    if(type == ClearRecord) {
+        tree_.clear();
+        return;
+    }
+    Key key = codec_.template read<Key>(in);
+    if(type == InsertRecord) {
+        Value value = codec_.template read<Value>(in);
+        if(!in) throw std::runtime_error("DurableAVLTree: log record does not decode");
+        tree_.insert(std::make_pair(std::move(key), std::move(value)));
+    }
+    else if(type == RemoveRecord && in) {
+        tree_.remove(key);
+    }
+    else {
+        throw std::runtime_error("DurableAVLTree: log record does not decode");
+    }
+}
+
+/**
+* Writes snapshot, an encoded checkpoint, as path.ckpt: to a temporary
+* file first, then renamed into place, so a crash leaves either the old
+* checkpoint or the new one. Touches no member the lock guards.
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::writeCheckpoint(const std::string& snapshot)
+{
+    std::string temp = path_ + ".ckpt.tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) throw fileError("DurableAVLTree: cannot create the checkpoint");
+    try {
+        writeAll(fd, snapshot.data(), snapshot.size());
+        if(::fsync(fd) != 0) throw fileError("DurableAVLTree: cannot sync the checkpoint");
+    }
+    catch(...) {
+        ::close(fd);
+        ::unlink(temp.c_str());
+        throw;
+    }
+    ::close(fd);
+    if(::rename(temp.c_str(), (path_ + ".ckpt").c_str()) != 0) {
+        int error = errno;
+        ::unlink(temp.c_str());
+        throw std::system_error(error, std::generic_category(), "DurableAVLTree: cannot replace the checkpoint");
+    }
+    syncDirectory();
+}
+
+/**
+* Replaces path.wal with a log of the given generation holding records,
+* the same way, and makes it the log that commits append to
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::startLog(uint64_t generation, const std::string& records)
+{
+    std::string temp = path_ + ".wal.tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if(fd < 0) throw fileError("DurableAVLTree: cannot create the log");
+
+    LogHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "BSTW", sizeof(header.magic));
+    header.version = LogHeader::Version;
+    header.codecTag = Codec::Tag;
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    header.generation = generation;
+    try {
+        writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header));
+        writeAll(fd, records.data(), records.size());
+        if(::fsync(fd) != 0) throw fileError("DurableAVLTree: cannot sync the log");
+        if(::rename(temp.c_str(), (path_ + ".wal").c_str()) != 0) {
+            throw fileError("DurableAVLTree: cannot replace the log");
+        }
+        syncDirectory();
+    }
+    catch(...) {
+        ::close(fd);
+        ::unlink(temp.c_str());
+        throw;
+    }
+
+    if(logFd_ >= 0) ::close(logFd_);
+    logFd_ = fd;
+    logBytes_ = sizeof(header) + records.size();
+}
+
+/**
+* Syncs the directory holding the files, so that renames are durable
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::syncDirectory()
+{
+    size_t slash = path_.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path_.substr(0, slash));
+    int fd = ::open(directory.c_str(), O_RDONLY);
+    if(fd < 0) throw fileError("DurableAVLTree: cannot open the directory");
+    int result = ::fsync(fd);
+    int error = errno;
+    ::close(fd);
+    if(result != 0) throw std::system_error(error, std::generic_category(), "DurableAVLTree: cannot sync the directory");
+}
+
+template<typename Key, typename Value, typename Compare, typename Codec>
+std::system_error DurableAVLTree<Key, Value, Compare, Codec>::fileError(const char* what)
+{
+    return std::system_error(errno, std::generic_category(), what);
+}
+
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::writeAll(int fd, const char* data, size_t size)
+{
+    while(size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            throw fileError("DurableAVLTree: cannot write the log");
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::checkUsable() const
+{
+    if(failure_ != 0) {
+        throw std::system_error(failure_, std::generic_category(), "DurableAVLTree: an earlier log write failed");
+    }
+}
+
+/**
+* Starts encoding a record into record_, leaving room for the frame
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::beginRecord(RecordType type)
+{
+    record_.assign(2 * sizeof(uint32_t), '\0');
+    recordOut_.clear();
+    recordOut_.put(static_cast<char>(type));
+}
+
+/**
+* Frames the encoded record, queues it for the next commit and, in
+* Immediate mode, waits until it is on disk
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::queueRecord(std::unique_lock<std::mutex>& lock)
+{
+    uint32_t frame[2];
+    frame[0] = static_cast<uint32_t>(record_.size() - sizeof(frame));
+    frame[1] = crc32(record_.data() + sizeof(frame), frame[0]);
+    std::memcpy(&record_[0], frame, sizeof(frame));
+    pending_.append(record_);
+    if(checkpointing_) carry_.append(record_);
+    uint64_t lsn = ++queuedLsn_;
+    if(mode_ == Immediate) commitThrough(lock, lsn);
+}
+
+/**
+* Returns once record lsn is on disk. If no commit is under way, this
+* thread becomes the one to write and sync everything queued, with the
+* mutex released; otherwise it waits for the commit in progress, and
+* for the next one if its record came too late for it.
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::commitThrough(std::unique_lock<std::mutex>& lock, uint64_t lsn)
+{
+    while(durableLsn_ < lsn) {
+        checkUsable();
+        if(committing_) {
+            committed_.wait(lock);
+            continue;
+        }
+
+        committing_ = true;
+        std::string batch;
+        batch.swap(pending_);
+        uint64_t batchLsn = queuedLsn_;
+        int error = 0;
+        lock.unlock();
+        try {
+            writeAll(logFd_, batch.data(), batch.size());
+            if(::fdatasync(logFd_) != 0) error = errno;
+        }
+        catch(const std::system_error& e) {
+            error = e.code().value();
+        }
+        lock.lock();
+
+        committing_ = false;
+        if(error == 0) {
+            durableLsn_ = batchLsn;
+            logBytes_ += batch.size();
+            ++commits_;
+        }
+        else {
+            failure_ = error;
+        }
+        // Keep the buffer's memory for the next batch
+        if(pending_.empty()) {
+            batch.clear();
+            pending_.swap(batch);
+        }
+        committed_.notify_all();
+    }
+}
+
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::flusherLoop()
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    while(!stopping_) {
+        flushWake_.wait_for(lock, interval_);
+        if(queuedLsn_ > durableLsn_ && failure_ == 0) {
+            try {
+                commitThrough(lock, queuedLsn_);
+            }
+            catch(...) {
+                // Kept in failure_ and reported by the next change
+            }
+        }
+    }
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present.
+* The record is encoded before the tree changes, so a codec that throws
+* leaves both as they were.
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    checkUsable();
+    beginRecord(InsertRecord);
+    codec_.write(recordOut_, keyValuePair.first);
+    codec_.write(recordOut_, keyValuePair.second);
+    tree_.insert(keyValuePair);
+    queueRecord(lock);
+}
+
+/**
+* Removes the key if present; a missing key is not logged
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::remove(const Key& key)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    checkUsable();
+    if(tree_.find(key) == tree_.end()) return;
+    beginRecord(RemoveRecord);
+    codec_.write(recordOut_, key);
+    tree_.remove(key);
+    queueRecord(lock);
+}
+
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::clear()
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    checkUsable();
+    beginRecord(ClearRecord);
+    tree_.clear();
+    queueRecord(lock);
+}
+
+/**
+* Waits until every change made so far is on disk
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::sync()
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    commitThrough(lock, queuedLsn_);
+}
+
+/**
+* Saves the whole tree as a new checkpoint and starts a new log, so
+* that recovery no longer replays the old records. The tree is encoded
+* in memory under the lock, which stalls readers and writers for that
+* O(n) copy and needs memory for it, but not for writing and syncing
+* the file. Changes made meanwhile go to the old log as usual and are
+* kept aside as well; once the checkpoint is in place they start the
+* new log, and only that switch, two small synced writes, takes the
+* lock again. A crash leaves the old checkpoint and log, the new
+* checkpoint and the old log, whose records from the snapshot on
+* recovery replays, or the new checkpoint and log.
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+void DurableAVLTree<Key, Value, Compare, Codec>::checkpoint()
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    checkUsable();
+    while(committing_ || checkpointing_) committed_.wait(lock);
+
+    uint64_t next = generation_ + 1;
+    // What is queued now is in the snapshot and will be written to the
+    // old log ahead of any later record, so the newer records start at
+    uint64_t replayFrom = logBytes_ + pending_.size();
+    std::string snapshot;
+    {
+        StringAppendBuf buffer(snapshot);
+        std::ostream out(&buffer);
+        out.write(reinterpret_cast<const char*>(&next), sizeof(next));
+        out.write(reinterpret_cast<const char*>(&replayFrom), sizeof(replayFrom));
+        tree_.save(out, codec_);
+    }
+    checkpointing_ = true;
+    carry_.clear();
+
+    lock.unlock();
+    try {
+        writeCheckpoint(snapshot);
+    }
+    catch(...) {
+        lock.lock();
+        checkpointing_ = false;
+        carry_.clear();
+        committed_.notify_all();
+        throw;
+    }
+    lock.lock();
+    while(committing_) committed_.wait(lock);
+
+    checkpointing_ = false;
+    generation_ = next;
+    committed_.notify_all();
+    try {
+        startLog(next, carry_);
+    }
+    catch(const std::system_error& e) {
+        // path.wal may or may not have been replaced, so later records
+        // have no log that recovery is sure to read
+        failure_ = e.code().value();
+        carry_.clear();
+        throw;
+    }
+    // Everything queued is in the new log now, so it is durable
+    pending_.clear();
+    durableLsn_ = queuedLsn_;
+    carry_.clear();
+    committed_.notify_all();
+}
+
+template<typename Key, typename Value, typename Compare, typename Codec>
+bool DurableAVLTree<Key, Value, Compare, Codec>::find(const Key& key, Value& value) const
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    typename AVLTree<Key, Value, Compare>::const_iterator it = tree_.find(key);
+    if(it == tree_.end()) return false;
+    value = it->second;
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare, typename Codec>
+bool DurableAVLTree<Key, Value, Compare, Codec>::contains(const Key& key) const
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    return tree_.find(key) != tree_.end();
+}
+
+template<typename Key, typename Value, typename Compare, typename Codec>
+size_t DurableAVLTree<Key, Value, Compare, Codec>::size() const
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    return tree_.size();
+}
+
+template<typename Key, typename Value, typename Compare, typename Codec>
+bool DurableAVLTree<Key, Value, Compare, Codec>::empty() const
+{
+    return size() == 0;
+}
+
+template<typename Key, typename Value, typename Compare, typename Codec>
+TreeReport DurableAVLTree<Key, Value, Compare, Codec>::verify() const
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    return tree_.verify();
+}
+
+/**
+* The bytes on disk in the current log, header included
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+uint64_t DurableAVLTree<Key, Value, Compare, Codec>::logBytes() const
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    return logBytes_;
+}
+
+/**
+* The number of log syncs so far; with group commit this is usually
+* well below the number of changes
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+uint64_t DurableAVLTree<Key, Value, Compare, Codec>::commitCount() const
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    return commits_;
+}
+
+/**
+* The number of log records replayed when the tree was opened
+*/
+template<typename Key, typename Value, typename Compare, typename Codec>
+size_t DurableAVLTree<Key, Value, Compare, Codec>::recoveredRecords() const
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    return recovered_;
+}
+
+/*
+--------------------------------------------------
+End implementations for the DurableAVLTree class.
+--------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,440 @@
+#ifndef FROZENTREE_H
+#define FROZENTREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "bst.h"
+
+/**
+* An immutable, read-optimized copy of a search tree, made by
+* BinarySearchTree::freeze(), which is only defined where this header
+* is included. The items are laid out in Eytzinger order:
+* slot 1 holds the root, and slot i has children 2i and 2i+1. So a
+* search touches one predictable array position per level instead of
+* chasing pointers. The keys are also kept in a separate dense array.
+* The search is branchless and prefetches the cache line holding the
+* descendants four levels down (for 4-byte keys) while it works.
+*
+* find, lower_bound, upper_bound and iteration behave like the live
+* tree they came from, except that nothing can be inserted or removed.
+* Iterators walk the implicit tree in order, in amortized O(1) per step.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class FrozenTree
+{
+public:
+    FrozenTree();
+    template<typename ForwardIt>
+    FrozenTree(ForwardIt first, size_t count, const Compare& comp = Compare());
+
+    /**
+    * A read-only bidirectional iterator in key order. --end() reaches
+    * the largest item.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key,Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        const_iterator();
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class FrozenTree<Key, Value, Compare>;
+        const_iterator(size_t index, const FrozenTree* tree);
+        size_t index_;  // Eytzinger slot, 0 for the end
+        const FrozenTree* tree_;
+    };
+
+    typedef const_iterator iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+    typedef const_reverse_iterator reverse_iterator;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+
+    const_iterator find(const Key& key) const;
+    bool contains(const Key& key) const;
+    const Value* lookup(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    const_iterator upper_bound(const Key& key) const;
+    bool empty() const;
+    size_t size() const;
+    Compare key_comp() const;
+
+private:
+    size_t lowerBoundIndex(const Key& key) const;
+    size_t upperBoundIndex(const Key& key) const;
+    size_t firstIndex() const;
+    size_t lastIndex() const;
+    size_t nextIndex(size_t i) const;
+    size_t prevIndex(size_t i) const;
+    static size_t finishDescent(size_t i);
+    void prefetch(size_t i) const;
+
+    // Keys per 64-byte cache line (at least one). Prefetching slot
+    // i * PrefetchStride fetches the line holding i's descendants
+    // log2(PrefetchStride) levels further down.
+    static const size_t PrefetchStride =
+        sizeof(Key) > 32 ? 1 : sizeof(Key) > 16 ? 2 :
+        sizeof(Key) > 8 ? 4 : sizeof(Key) > 4 ? 8 : 16;
+
+    std::vector<Key> keys_;                         // 1-based, Eytzinger order
+    std::vector<std::pair<const Key, Value> > items_; // items_[i - 1] is slot i
+    size_t size_;
+    Compare comp_;
+};
+
+/*
+---------------------------------------------------------------
+Begin implementations for the FrozenTree::const_iterator class.
+---------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+FrozenTree<Key, Value, Compare>::const_iterator::const_iterator(size_t index, const FrozenTree* tree)
+{
+    index_ = index;
+    tree_ = tree;
+}
+
+template<typename Key, typename Value, typename Compare>
+FrozenTree<Key, Value, Compare>::const_iterator::const_iterator()
+{
+    index_ = 0;
+    tree_ = NULL;
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<const Key,Value> &
+FrozenTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return tree_->items_[index_ - 1];
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<const Key,Value> *
+FrozenTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return &(tree_->items_[index_ - 1]);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenTree<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return index_ == rhs.index_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenTree<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return index_ != rhs.index_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator&
+FrozenTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    index_ = tree_->nextIndex(index_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator&
+FrozenTree<Key, Value, Compare>::const_iterator::operator--()
+{
+    index_ = (index_ == 0) ? tree_->lastIndex() : tree_->prevIndex(index_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+-------------------------------------------------------------
+End implementations for the FrozenTree::const_iterator class.
+-------------------------------------------------------------
+*/
+
+/*
+-------------------------------------------------
+Begin implementations for the FrozenTree class.
+-------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+FrozenTree<Key, Value, Compare>::FrozenTree() :
+    size_(0)
+{
+
+}
+
+/**
+* Builds the layout from count items starting at first, which must be
+* sorted by comp with no duplicate keys (as any tree's begin() is).
+* The items are read once in order and dropped into their Eytzinger
+* slots by walking the implicit tree in order.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename ForwardIt>
+FrozenTree<Key, Value, Compare>::FrozenTree(ForwardIt first, size_t count, const Compare& comp) :
+    size_(count),
+    comp_(comp)
+{
+    if(count == 0) return;
+
+    std::vector<const std::pair<const Key, Value>*> slots(count + 1);
+    for(size_t i = firstIndex(); i != 0; i = nextIndex(i), ++first) {
+        slots[i] = &*first;
+    }
+
+    keys_.reserve(count + 1);
+    items_.reserve(count);
+    keys_.push_back(slots[1]->first);  // slot 0 is never searched
+    for(size_t i = 1; i <= count; ++i) {
+        keys_.push_back(slots[i]->first);
+        items_.push_back(*slots[i]);
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+size_t FrozenTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value, typename Compare>
+Compare FrozenTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Prefetches the keys PrefetchStride levels below slot i. Near the
+* bottom that slot is past the end of the array, and merely forming a
+* pointer there is undefined, so the index is clamped to the last slot
+* (a conditional move, not a branch).
+*/
+template<typename Key, typename Value, typename Compare>
+void FrozenTree<Key, Value, Compare>::prefetch(size_t i) const
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(keys_.data() + std::min(i * PrefetchStride, size_));
+#else
+    (void)i;
+#endif
+}
+
+/**
+* A descent ends below a leaf after recording one bit per level: 1 for
+* "went right". The answer is the last node where it went left, found
+* by dropping the trailing 1 bits and then one 0 bit. 0 means none.
+*/
+template<typename Key, typename Value, typename Compare>
+size_t FrozenTree<Key, Value, Compare>::finishDescent(size_t i)
+{
+#if defined(__GNUC__)
+    return i >> (__builtin_ctzll(~static_cast<unsigned long long>(i)) + 1);
+#else
+    while(i & 1) i >>= 1;
+    return i >> 1;
+#endif
+}
+
+/**
+* Branchless descent: the comparison result picks the child index
+* arithmetically, so there is no branch to mispredict.
+*/
+template<typename Key, typename Value, typename Compare>
+size_t FrozenTree<Key, Value, Compare>::lowerBoundIndex(const Key& key) const
+{
+    size_t i = 1;
+    while(i <= size_) {
+        prefetch(i);
+        i = 2 * i + static_cast<size_t>(comp_(keys_[i], key));
+    }
+    return finishDescent(i);
+}
+
+template<typename Key, typename Value, typename Compare>
+size_t FrozenTree<Key, Value, Compare>::upperBoundIndex(const Key& key) const
+{
+    size_t i = 1;
+    while(i <= size_) {
+        prefetch(i);
+        i = 2 * i + static_cast<size_t>(!comp_(key, keys_[i]));
+    }
+    return finishDescent(i);
+}
+
+template<typename Key, typename Value, typename Compare>
+size_t FrozenTree<Key, Value, Compare>::firstIndex() const
+{
+    if(size_ == 0) return 0;
+    size_t i = 1;
+    while(2 * i <= size_) i = 2 * i;
+    return i;
+}
+
+template<typename Key, typename Value, typename Compare>
+size_t FrozenTree<Key, Value, Compare>::lastIndex() const
+{
+    if(size_ == 0) return 0;
+    size_t i = 1;
+    while(2 * i + 1 <= size_) i = 2 * i + 1;
+    return i;
+}
+
+/**
+* In-order successor in the implicit tree: the leftmost slot of the
+* right subtree, or else the nearest ancestor reached from a left child.
+*/
+template<typename Key, typename Value, typename Compare>
+size_t FrozenTree<Key, Value, Compare>::nextIndex(size_t i) const
+{
+    if(2 * i + 1 <= size_) {
+        i = 2 * i + 1;
+        while(2 * i <= size_) i = 2 * i;
+        return i;
+    }
+    return finishDescent(i);
+}
+
+template<typename Key, typename Value, typename Compare>
+size_t FrozenTree<Key, Value, Compare>::prevIndex(size_t i) const
+{
+    if(2 * i <= size_) {
+        i = 2 * i;
+        while(2 * i + 1 <= size_) i = 2 * i + 1;
+        return i;
+    }
+    while(i != 0 && !(i & 1)) i >>= 1;
+    return i >> 1;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::begin() const
+{
+    return const_iterator(firstIndex(), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(0, this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_reverse_iterator
+FrozenTree<Key, Value, Compare>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_reverse_iterator
+FrozenTree<Key, Value, Compare>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::find(const Key& key) const
+{
+    size_t i = lowerBoundIndex(key);
+    if(i != 0 && comp_(key, keys_[i])) i = 0;
+    return const_iterator(i, this);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    return find(key) != end();
+}
+
+/**
+* Returns a pointer to the value stored under key, or NULL
+*/
+template<typename Key, typename Value, typename Compare>
+const Value* FrozenTree<Key, Value, Compare>::lookup(const Key& key) const
+{
+    const_iterator it = find(key);
+    return it == end() ? NULL : &it->second;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return const_iterator(lowerBoundIndex(key), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return const_iterator(upperBoundIndex(key), this);
+}
+
+/*
+-----------------------------------------------
+End implementations for the FrozenTree class.
+-----------------------------------------------
+*/
+
+/**
+* Returns an immutable, search-optimized copy of the tree. Meant for
+* trees that are built once and then read many times; see FrozenTree.
+* Costs one in-order pass, O(n).
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc, typename NodeType>
+FrozenTree<Key, Value, Compare> BinarySearchTree<Key, Value, Compare, Alloc, NodeType>::freeze() const
+{
+    return FrozenTree<Key, Value, Compare>(begin(), size(), comp_);
+}
+
+#endif
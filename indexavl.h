@@ -0,0 +1,715 @@
+#ifndef INDEXAVL_H
+#define INDEXAVL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "bst.h"
+
+/**
+* The AVL algorithms of the index-linked trees, CompactAVLTree and
+* MappedAVLTree, written once. Their nodes are slots in one array and
+* link to each other by 32-bit slot index. The balance factor is packed
+* into the two low bits of the parent link, so a slot is the item plus
+* 12 bytes.
+*
+* The core knows nothing about where the slots live; Tree, the tree
+* deriving from it, owns that storage (a heap buffer or a file
+* mapping). Tree points slots_ at the array whenever it moves, and
+* provides the root link through rootLink(), a uint32_t& and a const
+* overload returning its value. Handing out and freeing slots is left
+* to Tree as well. The core searches, links a fresh slot in and
+* rebalances, unlinks a slot, and verifies.
+*/
+template <typename Tree, typename Key, typename Value, typename Compare>
+class IndexAVLCore
+{
+protected:
+    typedef std::pair<const Key, Value> Item;
+
+    /**
+    * One entry of the array. The item is raw storage so that free slots
+    * hold no object; parentBalance is (parent index << 2) | (balance + 1),
+    * and FreeMark in the low bits flags a slot on the free list, which
+    * is threaded through left.
+    */
+    struct Slot
+    {
+        typename std::aligned_storage<sizeof(Item), alignof(Item)>::type item;
+        uint32_t left;
+        uint32_t right;
+        uint32_t parentBalance;
+    };
+
+    static const uint32_t Nil = (1u << 30) - 1;
+    static const uint32_t FreeMark = 3;
+
+    explicit IndexAVLCore(const Compare& comp);
+
+    // Slot access
+    Item& item(uint32_t i) const;
+    const Key& key(uint32_t i) const;
+    uint32_t left(uint32_t i) const;
+    uint32_t right(uint32_t i) const;
+    uint32_t parent(uint32_t i) const;
+    int balance(uint32_t i) const;
+    bool isFree(uint32_t i) const;
+    void setLeft(uint32_t i, uint32_t child);
+    void setRight(uint32_t i, uint32_t child);
+    void setParent(uint32_t i, uint32_t p);
+    void setBalance(uint32_t i, int b);
+    void replaceChild(uint32_t p, uint32_t oldChild, uint32_t newChild);
+    uint32_t root() const;
+
+    // Tree helpers
+    uint32_t findInsertPos(const Key& k, uint32_t& p, bool& goLeft) const;
+    void linkSlot(uint32_t n, uint32_t p, bool goLeft);
+    void unlinkSlot(uint32_t n);
+    uint32_t findIndex(const Key& k) const;
+    uint32_t lowerBoundIndex(const Key& k) const;
+    uint32_t upperBoundIndex(const Key& k) const;
+    uint32_t smallestIndex() const;
+    uint32_t largestIndex() const;
+    uint32_t successor(uint32_t i) const;
+    uint32_t predecessor(uint32_t i) const;
+    void swapWithPredecessor(uint32_t n, uint32_t pred);
+    void rotateLeft(uint32_t x);
+    void rotateRight(uint32_t x);
+    void insertFix(uint32_t p, uint32_t n);
+    void removeFix(uint32_t n, int diff);
+    TreeReport verifySlots(uint32_t used, uint64_t size) const;
+
+    Slot* slots_;
+    Compare comp_;
+};
+
+/*
+---------------------------------------------------
+Begin implementations for the IndexAVLCore class.
+---------------------------------------------------
+*/
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+IndexAVLCore<Tree, Key, Value, Compare>::IndexAVLCore(const Compare& comp) :
+    slots_(NULL),
+    comp_(comp)
+{
+
+}
+
+/**
+* Slot accessors. The item lives in raw storage, hence the cast; the
+* link fields are decoded here so the tree code reads like AVLTree's.
+*/
+template<typename Tree, typename Key, typename Value, typename Compare>
+typename IndexAVLCore<Tree, Key, Value, Compare>::Item&
+IndexAVLCore<Tree, Key, Value, Compare>::item(uint32_t i) const
+{
+    return *reinterpret_cast<Item*>(&slots_[i].item);
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+const Key& IndexAVLCore<Tree, Key, Value, Compare>::key(uint32_t i) const
+{
+    return item(i).first;
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+uint32_t IndexAVLCore<Tree, Key, Value, Compare>::left(uint32_t i) const
+{
+    return slots_[i].left;
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+uint32_t IndexAVLCore<Tree, Key, Value, Compare>::right(uint32_t i) const
+{
+    return slots_[i].right;
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+uint32_t IndexAVLCore<Tree, Key, Value, Compare>::parent(uint32_t i) const
+{
+    return slots_[i].parentBalance >> 2;
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+int IndexAVLCore<Tree, Key, Value, Compare>::balance(uint32_t i) const
+{
+    return static_cast<int>(slots_[i].parentBalance & 3) - 1;
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+bool IndexAVLCore<Tree, Key, Value, Compare>::isFree(uint32_t i) const
+{
+    return (slots_[i].parentBalance & 3) == FreeMark;
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+void IndexAVLCore<Tree, Key, Value, Compare>::setLeft(uint32_t i, uint32_t child)
+{
+    slots_[i].left = child;
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+void IndexAVLCore<Tree, Key, Value, Compare>::setRight(uint32_t i, uint32_t child)
+{
+    slots_[i].right = child;
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+void IndexAVLCore<Tree, Key, Value, Compare>::setParent(uint32_t i, uint32_t p)
+{
+    slots_[i].parentBalance = (p << 2) | (slots_[i].parentBalance & 3);
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+void IndexAVLCore<Tree, Key, Value, Compare>::setBalance(uint32_t i, int b)
+{
+    slots_[i].parentBalance = (slots_[i].parentBalance & ~3u) | static_cast<uint32_t>(b + 1);
+}
+
+/**
+* Points p (or the root, if p is Nil) at newChild where it pointed at
+* oldChild
+*/
+template<typename Tree, typename Key, typename Value, typename Compare>
+void IndexAVLCore<Tree, Key, Value, Compare>::replaceChild(uint32_t p, uint32_t oldChild, uint32_t newChild)
+{
+    if(p == Nil) {
+        static_cast<Tree*>(this)->rootLink() = newChild;
+    }
+    else if(left(p) == oldChild) {
+        setLeft(p, newChild);
+    }
+    else {
+        setRight(p, newChild);
+    }
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+uint32_t IndexAVLCore<Tree, Key, Value, Compare>::root() const
+{
+    return static_cast<const Tree*>(this)->rootLink();
+}
+
+/**
+* One descent with a single comparison per level, as in
+* BinarySearchTree::findInsertPos. Returns the slot holding k, or Nil;
+* then p and goLeft say where a slot for k would be linked in.
+*/
+template<typename Tree, typename Key, typename Value, typename Compare>
+uint32_t IndexAVLCore<Tree, Key, Value, Compare>::findInsertPos(const Key& k, uint32_t& p, bool& goLeft) const
+{
+    p = Nil;
+    goLeft = false;
+    uint32_t candidate = Nil;
+    for(uint32_t curr = root(); curr != Nil; ) {
+        p = curr;
+        goLeft = comp_(k, key(curr));
+        if(goLeft) {
+            curr = left(curr);
+        }
+        else {
+            candidate = curr;
+            curr = right(curr);
+        }
+    }
+    if(candidate != Nil && !comp_(key(candidate), k)) return candidate;
+    return Nil;
+}
+
+/**
+* Links n, a slot whose item is already built, in as the goLeft child
+* of p (or as the root, if p is Nil) and retraces
+*/
+template<typename Tree, typename Key, typename Value, typename Compare>
+void IndexAVLCore<Tree, Key, Value, Compare>::linkSlot(uint32_t n, uint32_t p, bool goLeft)
+{
+    slots_[n].left = Nil;
+    slots_[n].right = Nil;
+    slots_[n].parentBalance = (p << 2) | 1;
+
+    if(p == Nil) {
+        static_cast<Tree*>(this)->rootLink() = n;
+        return;
+    }
+    if(goLeft) {
+        setLeft(p, n);
+        setBalance(p, balance(p) - 1);
+    }
+    else {
+        setRight(p, n);
+        setBalance(p, balance(p) + 1);
+    }
+    if(balance(p) != 0) {
+        insertFix(p, n);
+    }
+}
+
+/**
+* Takes n out of the tree and rebalances; the slot itself is left to
+* the caller to free. A node with two children first trades places with
+* its predecessor, as AVLTree::remove does with nodeSwap, so that no
+* item has to move between slots.
+*/
+template<typename Tree, typename Key, typename Value, typename Compare>
+void IndexAVLCore<Tree, Key, Value, Compare>::unlinkSlot(uint32_t n)
+{
+    if(left(n) != Nil && right(n) != Nil) {
+        swapWithPredecessor(n, predecessor(n));
+    }
+
+    uint32_t p = parent(n);
+    uint32_t child = (left(n) != Nil) ? left(n) : right(n);
+    if(child != Nil) {
+        setParent(child, p);
+    }
+
+    // diff is the change to the parent's balance
+    int diff = 0;
+    if(p == Nil) {
+        static_cast<Tree*>(this)->rootLink() = child;
+    }
+    else if(n == left(p)) {
+        setLeft(p, child);
+        diff = 1;
+    }
+    else {
+        setRight(p, child);
+        diff = -1;
+    }
+    removeFix(p, diff);
+}
+
+/**
+* Moves pred, the in-order predecessor of n, into n's place in the tree
+* and n into pred's old place. pred is the rightmost node of n's left
+* subtree, so it has no right child; afterwards n has none either.
+*/
+template<typename Tree, typename Key, typename Value, typename Compare>
+void IndexAVLCore<Tree, Key, Value, Compare>::swapWithPredecessor(uint32_t n, uint32_t pred)
+{
+    uint32_t nParent = parent(n);
+    uint32_t nLeft = left(n);
+    uint32_t nRight = right(n);
+    int nBalance = balance(n);
+    uint32_t predParent = parent(pred);
+    uint32_t predLeft = left(pred);
+    int predBalance = balance(pred);
+
+    replaceChild(nParent, n, pred);
+    setParent(pred, nParent);
+    setBalance(pred, nBalance);
+    setRight(pred, nRight);
+    setParent(nRight, pred);
+    if(pred == nLeft) {
+        setLeft(pred, n);
+        setParent(n, pred);
+    }
+    else {
+        setLeft(pred, nLeft);
+        setParent(nLeft, pred);
+        setRight(predParent, n);
+        setParent(n, predParent);
+    }
+
+    setLeft(n, predLeft);
+    if(predLeft != Nil) {
+        setParent(predLeft, n);
+    }
+    setRight(n, Nil);
+    setBalance(n, predBalance);
+}
+
+/**
+* Same retrace as AVLTree::insertFix, on slot indices
+*/
+template<typename Tree, typename Key, typename Value, typename Compare>
+void IndexAVLCore<Tree, Key, Value, Compare>::insertFix(uint32_t p, uint32_t n)
+{
+    while(p != Nil) {
+        uint32_t g = parent(p);
+        if(g == Nil) return;
+
+        if(p == left(g)) {
+            int gb = balance(g) - 1;
+            if(gb != -2) {
+                setBalance(g, gb);
+                if(gb == 0) return;
+            }
+            else {
+                if(n == left(p)) {
+                    // zig-zig
+                    rotateRight(g);
+                    setBalance(p, 0);
+                    setBalance(g, 0);
+                }
+                else {
+                    // zig-zag
+                    rotateLeft(p);
+                    rotateRight(g);
+                    int nb = balance(n);
+                    setBalance(p, nb == 1 ? -1 : 0);
+                    setBalance(g, nb == -1 ? 1 : 0);
+                    setBalance(n, 0);
+                }
+                return;
+            }
+        }
+        else {
+            int gb = balance(g) + 1;
+            if(gb != 2) {
+                setBalance(g, gb);
+                if(gb == 0) return;
+            }
+            else {
+                if(n == right(p)) {
+                    // zig-zig
+                    rotateLeft(g);
+                    setBalance(p, 0);
+                    setBalance(g, 0);
+                }
+                else {
+                    // zig-zag
+                    rotateRight(p);
+                    rotateLeft(g);
+                    int nb = balance(n);
+                    setBalance(p, nb == -1 ? 1 : 0);
+                    setBalance(g, nb == 1 ? -1 : 0);
+                    setBalance(n, 0);
+                }
+                return;
+            }
+        }
+
+        // g went from 0 to +/-1: its height grew, keep going up
+        n = p;
+        p = g;
+    }
+}
+
+/**
+* Same retrace as AVLTree::removeFix, on slot indices
+*/
+template<typename Tree, typename Key, typename Value, typename Compare>
+void IndexAVLCore<Tree, Key, Value, Compare>::removeFix(uint32_t n, int diff)
+{
+    while(n != Nil) {
+        // Work out the next step before any rotation moves n
+        uint32_t p = parent(n);
+        int ndiff = 0;
+        if(p != Nil) {
+            ndiff = (n == left(p)) ? 1 : -1;
+        }
+
+        int bal = balance(n) + diff;
+
+        if(bal == 2) {
+            uint32_t c = right(n);
+            if(balance(c) == 1) {
+                // zig-zig, height shrinks
+                rotateLeft(n);
+                setBalance(n, 0);
+                setBalance(c, 0);
+            }
+            else if(balance(c) == 0) {
+                // zig-zig, height is unchanged
+                rotateLeft(n);
+                setBalance(n, 1);
+                setBalance(c, -1);
+                return;
+            }
+            else {
+                // zig-zag, height shrinks
+                uint32_t g = left(c);
+                rotateRight(c);
+                rotateLeft(n);
+                int gb = balance(g);
+                setBalance(n, gb == 1 ? -1 : 0);
+                setBalance(c, gb == -1 ? 1 : 0);
+                setBalance(g, 0);
+            }
+        }
+        else if(bal == -2) {
+            uint32_t c = left(n);
+            if(balance(c) == -1) {
+                rotateRight(n);
+                setBalance(n, 0);
+                setBalance(c, 0);
+            }
+            else if(balance(c) == 0) {
+                rotateRight(n);
+                setBalance(n, -1);
+                setBalance(c, 1);
+                return;
+            }
+            else {
+                uint32_t g = right(c);
+                rotateLeft(c);
+                rotateRight(n);
+                int gb = balance(g);
+                setBalance(n, gb == -1 ? 1 : 0);
+                setBalance(c, gb == 1 ? -1 : 0);
+                setBalance(g, 0);
+            }
+        }
+        else if(bal != 0) {
+            // n went from 0 to +/-1: its height is unchanged
+            setBalance(n, bal);
+            return;
+        }
+        else {
+            setBalance(n, 0);
+        }
+
+        n = p;
+        diff = ndiff;
+    }
+}
+
+/**
+* Rotations only relink; the callers set the resulting balances.
+*/
+template<typename Tree, typename Key, typename Value, typename Compare>
+void IndexAVLCore<Tree, Key, Value, Compare>::rotateLeft(uint32_t x)
+{
+    uint32_t y = right(x);
+    uint32_t p = parent(x);
+    uint32_t b = left(y);
+
+    replaceChild(p, x, y);
+    setParent(y, p);
+    setLeft(y, x);
+    setParent(x, y);
+    setRight(x, b);
+    if(b != Nil) {
+        setParent(b, x);
+    }
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+void IndexAVLCore<Tree, Key, Value, Compare>::rotateRight(uint32_t x)
+{
+    uint32_t y = left(x);
+    uint32_t p = parent(x);
+    uint32_t b = right(y);
+
+    replaceChild(p, x, y);
+    setParent(y, p);
+    setRight(y, x);
+    setParent(x, y);
+    setLeft(x, b);
+    if(b != Nil) {
+        setParent(b, x);
+    }
+}
+
+/**
+* Returns the slot of the smallest key not less than k, or Nil
+*/
+template<typename Tree, typename Key, typename Value, typename Compare>
+uint32_t IndexAVLCore<Tree, Key, Value, Compare>::lowerBoundIndex(const Key& k) const
+{
+    uint32_t best = Nil;
+    for(uint32_t curr = root(); curr != Nil; ) {
+        if(comp_(key(curr), k)) {
+            curr = right(curr);
+        }
+        else {
+            best = curr;
+            curr = left(curr);
+        }
+    }
+    return best;
+}
+
+/**
+* Returns the slot of the smallest key greater than k, or Nil
+*/
+template<typename Tree, typename Key, typename Value, typename Compare>
+uint32_t IndexAVLCore<Tree, Key, Value, Compare>::upperBoundIndex(const Key& k) const
+{
+    uint32_t best = Nil;
+    for(uint32_t curr = root(); curr != Nil; ) {
+        if(comp_(k, key(curr))) {
+            best = curr;
+            curr = left(curr);
+        }
+        else {
+            curr = right(curr);
+        }
+    }
+    return best;
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+uint32_t IndexAVLCore<Tree, Key, Value, Compare>::findIndex(const Key& k) const
+{
+    uint32_t i = lowerBoundIndex(k);
+    if(i != Nil && !comp_(k, key(i))) return i;
+    return Nil;
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+uint32_t IndexAVLCore<Tree, Key, Value, Compare>::smallestIndex() const
+{
+    uint32_t curr = root();
+    if(curr == Nil) return Nil;
+    while(left(curr) != Nil) curr = left(curr);
+    return curr;
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+uint32_t IndexAVLCore<Tree, Key, Value, Compare>::largestIndex() const
+{
+    uint32_t curr = root();
+    if(curr == Nil) return Nil;
+    while(right(curr) != Nil) curr = right(curr);
+    return curr;
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+uint32_t IndexAVLCore<Tree, Key, Value, Compare>::successor(uint32_t i) const
+{
+    if(i == Nil) return Nil;
+    if(right(i) != Nil) {
+        uint32_t curr = right(i);
+        while(left(curr) != Nil) curr = left(curr);
+        return curr;
+    }
+    uint32_t p = parent(i);
+    while(p != Nil && i == right(p)) {
+        i = p;
+        p = parent(p);
+    }
+    return p;
+}
+
+template<typename Tree, typename Key, typename Value, typename Compare>
+uint32_t IndexAVLCore<Tree, Key, Value, Compare>::predecessor(uint32_t i) const
+{
+    if(i == Nil) return Nil;
+    if(left(i) != Nil) {
+        uint32_t curr = left(i);
+        while(right(curr) != Nil) curr = right(curr);
+        return curr;
+    }
+    uint32_t p = parent(i);
+    while(p != Nil && i == left(p)) {
+        i = p;
+        p = parent(p);
+    }
+    return p;
+}
+
+/**
+* Checks links, key order, node count and stored balance factors in one
+* iterative pass, like BinarySearchTree::verify(), and that every link
+* stays inside the first used slots, the ones ever handed out
+*/
+template<typename Tree, typename Key, typename Value, typename Compare>
+TreeReport IndexAVLCore<Tree, Key, Value, Compare>::verifySlots(uint32_t used, uint64_t size) const
+{
+    struct Frame
+    {
+        uint32_t node;
+        int leftHeight;
+        int stage;  // 0: not visited, 1: left subtree done, 2: right subtree done
+    };
+
+    TreeReport report;
+    uint32_t top = root();
+    if(top != Nil && (top >= used || parent(top) != Nil)) {
+        report.valid = false;
+        report.error = "root is out of range or has a non-null parent";
+        return report;
+    }
+
+    std::vector<Frame> stack;
+    if(top != Nil) {
+        Frame first = { top, 0, 0 };
+        stack.push_back(first);
+    }
+    uint32_t prev = Nil;
+    int childHeight = 0;
+
+    while(!stack.empty()) {
+        uint32_t node = stack.back().node;
+        uint32_t l = left(node);
+        uint32_t r = right(node);
+
+        if(stack.back().stage == 0) {
+            ++report.nodeCount;
+            if((l != Nil && l >= used) || (r != Nil && r >= used) || report.nodeCount > used) {
+                report.valid = false;
+                report.error = "link points outside the slots in use";
+                return report;
+            }
+            if(isFree(node) || (l != Nil && l == r) ||
+               (l != Nil && parent(l) != node) || (r != Nil && parent(r) != node)) {
+                report.valid = false;
+                report.error = "child's parent link does not point back to its parent";
+                return report;
+            }
+            stack.back().stage = 1;
+            if(l != Nil) {
+                Frame f = { l, 0, 0 };
+                stack.push_back(f);
+                continue;
+            }
+            childHeight = 0;
+        }
+
+        if(stack.back().stage == 1) {
+            stack.back().leftHeight = childHeight;
+            if(prev != Nil && !comp_(key(prev), key(node))) {
+                report.valid = false;
+                report.error = "keys are not in strictly increasing order";
+                return report;
+            }
+            prev = node;
+            stack.back().stage = 2;
+            if(r != Nil) {
+                Frame f = { r, 0, 0 };
+                stack.push_back(f);
+                continue;
+            }
+            childHeight = 0;
+        }
+
+        int lh = stack.back().leftHeight;
+        int rh = childHeight;
+        if(balance(node) != rh - lh) {
+            report.valid = false;
+            report.error = "stored balance factor does not match subtree heights";
+            return report;
+        }
+        if(std::abs(lh - rh) > 1) {
+            report.balanced = false;
+            report.valid = false;
+            report.error = "subtree heights differ by more than one";
+            return report;
+        }
+        childHeight = 1 + std::max(lh, rh);
+        stack.pop_back();
+    }
+
+    if(report.nodeCount != size) {
+        report.valid = false;
+        report.error = "node count does not match size()";
+        return report;
+    }
+    report.height = childHeight;
+    return report;
+}
+
+/*
+-------------------------------------------------
+End implementations for the IndexAVLCore class.
+-------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,762 @@
+#ifndef MAPPEDAVL_H
+#define MAPPEDAVL_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bst.h"
+#include "indexavl.h"
+
+/**
+* An AVL tree whose nodes live in a memory-mapped file. Nodes link to
+* each other by 32-bit slot indices, i.e. offsets from the start of the
+* node area, rather than pointers, so the file means the same wherever
+* it is mapped. Opening an existing file maps it and is done: find()
+* and iteration work at once, and the pages a search touches are read
+* in by the OS as they are first used. Nothing is deserialized.
+*
+* The nodes are IndexAVLCore slots, as in CompactAVLTree (item plus 12
+* bytes of links and balance), and the tree algorithms are the core's.
+* They sit behind a file header holding the root, the free list and
+* the counts. Keys and values must be trivially copyable, since their
+* bytes are the file contents; the file is tied to the key and value
+* types and to the byte order it was written with.
+*
+* Changes are made in place in the mapping. flush() writes them back
+* with msync() and marks the file clean; the destructor flushes too.
+* A file that was changed and not flushed, e.g. after a crash, may have
+* been left inconsistent by an interrupted rotation. It is refused
+* read-write, but can still be opened ReadOnly if verify() passes on
+* it, so its items can be read out and written to a new tree. One
+* process may have a file open read-write, or any number read-only (an
+* flock() lock on the file).
+*
+* Values are only changed through insert(), so iterators and lookup()
+* are read-only. Growing the file remaps it, which moves the items:
+* iterators stay valid, as they hold a slot index, but pointers from
+* lookup() are only stable after reserve().
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class MappedAVLTree : public IndexAVLCore<MappedAVLTree<Key, Value, Compare>, Key, Value, Compare>
+{
+    typedef IndexAVLCore<MappedAVLTree<Key, Value, Compare>, Key, Value, Compare> Core;
+    friend class IndexAVLCore<MappedAVLTree<Key, Value, Compare>, Key, Value, Compare>;
+    typedef typename Core::Item Item;
+    typedef typename Core::Slot Slot;
+    using Core::Nil;
+    using Core::FreeMark;
+
+public:
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "MappedAVLTree stores its items as raw bytes in the file");
+
+    enum OpenMode { ReadWrite, ReadOnly };
+
+    explicit MappedAVLTree(const std::string& path, OpenMode mode = ReadWrite, const Compare& comp = Compare());
+    MappedAVLTree(const MappedAVLTree&) = delete;
+    MappedAVLTree& operator=(const MappedAVLTree&) = delete;
+    ~MappedAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    template<typename ForwardIt>
+    void insert(ForwardIt first, ForwardIt last);
+    void remove(const Key& key);
+    void clear();
+    void reserve(size_t n);
+    void flush();
+    size_t capacity() const;
+    bool empty() const;
+    size_t size() const;
+    size_t fileBytes() const;
+    bool isBalanced() const;
+    TreeReport verify() const;
+
+    /**
+    * A read-only bidirectional iterator over the items in key order.
+    * --end() reaches the largest item.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key,Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        const_iterator();
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class MappedAVLTree<Key, Value, Compare>;
+        const_iterator(uint32_t index, const MappedAVLTree* tree);
+        uint32_t index_;
+        const MappedAVLTree* tree_;
+    };
+
+    typedef const_iterator iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+    typedef const_reverse_iterator reverse_iterator;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+
+    const_iterator find(const Key& key) const;
+    bool contains(const Key& key) const;
+    const Value* lookup(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    const_iterator upper_bound(const Key& key) const;
+    Compare key_comp() const;
+
+private:
+    /**
+    * The start of the file. The slots follow at HeaderBytes; the file
+    * is HeaderBytes + capacity * slotSize bytes long.
+    */
+    struct FileHeader
+    {
+        static const uint32_t Version = 1;
+        static const uint32_t ByteOrderMark = 0x01020304;
+
+        char magic[4];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint32_t keySize;
+        uint32_t valueSize;
+        uint32_t slotSize;
+        uint32_t capacity;
+        uint32_t used;       // slots ever handed out; later ones are untouched
+        uint32_t freeList;
+        uint32_t root;
+        uint32_t dirty;      // changed since the last flush()
+        uint32_t reserved;
+        uint64_t size;
+    };
+
+    static const size_t HeaderBytes = (sizeof(FileHeader) + alignof(Slot) + 63) / 64 * 64;
+    static const uint32_t InitialCapacity = 16;
+
+    using Core::item;
+    using Core::key;
+    using Core::left;
+    using Core::findInsertPos;
+    using Core::linkSlot;
+    using Core::unlinkSlot;
+    using Core::findIndex;
+    using Core::lowerBoundIndex;
+    using Core::upperBoundIndex;
+    using Core::smallestIndex;
+    using Core::largestIndex;
+    using Core::successor;
+    using Core::predecessor;
+    using Core::slots_;
+    using Core::comp_;
+
+    uint32_t& rootLink();
+    uint32_t rootLink() const;
+
+    // File management
+    void openFile(const std::string& path);
+    void initializeHeader();
+    void checkHeader(uint64_t fileBytes) const;
+    void mapFile(size_t bytes);
+    void markDirty();
+    void syncRange(void* start, size_t bytes);
+    static std::system_error fileError(const char* what);
+
+    // Pool management
+    uint32_t allocateSlot();
+    void freeSlot(uint32_t i);
+    void grow(size_t newCapacity);
+
+    int fd_;
+    bool readOnly_;
+    char* base_;         // the mapping; the header is at its start
+    size_t mappedBytes_;
+    FileHeader* header_;
+};
+
+/*
+-------------------------------------------------------------------
+Begin implementations for the MappedAVLTree::const_iterator class.
+-------------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+MappedAVLTree<Key, Value, Compare>::const_iterator::const_iterator(uint32_t index, const MappedAVLTree* tree)
+{
+    index_ = index;
+    tree_ = tree;
+}
+
+template<typename Key, typename Value, typename Compare>
+MappedAVLTree<Key, Value, Compare>::const_iterator::const_iterator()
+{
+    index_ = Nil;
+    tree_ = NULL;
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<const Key,Value> &
+MappedAVLTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return tree_->item(index_);
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<const Key,Value> *
+MappedAVLTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return &(tree_->item(index_));
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MappedAVLTree<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return index_ == rhs.index_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MappedAVLTree<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return index_ != rhs.index_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedAVLTree<Key, Value, Compare>::const_iterator&
+MappedAVLTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    index_ = tree_->successor(index_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedAVLTree<Key, Value, Compare>::const_iterator
+MappedAVLTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Moves back one item; decrementing the end iterator moves it to the
+* largest item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename MappedAVLTree<Key, Value, Compare>::const_iterator&
+MappedAVLTree<Key, Value, Compare>::const_iterator::operator--()
+{
+    index_ = (index_ == Nil) ? tree_->largestIndex() : tree_->predecessor(index_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedAVLTree<Key, Value, Compare>::const_iterator
+MappedAVLTree<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+-----------------------------------------------------------------
+End implementations for the MappedAVLTree::const_iterator class.
+-----------------------------------------------------------------
+*/
+
+/*
+----------------------------------------------------
+Begin implementations for the MappedAVLTree class.
+----------------------------------------------------
+*/
+
+/**
+* Opens the tree stored at path, creating an empty one if the file does
+* not exist (read-write only). Throws std::system_error if the file
+* cannot be opened, locked or mapped, and std::runtime_error if it is
+* not a tree file for these key and value types, its header is corrupt,
+* or it was not flushed after its last change and is opened read-write
+* or fails verify().
+*/
+template<typename Key, typename Value, typename Compare>
+MappedAVLTree<Key, Value, Compare>::MappedAVLTree(const std::string& path, OpenMode mode, const Compare& comp) :
+    Core(comp),
+    fd_(-1),
+    readOnly_(mode == ReadOnly),
+    base_(NULL),
+    mappedBytes_(0),
+    header_(NULL)
+{
+    try {
+        openFile(path);
+    }
+    catch(...) {
+        if(base_ != NULL) ::munmap(base_, mappedBytes_);
+        if(fd_ >= 0) ::close(fd_);
+        throw;
+    }
+}
+
+/**
+* Flushes unless read-only; errors are lost here, so callers that
+* care call flush() first
+*/
+template<typename Key, typename Value, typename Compare>
+MappedAVLTree<Key, Value, Compare>::~MappedAVLTree()
+{
+    try {
+        if(!readOnly_) flush();
+    }
+    catch(...) {
+    }
+    ::munmap(base_, mappedBytes_);
+    ::close(fd_);
+}
+
+template<typename Key, typename Value, typename Compare>
+void MappedAVLTree<Key, Value, Compare>::openFile(const std::string& path)
+{
+    fd_ = readOnly_ ? ::open(path.c_str(), O_RDONLY) : ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd_ < 0) throw fileError("MappedAVLTree: cannot open the file");
+    if(::flock(fd_, (readOnly_ ? LOCK_SH : LOCK_EX) | LOCK_NB) != 0) {
+        throw fileError("MappedAVLTree: the file is in use");
+    }
+
+    struct stat info;
+    if(::fstat(fd_, &info) != 0) throw fileError("MappedAVLTree: cannot stat the file");
+    if(info.st_size == 0 && !readOnly_) {
+        initializeHeader();
+        return;
+    }
+    if(static_cast<uint64_t>(info.st_size) < HeaderBytes) {
+        throw std::runtime_error("MappedAVLTree: not a mapped tree file");
+    }
+    mapFile(static_cast<size_t>(info.st_size));
+    checkHeader(static_cast<uint64_t>(info.st_size));
+}
+
+/**
+* Sizes a new file for InitialCapacity slots and writes its header
+*/
+template<typename Key, typename Value, typename Compare>
+void MappedAVLTree<Key, Value, Compare>::initializeHeader()
+{
+    size_t bytes = HeaderBytes + InitialCapacity * sizeof(Slot);
+    if(::ftruncate(fd_, static_cast<off_t>(bytes)) != 0) throw fileError("MappedAVLTree: cannot size the file");
+    mapFile(bytes);
+
+    std::memcpy(header_->magic, "AVLM", sizeof(header_->magic));
+    header_->version = FileHeader::Version;
+    header_->byteOrder = FileHeader::ByteOrderMark;
+    header_->keySize = sizeof(Key);
+    header_->valueSize = sizeof(Value);
+    header_->slotSize = sizeof(Slot);
+    header_->capacity = InitialCapacity;
+    header_->used = 0;
+    header_->freeList = Nil;
+    header_->root = Nil;
+    header_->dirty = 0;
+    header_->reserved = 0;
+    header_->size = 0;
+    syncRange(base_, mappedBytes_);
+}
+
+/**
+* Rejects a file this tree cannot safely map: a foreign or truncated
+* one, or one whose root or free list points past the slots in use.
+* A dirty file is only accepted read-only, and only if the tree in it
+* verifies; verify() keeps to the slots in use, so it is safe to run on
+* a damaged file.
+*/
+template<typename Key, typename Value, typename Compare>
+void MappedAVLTree<Key, Value, Compare>::checkHeader(uint64_t fileBytes) const
+{
+    if(std::memcmp(header_->magic, "AVLM", sizeof(header_->magic)) != 0) {
+        throw std::runtime_error("MappedAVLTree: not a mapped tree file");
+    }
+    if(header_->version != FileHeader::Version || header_->byteOrder != FileHeader::ByteOrderMark) {
+        throw std::runtime_error("MappedAVLTree: unsupported file version or byte order");
+    }
+    if(header_->keySize != sizeof(Key) || header_->valueSize != sizeof(Value) || header_->slotSize != sizeof(Slot)) {
+        throw std::runtime_error("MappedAVLTree: file was written for another key/value type");
+    }
+    if(header_->capacity > Nil - 1 || header_->used > header_->capacity ||
+       fileBytes < HeaderBytes + static_cast<uint64_t>(header_->capacity) * sizeof(Slot)) {
+        throw std::runtime_error("MappedAVLTree: file is cut short");
+    }
+    if((header_->root != Nil && header_->root >= header_->used) ||
+       (header_->freeList != Nil && header_->freeList >= header_->used)) {
+        throw std::runtime_error("MappedAVLTree: file header is corrupt");
+    }
+    if(header_->dirty != 0) {
+        if(!readOnly_) {
+            throw std::runtime_error("MappedAVLTree: file was not flushed after its last change and may be "
+                                     "inconsistent; it can only be opened read-only");
+        }
+        TreeReport report = verify();
+        if(!report.valid) {
+            throw std::runtime_error("MappedAVLTree: file was not flushed after its last change and is "
+                                     "inconsistent: " + report.error);
+        }
+    }
+}
+
+/**
+* Maps the first bytes of the file in place of any earlier mapping. The
+* new mapping is made before the old one goes, so a failure leaves the
+* tree as it was.
+*/
+template<typename Key, typename Value, typename Compare>
+void MappedAVLTree<Key, Value, Compare>::mapFile(size_t bytes)
+{
+    int protection = readOnly_ ? PROT_READ : PROT_READ | PROT_WRITE;
+    void* mapped = ::mmap(NULL, bytes, protection, MAP_SHARED, fd_, 0);
+    if(mapped == MAP_FAILED) throw fileError("MappedAVLTree: cannot map the file");
+    if(base_ != NULL) ::munmap(base_, mappedBytes_);
+    base_ = static_cast<char*>(mapped);
+    mappedBytes_ = bytes;
+    header_ = reinterpret_cast<FileHeader*>(base_);
+    slots_ = reinterpret_cast<Slot*>(base_ + HeaderBytes);
+}
+
+/**
+* Called before every change. The first change after a flush sets the
+* dirty flag and syncs the header before anything else is written, so
+* a file with half-written changes on disk is always marked as such.
+*/
+template<typename Key, typename Value, typename Compare>
+void MappedAVLTree<Key, Value, Compare>::markDirty()
+{
+    if(readOnly_) throw std::logic_error("MappedAVLTree: the tree was opened read-only");
+    if(header_->dirty != 0) return;
+    header_->dirty = 1;
+    syncRange(base_, HeaderBytes);
+}
+
+template<typename Key, typename Value, typename Compare>
+void MappedAVLTree<Key, Value, Compare>::syncRange(void* start, size_t bytes)
+{
+    if(::msync(start, bytes, MS_SYNC) != 0) throw fileError("MappedAVLTree: msync failed");
+}
+
+template<typename Key, typename Value, typename Compare>
+std::system_error MappedAVLTree<Key, Value, Compare>::fileError(const char* what)
+{
+    return std::system_error(errno, std::generic_category(), what);
+}
+
+/**
+* Writes every change since the last flush back to the file, waiting
+* for the writes to finish, then marks the file clean. Throws
+* std::system_error if the writes fail; the file then stays dirty.
+*/
+template<typename Key, typename Value, typename Compare>
+void MappedAVLTree<Key, Value, Compare>::flush()
+{
+    if(readOnly_ || header_->dirty == 0) return;
+    syncRange(base_, mappedBytes_);
+    header_->dirty = 0;
+    syncRange(base_, HeaderBytes);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MappedAVLTree<Key, Value, Compare>::empty() const
+{
+    return header_->size == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+size_t MappedAVLTree<Key, Value, Compare>::size() const
+{
+    return static_cast<size_t>(header_->size);
+}
+
+/**
+* The number of nodes the file can hold before it has to grow
+*/
+template<typename Key, typename Value, typename Compare>
+size_t MappedAVLTree<Key, Value, Compare>::capacity() const
+{
+    return header_->capacity;
+}
+
+/**
+* The size of the mapped file, header included
+*/
+template<typename Key, typename Value, typename Compare>
+size_t MappedAVLTree<Key, Value, Compare>::fileBytes() const
+{
+    return mappedBytes_;
+}
+
+template<typename Key, typename Value, typename Compare>
+Compare MappedAVLTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Grows the file to hold at least n nodes. Afterwards inserts do not
+* remap it until the tree holds more than n.
+*/
+template<typename Key, typename Value, typename Compare>
+void MappedAVLTree<Key, Value, Compare>::reserve(size_t n)
+{
+    if(n > header_->capacity) {
+        markDirty();
+        grow(n);
+    }
+}
+
+/**
+* Empties the tree. The file keeps its size for reuse, like
+* CompactAVLTree::clear.
+*/
+template<typename Key, typename Value, typename Compare>
+void MappedAVLTree<Key, Value, Compare>::clear()
+{
+    markDirty();
+    header_->used = 0;
+    header_->freeList = Nil;
+    header_->root = Nil;
+    header_->size = 0;
+}
+
+/**
+* The root link, kept in the file header, for IndexAVLCore
+*/
+template<typename Key, typename Value, typename Compare>
+uint32_t& MappedAVLTree<Key, Value, Compare>::rootLink()
+{
+    return header_->root;
+}
+
+template<typename Key, typename Value, typename Compare>
+uint32_t MappedAVLTree<Key, Value, Compare>::rootLink() const
+{
+    return header_->root;
+}
+
+/**
+* Hands out a slot from the free list, or else the next untouched
+* slot, doubling the file when it is full.
+*/
+template<typename Key, typename Value, typename Compare>
+uint32_t MappedAVLTree<Key, Value, Compare>::allocateSlot()
+{
+    if(header_->freeList != Nil) {
+        uint32_t i = header_->freeList;
+        uint32_t next = left(i);
+        if(next != Nil && next >= header_->used) throw std::runtime_error("MappedAVLTree: free list is corrupt");
+        header_->freeList = next;
+        return i;
+    }
+    if(header_->used == header_->capacity) {
+        if(header_->capacity >= Nil - 1) {
+            throw std::length_error("MappedAVLTree: too many nodes for 30-bit links");
+        }
+        grow(static_cast<size_t>(header_->capacity) * 2);
+    }
+    return header_->used++;
+}
+
+template<typename Key, typename Value, typename Compare>
+void MappedAVLTree<Key, Value, Compare>::freeSlot(uint32_t i)
+{
+    slots_[i].left = header_->freeList;
+    slots_[i].parentBalance = FreeMark;
+    header_->freeList = i;
+}
+
+/**
+* Extends the file and maps it again. Slots are addressed by index, so
+* nothing in the file changes but the capacity; a failure leaves the
+* tree as it was.
+*/
+template<typename Key, typename Value, typename Compare>
+void MappedAVLTree<Key, Value, Compare>::grow(size_t newCapacity)
+{
+    if(newCapacity > Nil - 1) newCapacity = Nil - 1;
+    size_t bytes = HeaderBytes + newCapacity * sizeof(Slot);
+    if(::ftruncate(fd_, static_cast<off_t>(bytes)) != 0) throw fileError("MappedAVLTree: cannot grow the file");
+    mapFile(bytes);
+    header_->capacity = static_cast<uint32_t>(newCapacity);
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present
+*/
+template<typename Key, typename Value, typename Compare>
+void MappedAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    uint32_t p;
+    bool goLeft;
+    uint32_t existing = findInsertPos(keyValuePair.first, p, goLeft);
+    markDirty();
+    if(existing != Nil) {
+        item(existing).second = keyValuePair.second; // overwrite value
+        return;
+    }
+
+    uint32_t n = allocateSlot();
+    ::new(static_cast<void*>(&slots_[n].item)) Item(keyValuePair);
+    ++header_->size;
+    linkSlot(n, p, goLeft);
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename ForwardIt>
+void MappedAVLTree<Key, Value, Compare>::insert(ForwardIt first, ForwardIt last)
+{
+    for(; first != last; ++first) insert(*first);
+}
+
+/**
+* Removes the key if present
+*/
+template<typename Key, typename Value, typename Compare>
+void MappedAVLTree<Key, Value, Compare>::remove(const Key& k)
+{
+    uint32_t n = findIndex(k);
+    if(n == Nil) return;
+    markDirty();
+    unlinkSlot(n);
+    freeSlot(n);
+    --header_->size;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedAVLTree<Key, Value, Compare>::const_iterator
+MappedAVLTree<Key, Value, Compare>::find(const Key& k) const
+{
+    return const_iterator(findIndex(k), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MappedAVLTree<Key, Value, Compare>::contains(const Key& k) const
+{
+    return findIndex(k) != Nil;
+}
+
+/**
+* Returns a pointer to the value stored under k, or NULL if k is not in
+* the tree
+*/
+template<typename Key, typename Value, typename Compare>
+const Value* MappedAVLTree<Key, Value, Compare>::lookup(const Key& k) const
+{
+    uint32_t i = findIndex(k);
+    return i == Nil ? NULL : &item(i).second;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedAVLTree<Key, Value, Compare>::const_iterator
+MappedAVLTree<Key, Value, Compare>::lower_bound(const Key& k) const
+{
+    return const_iterator(lowerBoundIndex(k), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedAVLTree<Key, Value, Compare>::const_iterator
+MappedAVLTree<Key, Value, Compare>::upper_bound(const Key& k) const
+{
+    return const_iterator(upperBoundIndex(k), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedAVLTree<Key, Value, Compare>::const_iterator
+MappedAVLTree<Key, Value, Compare>::begin() const
+{
+    return const_iterator(smallestIndex(), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedAVLTree<Key, Value, Compare>::const_iterator
+MappedAVLTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(Nil, this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedAVLTree<Key, Value, Compare>::const_iterator
+MappedAVLTree<Key, Value, Compare>::cbegin() const
+{
+    return begin();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedAVLTree<Key, Value, Compare>::const_iterator
+MappedAVLTree<Key, Value, Compare>::cend() const
+{
+    return end();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedAVLTree<Key, Value, Compare>::const_reverse_iterator
+MappedAVLTree<Key, Value, Compare>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedAVLTree<Key, Value, Compare>::const_reverse_iterator
+MappedAVLTree<Key, Value, Compare>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MappedAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return verify().balanced;
+}
+
+/**
+* Checks links, key order, node count and stored balance factors, and
+* that every link stays inside the slots handed out, as
+* IndexAVLCore::verifySlots does
+*/
+template<typename Key, typename Value, typename Compare>
+TreeReport MappedAVLTree<Key, Value, Compare>::verify() const
+{
+    return this->verifySlots(header_->used, header_->size);
+}
+
+/*
+--------------------------------------------------
+End implementations for the MappedAVLTree class.
+--------------------------------------------------
+*/
+
+#endif
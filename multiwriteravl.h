@@ -0,0 +1,1072 @@
+#ifndef MULTIWRITERAVL_H
+#define MULTIWRITERAVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include "bst.h"
+#include "nodereclaimer.h"
+
+/**
+* A relaxed-balance AVL tree that any number of threads can read and
+* write at once, after Bronson, Casper, Chafi and Olukotun, "A Practical
+* Concurrent Binary Search Tree" (PPoPP 2010).
+*
+* Every node has its own lock and a version number. Searches, including
+* the descent of an insert or remove, take no locks: they check each
+* node's version before and after reading its child, and back up when a
+* rotation shrank the node's key range in between. Only the nodes a
+* change touches are locked, always parent before child, so writes in
+* different subtrees run in parallel and cannot deadlock.
+*
+* Removing a key with two children only clears its value, leaving a
+* routing node that is unlinked later, once it has at most one child.
+* Heights are repaired, and rotations done, bottom up after each change,
+* one locked node pair at a time. Other threads may briefly see the tree
+* out of balance, but once they are all done it is a proper AVL tree.
+*
+* find/contains, insert and remove are linearizable. Unlinked nodes and
+* replaced values are retired through NodeReclaimer, so a search never
+* touches freed memory. size() is exact only when no write is running,
+* and verify() must only be called then.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class MultiWriterAVLTree
+{
+public:
+    MultiWriterAVLTree();
+    explicit MultiWriterAVLTree(const Compare& comp);
+    MultiWriterAVLTree(const MultiWriterAVLTree&) = delete;
+    MultiWriterAVLTree& operator=(const MultiWriterAVLTree&) = delete;
+    ~MultiWriterAVLTree();
+
+    bool insert(const std::pair<const Key, Value>& keyValuePair);
+    bool remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    size_t size() const;
+    bool empty() const;
+    TreeReport verify() const;
+
+    // Retired nodes and values are freed in batches of this many
+    static const size_t RetireBatch = 256;
+
+private:
+    struct Node
+    {
+        Node();
+        Node(const Key& key, Value* value, Node* parent);
+        ~Node();
+        const Key& key() const;
+
+        typename std::aligned_storage<sizeof(Key), alignof(Key)>::type keyStorage;
+        bool hasKey;  // false only for the holder above the root
+        std::atomic<uint64_t> version;
+        std::atomic<int> height;
+        std::atomic<Value*> value;  // NULL in a routing node
+        std::atomic<Node*> parent;
+        std::atomic<Node*> left;
+        std::atomic<Node*> right;
+        std::mutex lock;
+    };
+
+    // Version bits. A node's version changes only when its key range
+    // shrinks (Shrinking is set meanwhile) or when it is unlinked.
+    static const uint64_t Unlinked = 1;
+    static const uint64_t Shrinking = 2;
+    static const uint64_t VersionStep = 4;
+
+    // Outcomes of an attempt, which the caller retries from higher up
+    enum Outcome { Retry, Missing, Present };
+
+    // What nodeCondition() asks for, besides a new height
+    static const int NothingRequired = -1;
+    static const int RebalanceRequired = -2;
+    static const int UnlinkRequired = -3;
+
+    typedef std::lock_guard<std::mutex> Lock;
+
+    int compare(const Key& a, const Key& b) const;
+    static std::atomic<Node*>& child(Node* node, int dir);
+    static int height(Node* node);
+    static bool isChanging(uint64_t version);
+    static void waitUntilNotChanging(Node* node);
+    static uint64_t beginChange(uint64_t version);
+    static uint64_t endChange(uint64_t version);
+
+    Value* get(const Key& key) const;
+    bool attemptGet(const Key& key, Node* node, int dir, uint64_t nodeVersion, Value*& result) const;
+    bool put(const Key& key, Value* fresh);
+    Outcome attemptPut(const Key& key, Value* fresh, Node* node, uint64_t nodeVersion);
+    Outcome attemptNodePut(Value* fresh, Node* node);
+    bool erase(const Key& key);
+    Outcome attemptRemove(const Key& key, Node* parent, Node* node, uint64_t nodeVersion);
+    Outcome attemptRemoveNode(Node* parent, Node* node);
+    bool attemptUnlink(Node* parent, Node* node);
+
+    void fixHeightAndRebalance(Node* node);
+    static int nodeCondition(Node* node);
+    static Node* fixHeight(Node* node);
+    Node* rebalanceNode(Node* parent, Node* n);
+    Node* rebalanceToRight(Node* parent, Node* n, Node* nL, int hR0);
+    Node* rebalanceToLeft(Node* parent, Node* n, Node* nR, int hL0);
+    static Node* rotateRight(Node* parent, Node* n, Node* nL, int hR, int hLL, Node* nLR, int hLR);
+    static Node* rotateLeft(Node* parent, Node* n, int hL, Node* nR, Node* nRL, int hRL, int hRR);
+    static Node* rotateRightOverLeft(Node* parent, Node* n, Node* nL, int hR, int hLL, Node* nLR, int hLRL);
+    static Node* rotateLeftOverRight(Node* parent, Node* n, int hL, Node* nR, Node* nRL, int hRR, int hRLR);
+
+    void retireNode(Node* node);
+    void retireValue(Value* value);
+    void reclaimIfDue();
+    static void disposeNode(void* p);
+    static void disposeValue(void* p);
+    static void destroySubtree(Node* node);
+
+    // Declared first so that it outlives everything retired into it
+    mutable NodeReclaimer reclaimer_;
+    Node* holder_;  // its right child is the root
+    std::atomic<std::ptrdiff_t> size_;
+    Compare comp_;
+};
+
+/*
+------------------------------------------------------------
+Begin implementations for the MultiWriterAVLTree::Node class.
+------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+MultiWriterAVLTree<Key, Value, Compare>::Node::Node() :
+    hasKey(false),
+    version(0),
+    height(1),
+    value(NULL),
+    parent(NULL),
+    left(NULL),
+    right(NULL)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+MultiWriterAVLTree<Key, Value, Compare>::Node::Node(const Key& key, Value* value, Node* parent) :
+    hasKey(true),
+    version(0),
+    height(1),
+    value(value),
+    parent(parent),
+    left(NULL),
+    right(NULL)
+{
+    ::new(static_cast<void*>(&keyStorage)) Key(key);
+}
+
+/**
+* Destroys the key; the value is owned and freed separately
+*/
+template<typename Key, typename Value, typename Compare>
+MultiWriterAVLTree<Key, Value, Compare>::Node::~Node()
+{
+    if(hasKey) reinterpret_cast<Key*>(&keyStorage)->~Key();
+}
+
+template<typename Key, typename Value, typename Compare>
+const Key& MultiWriterAVLTree<Key, Value, Compare>::Node::key() const
+{
+    return *reinterpret_cast<const Key*>(&keyStorage);
+}
+
+/*
+----------------------------------------------------------
+End implementations for the MultiWriterAVLTree::Node class.
+----------------------------------------------------------
+*/
+
+/*
+-------------------------------------------------------
+Begin implementations for the MultiWriterAVLTree class.
+-------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+MultiWriterAVLTree<Key, Value, Compare>::MultiWriterAVLTree() :
+    holder_(new Node()),
+    size_(0)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+MultiWriterAVLTree<Key, Value, Compare>::MultiWriterAVLTree(const Compare& comp) :
+    holder_(new Node()),
+    size_(0),
+    comp_(comp)
+{
+
+}
+
+/**
+* No other thread may still be using the tree
+*/
+template<typename Key, typename Value, typename Compare>
+MultiWriterAVLTree<Key, Value, Compare>::~MultiWriterAVLTree()
+{
+    destroySubtree(holder_->right.load());
+    delete holder_;
+}
+
+template<typename Key, typename Value, typename Compare>
+void MultiWriterAVLTree<Key, Value, Compare>::destroySubtree(Node* node)
+{
+    if(node == NULL) return;
+    destroySubtree(node->left.load());
+    destroySubtree(node->right.load());
+    delete node->value.load();
+    delete node;
+}
+
+template<typename Key, typename Value, typename Compare>
+size_t MultiWriterAVLTree<Key, Value, Compare>::size() const
+{
+    std::ptrdiff_t n = size_.load();
+    return n < 0 ? 0 : static_cast<size_t>(n);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MultiWriterAVLTree<Key, Value, Compare>::empty() const
+{
+    return size() == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+int MultiWriterAVLTree<Key, Value, Compare>::compare(const Key& a, const Key& b) const
+{
+    if(comp_(a, b)) return -1;
+    return comp_(b, a) ? 1 : 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::atomic<typename MultiWriterAVLTree<Key, Value, Compare>::Node*>&
+MultiWriterAVLTree<Key, Value, Compare>::child(Node* node, int dir)
+{
+    return dir < 0 ? node->left : node->right;
+}
+
+template<typename Key, typename Value, typename Compare>
+int MultiWriterAVLTree<Key, Value, Compare>::height(Node* node)
+{
+    return node == NULL ? 0 : node->height.load();
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MultiWriterAVLTree<Key, Value, Compare>::isChanging(uint64_t version)
+{
+    return (version & (Unlinked | Shrinking)) != 0;
+}
+
+/**
+* Waits out a rotation that is shrinking node. The rotating thread holds
+* node's lock, so after a short spin this blocks on it.
+*/
+template<typename Key, typename Value, typename Compare>
+void MultiWriterAVLTree<Key, Value, Compare>::waitUntilNotChanging(Node* node)
+{
+    uint64_t version = node->version.load();
+    if((version & Shrinking) == 0) return;
+    for(int i = 0; i < 100; ++i) {
+        if(node->version.load() != version) return;
+    }
+    Lock lock(node->lock);
+}
+
+template<typename Key, typename Value, typename Compare>
+uint64_t MultiWriterAVLTree<Key, Value, Compare>::beginChange(uint64_t version)
+{
+    return version | Shrinking;
+}
+
+template<typename Key, typename Value, typename Compare>
+uint64_t MultiWriterAVLTree<Key, Value, Compare>::endChange(uint64_t version)
+{
+    return (version & ~(Unlinked | Shrinking)) + VersionStep;
+}
+
+/**
+* Copies the value stored under key into value and returns true, or
+* returns false if key is not in the tree
+*/
+template<typename Key, typename Value, typename Compare>
+bool MultiWriterAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    ReclaimerSection section(reclaimer_);
+    Value* found = get(key);
+    if(found == NULL) return false;
+    value = *found;
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MultiWriterAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    ReclaimerSection section(reclaimer_);
+    return get(key) != NULL;
+}
+
+template<typename Key, typename Value, typename Compare>
+Value* MultiWriterAVLTree<Key, Value, Compare>::get(const Key& key) const
+{
+    while(true) {
+        Node* root = holder_->right.load();
+        if(root == NULL) return NULL;
+        int c = compare(key, root->key());
+        if(c == 0) return root->value.load();
+        uint64_t rootVersion = root->version.load();
+        if(isChanging(rootVersion)) {
+            waitUntilNotChanging(root);
+        }
+        else if(root == holder_->right.load()) {
+            Value* result;
+            if(attemptGet(key, root, c, rootVersion, result)) return result;
+        }
+    }
+}
+
+/**
+* Searches below node, which was reached with version nodeVersion, on
+* the dir side. Returns false if node's key range shrank meanwhile, so
+* that the caller retries from higher up.
+*/
+template<typename Key, typename Value, typename Compare>
+bool MultiWriterAVLTree<Key, Value, Compare>::attemptGet(const Key& key, Node* node, int dir, uint64_t nodeVersion, Value*& result) const
+{
+    while(true) {
+        Node* next = child(node, dir).load();
+        if(next == NULL) {
+            if(node->version.load() != nodeVersion) return false;
+            result = NULL;
+            return true;
+        }
+        int c = compare(key, next->key());
+        if(c == 0) {
+            result = next->value.load();
+            return true;
+        }
+        uint64_t nextVersion = next->version.load();
+        if(isChanging(nextVersion)) {
+            waitUntilNotChanging(next);
+            if(node->version.load() != nodeVersion) return false;
+        }
+        else if(next != child(node, dir).load()) {
+            if(node->version.load() != nodeVersion) return false;
+        }
+        else {
+            if(node->version.load() != nodeVersion) return false;
+            if(attemptGet(key, next, c, nextVersion, result)) return true;
+        }
+    }
+}
+
+/**
+* Inserts the pair, or overwrites the value if the key is present.
+* Returns true if the key was new.
+*/
+template<typename Key, typename Value, typename Compare>
+bool MultiWriterAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Value* fresh = new Value(keyValuePair.second);
+    bool added;
+    try {
+        ReclaimerSection section(reclaimer_);
+        added = put(keyValuePair.first, fresh);
+    }
+    catch(...) {
+        delete fresh;
+        throw;
+    }
+    reclaimIfDue();
+    return added;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MultiWriterAVLTree<Key, Value, Compare>::put(const Key& key, Value* fresh)
+{
+    while(true) {
+        Node* root = holder_->right.load();
+        if(root == NULL) {
+            Node* created = new Node(key, fresh, holder_);
+            {
+                Lock lock(holder_->lock);
+                if(holder_->right.load() == NULL) {
+                    holder_->right.store(created);
+                    ++size_;
+                    return true;
+                }
+            }
+            delete created;
+            continue;
+        }
+        uint64_t rootVersion = root->version.load();
+        if(isChanging(rootVersion)) {
+            waitUntilNotChanging(root);
+        }
+        else if(root == holder_->right.load()) {
+            Outcome outcome = attemptPut(key, fresh, root, rootVersion);
+            if(outcome != Retry) return outcome == Missing;
+        }
+    }
+}
+
+/**
+* Puts fresh under key in node's subtree. Returns Missing if the key
+* was added, Present if its value was replaced, or Retry.
+*/
+template<typename Key, typename Value, typename Compare>
+typename MultiWriterAVLTree<Key, Value, Compare>::Outcome
+MultiWriterAVLTree<Key, Value, Compare>::attemptPut(const Key& key, Value* fresh, Node* node, uint64_t nodeVersion)
+{
+    int c = compare(key, node->key());
+    if(c == 0) return attemptNodePut(fresh, node);
+
+    while(true) {
+        Node* next = child(node, c).load();
+        if(node->version.load() != nodeVersion) return Retry;
+
+        if(next == NULL) {
+            Node* created = new Node(key, fresh, node);
+            bool linked = false;
+            {
+                Lock lock(node->lock);
+                if(node->version.load() != nodeVersion) {
+                    delete created;
+                    return Retry;
+                }
+                if(child(node, c).load() == NULL) {
+                    child(node, c).store(created);
+                    linked = true;
+                }
+            }
+            if(linked) {
+                ++size_;
+                fixHeightAndRebalance(node);
+                return Missing;
+            }
+            delete created;
+            continue;
+        }
+
+        uint64_t nextVersion = next->version.load();
+        if(isChanging(nextVersion)) {
+            waitUntilNotChanging(next);
+        }
+        else if(next == child(node, c).load()) {
+            if(node->version.load() != nodeVersion) return Retry;
+            Outcome outcome = attemptPut(key, fresh, next, nextVersion);
+            if(outcome != Retry) return outcome;
+        }
+    }
+}
+
+/**
+* Swaps fresh in as node's value. A routing node comes back to life.
+*/
+template<typename Key, typename Value, typename Compare>
+typename MultiWriterAVLTree<Key, Value, Compare>::Outcome
+MultiWriterAVLTree<Key, Value, Compare>::attemptNodePut(Value* fresh, Node* node)
+{
+    Value* prev;
+    {
+        Lock lock(node->lock);
+        if(node->version.load() & Unlinked) return Retry;
+        prev = node->value.exchange(fresh);
+    }
+    if(prev == NULL) {
+        ++size_;
+        return Missing;
+    }
+    retireValue(prev);
+    return Present;
+}
+
+/**
+* Removes the key if present. Returns true if it was.
+*/
+template<typename Key, typename Value, typename Compare>
+bool MultiWriterAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    bool removed;
+    {
+        ReclaimerSection section(reclaimer_);
+        removed = erase(key);
+    }
+    reclaimIfDue();
+    return removed;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MultiWriterAVLTree<Key, Value, Compare>::erase(const Key& key)
+{
+    while(true) {
+        Node* root = holder_->right.load();
+        if(root == NULL) return false;
+        uint64_t rootVersion = root->version.load();
+        if(isChanging(rootVersion)) {
+            waitUntilNotChanging(root);
+        }
+        else if(root == holder_->right.load()) {
+            Outcome outcome = attemptRemove(key, holder_, root, rootVersion);
+            if(outcome != Retry) return outcome == Present;
+        }
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MultiWriterAVLTree<Key, Value, Compare>::Outcome
+MultiWriterAVLTree<Key, Value, Compare>::attemptRemove(const Key& key, Node* parent, Node* node, uint64_t nodeVersion)
+{
+    int c = compare(key, node->key());
+    if(c == 0) return attemptRemoveNode(parent, node);
+
+    while(true) {
+        Node* next = child(node, c).load();
+        if(node->version.load() != nodeVersion) return Retry;
+        if(next == NULL) return Missing;
+
+        uint64_t nextVersion = next->version.load();
+        if(isChanging(nextVersion)) {
+            waitUntilNotChanging(next);
+        }
+        else if(next == child(node, c).load()) {
+            if(node->version.load() != nodeVersion) return Retry;
+            Outcome outcome = attemptRemove(key, node, next, nextVersion);
+            if(outcome != Retry) return outcome;
+        }
+    }
+}
+
+/**
+* Removes node's value. A node with at most one child is unlinked
+* right away, under its parent's lock and its own; one with two
+* children becomes a routing node.
+*/
+template<typename Key, typename Value, typename Compare>
+typename MultiWriterAVLTree<Key, Value, Compare>::Outcome
+MultiWriterAVLTree<Key, Value, Compare>::attemptRemoveNode(Node* parent, Node* node)
+{
+    if(node->value.load() == NULL) return Missing;
+
+    Value* prev;
+    if(node->left.load() == NULL || node->right.load() == NULL) {
+        {
+            Lock parentLock(parent->lock);
+            if((parent->version.load() & Unlinked) || node->parent.load() != parent) return Retry;
+            Lock nodeLock(node->lock);
+            prev = node->value.load();
+            if(prev == NULL) return Missing;
+            if(!attemptUnlink(parent, node)) return Retry;
+        }
+        --size_;
+        retireValue(prev);
+        retireNode(node);
+        fixHeightAndRebalance(parent);
+        return Present;
+    }
+
+    {
+        Lock lock(node->lock);
+        if(node->version.load() & Unlinked) return Retry;
+        prev = node->value.load();
+        if(prev == NULL) return Missing;
+        // A node that lost a child meanwhile must be unlinked instead
+        if(node->left.load() == NULL || node->right.load() == NULL) return Retry;
+        node->value.store(NULL);
+    }
+    --size_;
+    retireValue(prev);
+    return Present;
+}
+
+/**
+* Splices out node, which must have at most one child. Both parent and
+* node are locked. Returns false if the tree changed so that this is no
+* longer possible.
+*/
+template<typename Key, typename Value, typename Compare>
+bool MultiWriterAVLTree<Key, Value, Compare>::attemptUnlink(Node* parent, Node* node)
+{
+    Node* parentLeft = parent->left.load();
+    Node* parentRight = parent->right.load();
+    if(parentLeft != node && parentRight != node) return false;
+
+    Node* left = node->left.load();
+    Node* right = node->right.load();
+    if(left != NULL && right != NULL) return false;
+
+    Node* splice = (left != NULL) ? left : right;
+    if(parentLeft == node) parent->left.store(splice);
+    else parent->right.store(splice);
+    if(splice != NULL) splice->parent.store(parent);
+
+    node->version.store(Unlinked);
+    node->value.store(NULL);
+    return true;
+}
+
+/**
+* Walks up from node, fixing heights and rotating until nothing is left
+* to do. Each step locks only node, or node's parent and then node.
+*
+* A thread that stores a node's height must then check the node's
+* parent, and it does so holding the parent's lock. Every step here
+* decides under node's lock too, even when node turns out to need
+* nothing. Deciding without the lock could race with a thread that is
+* fixing node from child heights it read before this walk's store, and
+* neither thread would look at node again.
+*
+* A rotation that leaves work below it (an unbalanced or routing node)
+* returns there before its parent has been checked. From then on the
+* walk does not stop early but goes on up to the root, also past nodes
+* that other threads unlink meanwhile.
+*/
+template<typename Key, typename Value, typename Compare>
+void MultiWriterAVLTree<Key, Value, Compare>::fixHeightAndRebalance(Node* node)
+{
+    bool toRoot = false;
+    while(node != NULL && node->parent.load() != NULL) {
+        if(node->version.load() & Unlinked) {
+            // The unlinking thread checks node's old parent; a check
+            // still owed higher up is this walk's own
+            if(!toRoot) return;
+            node = node->parent.load();
+            continue;
+        }
+
+        // Only picks the locks; the step itself looks again under them
+        int condition = nodeCondition(node);
+        if(condition != UnlinkRequired && condition != RebalanceRequired) {
+            Lock lock(node->lock);
+            Node* next = fixHeight(node);
+            node = (next == NULL && toRoot) ? node->parent.load() : next;
+        }
+        else {
+            Node* parent = node->parent.load();
+            Lock parentLock(parent->lock);
+            if(!(parent->version.load() & Unlinked) && node->parent.load() == parent) {
+                Node* n = node;
+                Lock nodeLock(n->lock);
+                Node* next = rebalanceNode(parent, n);
+                if(next != NULL && next != parent && next != parent->parent.load()) toRoot = true;
+                node = (next == NULL && toRoot) ? parent : next;
+            }
+        }
+    }
+}
+
+/**
+* Returns UnlinkRequired for a routing node with a missing child,
+* RebalanceRequired if node's subtrees differ in height by more than
+* one, the height node should have if its stored one is stale, or else
+* NothingRequired
+*/
+template<typename Key, typename Value, typename Compare>
+int MultiWriterAVLTree<Key, Value, Compare>::nodeCondition(Node* node)
+{
+    Node* nL = node->left.load();
+    Node* nR = node->right.load();
+    if((nL == NULL || nR == NULL) && node->value.load() == NULL) return UnlinkRequired;
+
+    int hN = node->height.load();
+    int hL0 = height(nL);
+    int hR0 = height(nR);
+    int hNRepl = 1 + std::max(hL0, hR0);
+    int bal = hL0 - hR0;
+    if(bal < -1 || bal > 1) return RebalanceRequired;
+    return hN != hNRepl ? hNRepl : NothingRequired;
+}
+
+/**
+* With node locked: stores its height if that is all it needs. Returns
+* the next node to look at, or NULL when done.
+*/
+template<typename Key, typename Value, typename Compare>
+typename MultiWriterAVLTree<Key, Value, Compare>::Node*
+MultiWriterAVLTree<Key, Value, Compare>::fixHeight(Node* node)
+{
+    int c = nodeCondition(node);
+    switch(c) {
+        case RebalanceRequired:
+        case UnlinkRequired:
+            return node;
+        case NothingRequired:
+            return NULL;
+        default:
+            node->height.store(c);
+            return node->parent.load();
+    }
+}
+
+/**
+* With parent and n locked: unlinks n if it is a routing node with a
+* missing child, else rotates or fixes its height. Returns the next node
+* to look at, or NULL when done.
+*/
+template<typename Key, typename Value, typename Compare>
+typename MultiWriterAVLTree<Key, Value, Compare>::Node*
+MultiWriterAVLTree<Key, Value, Compare>::rebalanceNode(Node* parent, Node* n)
+{
+    Node* nL = n->left.load();
+    Node* nR = n->right.load();
+    if((nL == NULL || nR == NULL) && n->value.load() == NULL) {
+        if(attemptUnlink(parent, n)) {
+            retireNode(n);
+            return fixHeight(parent);
+        }
+        return n;
+    }
+
+    int hN = n->height.load();
+    int hL0 = height(nL);
+    int hR0 = height(nR);
+    int hNRepl = 1 + std::max(hL0, hR0);
+    int bal = hL0 - hR0;
+    if(bal > 1) return rebalanceToRight(parent, n, nL, hR0);
+    if(bal < -1) return rebalanceToLeft(parent, n, nR, hL0);
+    if(hNRepl != hN) {
+        n->height.store(hNRepl);
+        return fixHeight(parent);
+    }
+    return NULL;
+}
+
+/**
+* n is left heavy: rotates right, or left-right if nL leans right. A
+* double rotation that would leave nL a routing node with a missing
+* child, or out of balance, is done as two single ones instead.
+*/
+template<typename Key, typename Value, typename Compare>
+typename MultiWriterAVLTree<Key, Value, Compare>::Node*
+MultiWriterAVLTree<Key, Value, Compare>::rebalanceToRight(Node* parent, Node* n, Node* nL, int hR0)
+{
+    Lock leftLock(nL->lock);
+    int hL = nL->height.load();
+    if(hL - hR0 <= 1) return n;
+
+    Node* nLR = nL->right.load();
+    int hLL0 = height(nL->left.load());
+    int hLR0 = height(nLR);
+    if(hLL0 >= hLR0) return rotateRight(parent, n, nL, hR0, hLL0, nLR, hLR0);
+
+    {
+        Lock leftRightLock(nLR->lock);
+        int hLR = nLR->height.load();
+        if(hLL0 >= hLR) return rotateRight(parent, n, nL, hR0, hLL0, nLR, hLR);
+
+        int hLRL = height(nLR->left.load());
+        int b = hLL0 - hLRL;
+        if(b >= -1 && b <= 1 && !((hLL0 == 0 || hLRL == 0) && nL->value.load() == NULL)) {
+            return rotateRightOverLeft(parent, n, nL, hR0, hLL0, nLR, hLRL);
+        }
+        // Rotate nL left on its own; n is rotated right on the next step
+        return rotateLeft(n, nL, hLL0, nLR, nLR->left.load(), hLRL, height(nLR->right.load()));
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MultiWriterAVLTree<Key, Value, Compare>::Node*
+MultiWriterAVLTree<Key, Value, Compare>::rebalanceToLeft(Node* parent, Node* n, Node* nR, int hL0)
+{
+    Lock rightLock(nR->lock);
+    int hR = nR->height.load();
+    if(hL0 - hR >= -1) return n;
+
+    Node* nRL = nR->left.load();
+    int hRL0 = height(nRL);
+    int hRR0 = height(nR->right.load());
+    if(hRR0 >= hRL0) return rotateLeft(parent, n, hL0, nR, nRL, hRL0, hRR0);
+
+    {
+        Lock rightLeftLock(nRL->lock);
+        int hRL = nRL->height.load();
+        if(hRR0 >= hRL) return rotateLeft(parent, n, hL0, nR, nRL, hRL, hRR0);
+
+        int hRLR = height(nRL->right.load());
+        int b = hRR0 - hRLR;
+        if(b >= -1 && b <= 1 && !((hRR0 == 0 || hRLR == 0) && nR->value.load() == NULL)) {
+            return rotateLeftOverRight(parent, n, hL0, nR, nRL, hRR0, hRLR);
+        }
+        return rotateRight(n, nR, nRL, hRR0, height(nRL->left.load()), nRL->right.load(), hRLR);
+    }
+}
+
+/**
+* Rotates nL up over n, with parent, n and nL locked. n's key range
+* shrinks, so its version is bumped around the change. Returns the next
+* node that may need work.
+*/
+template<typename Key, typename Value, typename Compare>
+typename MultiWriterAVLTree<Key, Value, Compare>::Node*
+MultiWriterAVLTree<Key, Value, Compare>::rotateRight(Node* parent, Node* n, Node* nL, int hR, int hLL, Node* nLR, int hLR)
+{
+    uint64_t nodeVersion = n->version.load();
+    Node* parentLeft = parent->left.load();
+
+    n->version.store(beginChange(nodeVersion));
+
+    n->left.store(nLR);
+    if(nLR != NULL) nLR->parent.store(n);
+    nL->right.store(n);
+    n->parent.store(nL);
+    if(parentLeft == n) parent->left.store(nL);
+    else parent->right.store(nL);
+    nL->parent.store(parent);
+
+    int hNRepl = 1 + std::max(hLR, hR);
+    n->height.store(hNRepl);
+    nL->height.store(1 + std::max(hLL, hNRepl));
+
+    n->version.store(endChange(nodeVersion));
+
+    int balN = hLR - hR;
+    if(balN < -1 || balN > 1) return n;
+    if((nLR == NULL || hR == 0) && n->value.load() == NULL) return n;
+    int balL = hLL - hNRepl;
+    if(balL < -1 || balL > 1) return nL;
+    if(hLL == 0 && nL->value.load() == NULL) return nL;
+    return fixHeight(parent);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MultiWriterAVLTree<Key, Value, Compare>::Node*
+MultiWriterAVLTree<Key, Value, Compare>::rotateLeft(Node* parent, Node* n, int hL, Node* nR, Node* nRL, int hRL, int hRR)
+{
+    uint64_t nodeVersion = n->version.load();
+    Node* parentLeft = parent->left.load();
+
+    n->version.store(beginChange(nodeVersion));
+
+    n->right.store(nRL);
+    if(nRL != NULL) nRL->parent.store(n);
+    nR->left.store(n);
+    n->parent.store(nR);
+    if(parentLeft == n) parent->left.store(nR);
+    else parent->right.store(nR);
+    nR->parent.store(parent);
+
+    int hNRepl = 1 + std::max(hL, hRL);
+    n->height.store(hNRepl);
+    nR->height.store(1 + std::max(hNRepl, hRR));
+
+    n->version.store(endChange(nodeVersion));
+
+    int balN = hRL - hL;
+    if(balN < -1 || balN > 1) return n;
+    if((nRL == NULL || hL == 0) && n->value.load() == NULL) return n;
+    int balR = hRR - hNRepl;
+    if(balR < -1 || balR > 1) return nR;
+    if(hRR == 0 && nR->value.load() == NULL) return nR;
+    return fixHeight(parent);
+}
+
+/**
+* Rotates nLR up over both nL and n, with parent, n, nL and nLR locked.
+* Both n and nL shrink.
+*/
+template<typename Key, typename Value, typename Compare>
+typename MultiWriterAVLTree<Key, Value, Compare>::Node*
+MultiWriterAVLTree<Key, Value, Compare>::rotateRightOverLeft(Node* parent, Node* n, Node* nL, int hR, int hLL, Node* nLR, int hLRL)
+{
+    uint64_t nodeVersion = n->version.load();
+    uint64_t leftVersion = nL->version.load();
+    Node* parentLeft = parent->left.load();
+    Node* nLRL = nLR->left.load();
+    Node* nLRR = nLR->right.load();
+    int hLRR = height(nLRR);
+
+    n->version.store(beginChange(nodeVersion));
+    nL->version.store(beginChange(leftVersion));
+
+    n->left.store(nLRR);
+    if(nLRR != NULL) nLRR->parent.store(n);
+    nL->right.store(nLRL);
+    if(nLRL != NULL) nLRL->parent.store(nL);
+    nLR->left.store(nL);
+    nL->parent.store(nLR);
+    nLR->right.store(n);
+    n->parent.store(nLR);
+    if(parentLeft == n) parent->left.store(nLR);
+    else parent->right.store(nLR);
+    nLR->parent.store(parent);
+
+    int hNRepl = 1 + std::max(hLRR, hR);
+    n->height.store(hNRepl);
+    int hLRepl = 1 + std::max(hLL, hLRL);
+    nL->height.store(hLRepl);
+    nLR->height.store(1 + std::max(hLRepl, hNRepl));
+
+    n->version.store(endChange(nodeVersion));
+    nL->version.store(endChange(leftVersion));
+
+    int balN = hLRR - hR;
+    if(balN < -1 || balN > 1) return n;
+    if((nLRR == NULL || hR == 0) && n->value.load() == NULL) return n;
+    int balLR = hLRepl - hNRepl;
+    if(balLR < -1 || balLR > 1) return nLR;
+    return fixHeight(parent);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MultiWriterAVLTree<Key, Value, Compare>::Node*
+MultiWriterAVLTree<Key, Value, Compare>::rotateLeftOverRight(Node* parent, Node* n, int hL, Node* nR, Node* nRL, int hRR, int hRLR)
+{
+    uint64_t nodeVersion = n->version.load();
+    uint64_t rightVersion = nR->version.load();
+    Node* parentLeft = parent->left.load();
+    Node* nRLL = nRL->left.load();
+    Node* nRLR = nRL->right.load();
+    int hRLL = height(nRLL);
+
+    n->version.store(beginChange(nodeVersion));
+    nR->version.store(beginChange(rightVersion));
+
+    n->right.store(nRLL);
+    if(nRLL != NULL) nRLL->parent.store(n);
+    nR->left.store(nRLR);
+    if(nRLR != NULL) nRLR->parent.store(nR);
+    nRL->right.store(nR);
+    nR->parent.store(nRL);
+    nRL->left.store(n);
+    n->parent.store(nRL);
+    if(parentLeft == n) parent->left.store(nRL);
+    else parent->right.store(nRL);
+    nRL->parent.store(parent);
+
+    int hNRepl = 1 + std::max(hL, hRLL);
+    n->height.store(hNRepl);
+    int hRRepl = 1 + std::max(hRLR, hRR);
+    nR->height.store(hRRepl);
+    nRL->height.store(1 + std::max(hNRepl, hRRepl));
+
+    n->version.store(endChange(nodeVersion));
+    nR->version.store(endChange(rightVersion));
+
+    int balN = hRLL - hL;
+    if(balN < -1 || balN > 1) return n;
+    if((nRLL == NULL || hL == 0) && n->value.load() == NULL) return n;
+    int balRL = hRRepl - hNRepl;
+    if(balRL < -1 || balRL > 1) return nRL;
+    return fixHeight(parent);
+}
+
+template<typename Key, typename Value, typename Compare>
+void MultiWriterAVLTree<Key, Value, Compare>::retireNode(Node* node)
+{
+    reclaimer_.retire(node, &disposeNode);
+}
+
+template<typename Key, typename Value, typename Compare>
+void MultiWriterAVLTree<Key, Value, Compare>::retireValue(Value* value)
+{
+    reclaimer_.retire(value, &disposeValue);
+}
+
+/**
+* Frees retired nodes and values once a batch has built up. Must be
+* called outside any ReclaimerSection.
+*/
+template<typename Key, typename Value, typename Compare>
+void MultiWriterAVLTree<Key, Value, Compare>::reclaimIfDue()
+{
+    if(reclaimer_.retiredCount() >= RetireBatch) reclaimer_.reclaim();
+}
+
+template<typename Key, typename Value, typename Compare>
+void MultiWriterAVLTree<Key, Value, Compare>::disposeNode(void* p)
+{
+    delete static_cast<Node*>(p);
+}
+
+template<typename Key, typename Value, typename Compare>
+void MultiWriterAVLTree<Key, Value, Compare>::disposeValue(void* p)
+{
+    delete static_cast<Value*>(p);
+}
+
+/**
+* Checks key order, parent links, stored heights and the AVL balance at
+* every node, that routing nodes have two children, and the item count.
+* Only meaningful while no other thread is using the tree.
+*/
+template<typename Key, typename Value, typename Compare>
+TreeReport MultiWriterAVLTree<Key, Value, Compare>::verify() const
+{
+    struct Checker
+    {
+        const MultiWriterAVLTree& tree;
+        TreeReport& report;
+
+        // Returns the subtree height, or -1 after recording an error
+        int check(Node* node, Node* parent, const Key* lo, const Key* hi)
+        {
+            if(node == NULL) return 0;
+            const char* error = NULL;
+            if((lo != NULL && tree.compare(*lo, node->key()) >= 0) ||
+               (hi != NULL && tree.compare(node->key(), *hi) >= 0)) {
+                error = "keys are out of order";
+            }
+            else if(node->parent.load() != parent) {
+                error = "parent link is wrong";
+            }
+            else if(node->value.load() == NULL && (node->left.load() == NULL || node->right.load() == NULL)) {
+                error = "routing node was left linked";
+            }
+            if(error != NULL) {
+                report.valid = false;
+                report.error = error;
+                return -1;
+            }
+            int left = check(node->left.load(), node, lo, &node->key());
+            if(left < 0) return -1;
+            int right = check(node->right.load(), node, &node->key(), hi);
+            if(right < 0) return -1;
+            if(node->value.load() != NULL) ++report.nodeCount;
+            if(node->height.load() != 1 + std::max(left, right)) {
+                report.valid = false;
+                report.error = "stored height is wrong";
+                return -1;
+            }
+            if(left - right > 1 || right - left > 1) {
+                report.balanced = false;
+                report.valid = false;
+                report.error = "node is out of AVL balance";
+                return -1;
+            }
+            return 1 + std::max(left, right);
+        }
+    };
+
+    TreeReport report;
+    Checker checker = { *this, report };
+    int h = checker.check(holder_->right.load(), holder_, NULL, NULL);
+    if(h >= 0) {
+        report.height = h;
+        if(report.nodeCount != size()) {
+            report.valid = false;
+            report.error = "item count does not match size()";
+        }
+    }
+    return report;
+}
+
+/*
+-----------------------------------------------------
+End implementations for the MultiWriterAVLTree class.
+-----------------------------------------------------
+*/
+
+#endif
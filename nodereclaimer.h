@@ -0,0 +1,263 @@
+#ifndef NODERECLAIMER_H
+#define NODERECLAIMER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+/**
+* Defers freeing the nodes a writer removes until no reader can still
+* be looking at them. Readers announce themselves in one of ReaderSlots
+* padded counters, picked per thread, and there in one of two phases.
+* A writer waits for a grace period by flipping the phase and waiting
+* for the old phase's counters to drain, twice: new readers go to the
+* other phase, so this always ends once the readers that were already
+* inside are done. Any number of threads may retire and reclaim at once,
+* as long as none of them is inside a read section while reclaiming.
+*/
+class NodeReclaimer
+{
+public:
+    NodeReclaimer();
+    ~NodeReclaimer();
+
+    // Called by readers around any access to the tree
+    size_t enter();
+    void leave(size_t ticket);
+
+    // Called by RetiringAllocator, under the single writer's lock
+    void noteDestroyed(void* p);
+    bool takeDestroyed(void* p);
+
+    // Called by writers
+    void retire(void* p, void (*dispose)(void*));
+    size_t retiredCount() const;
+    void synchronize();
+    void reclaim();
+
+private:
+    static const size_t ReaderSlots = 64;
+
+    struct Retired
+    {
+        void* p;
+        void (*dispose)(void*);
+    };
+
+    struct alignas(64) ReaderSlot
+    {
+        std::atomic<uint32_t> count[2];
+    };
+
+    static size_t threadSlot();
+    static void disposeAll(std::vector<Retired>& retired);
+
+    ReaderSlot slots_[ReaderSlots];
+    std::atomic<uint32_t> phase_;
+    void* destroyed_;  // destroyed by the tree, deallocation pending
+    std::vector<Retired> retired_;
+    std::atomic<size_t> retiredCount_;  // retired_.size(), readable without the lock
+    std::mutex retireLock_;  // guards retired_
+    std::mutex syncLock_;  // one grace period at a time
+};
+
+/**
+* Registers the current thread as a reader of a NodeReclaimer for as
+* long as it lives: nothing retired meanwhile is freed before it ends.
+*/
+class ReclaimerSection
+{
+public:
+    explicit ReclaimerSection(NodeReclaimer& reclaimer) : reclaimer_(reclaimer), ticket_(reclaimer.enter()) { }
+    ~ReclaimerSection() { reclaimer_.leave(ticket_); }
+
+    ReclaimerSection(const ReclaimerSection&) = delete;
+    ReclaimerSection& operator=(const ReclaimerSection&) = delete;
+
+private:
+    NodeReclaimer& reclaimer_;
+    size_t ticket_;
+};
+
+/**
+* A node allocator for trees read concurrently through NodeReclaimer.
+* destroy() leaves the node intact and deallocate() hands it to the
+* reclaimer, which runs the destructor and frees it after a grace
+* period. A node deallocated without being destroyed first failed to
+* construct, was never visible, and is freed at once.
+*/
+template <typename T>
+class RetiringAllocator
+{
+public:
+    typedef T value_type;
+
+    explicit RetiringAllocator(NodeReclaimer* reclaimer) : reclaimer_(reclaimer) { }
+    template <typename U>
+    RetiringAllocator(const RetiringAllocator<U>& other) : reclaimer_(other.reclaimer_) { }
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        if(reclaimer_->takeDestroyed(p)) reclaimer_->retire(p, &dispose);
+        else ::operator delete(p);
+    }
+
+    template <typename U>
+    void destroy(U* p)
+    {
+        reclaimer_->noteDestroyed(p);
+    }
+
+    bool operator==(const RetiringAllocator& rhs) const { return reclaimer_ == rhs.reclaimer_; }
+    bool operator!=(const RetiringAllocator& rhs) const { return reclaimer_ != rhs.reclaimer_; }
+
+private:
+    template <typename U> friend class RetiringAllocator;
+
+    static void dispose(void* p)
+    {
+        static_cast<T*>(p)->~T();
+        ::operator delete(p);
+    }
+
+    NodeReclaimer* reclaimer_;
+};
+
+
+/*
+------------------------------------------------
+Begin implementations for the NodeReclaimer class.
+------------------------------------------------
+*/
+
+inline NodeReclaimer::NodeReclaimer() :
+    phase_(0),
+    destroyed_(NULL),
+    retiredCount_(0)
+{
+    for(size_t i = 0; i < ReaderSlots; ++i) {
+        slots_[i].count[0].store(0, std::memory_order_relaxed);
+        slots_[i].count[1].store(0, std::memory_order_relaxed);
+    }
+}
+
+/**
+* No reader can be left by the time the owner is destroyed
+*/
+inline NodeReclaimer::~NodeReclaimer()
+{
+    disposeAll(retired_);
+}
+
+/**
+* Threads are handed slots round robin on their first read, so up to
+* ReaderSlots readers never share a counter
+*/
+inline size_t NodeReclaimer::threadSlot()
+{
+    static std::atomic<size_t> nextSlot(0);
+    static thread_local size_t slot = nextSlot.fetch_add(1, std::memory_order_relaxed) % ReaderSlots;
+    return slot;
+}
+
+/**
+* Registers a reader in the current phase. The returned ticket is passed
+* back to leave().
+*/
+inline size_t NodeReclaimer::enter()
+{
+    size_t slot = threadSlot();
+    size_t phase = phase_.load(std::memory_order_seq_cst) & 1;
+    slots_[slot].count[phase].fetch_add(1, std::memory_order_seq_cst);
+    return slot * 2 + phase;
+}
+
+inline void NodeReclaimer::leave(size_t ticket)
+{
+    slots_[ticket / 2].count[ticket % 2].fetch_sub(1, std::memory_order_release);
+}
+
+inline void NodeReclaimer::noteDestroyed(void* p)
+{
+    destroyed_ = p;
+}
+
+/**
+* True if p is the node most recently passed to noteDestroyed()
+*/
+inline bool NodeReclaimer::takeDestroyed(void* p)
+{
+    if(destroyed_ != p) return false;
+    destroyed_ = NULL;
+    return true;
+}
+
+inline void NodeReclaimer::retire(void* p, void (*dispose)(void*))
+{
+    Retired r = { p, dispose };
+    std::lock_guard<std::mutex> lock(retireLock_);
+    retired_.push_back(r);
+    retiredCount_.store(retired_.size(), std::memory_order_relaxed);
+}
+
+inline size_t NodeReclaimer::retiredCount() const
+{
+    return retiredCount_.load(std::memory_order_relaxed);
+}
+
+/**
+* Returns once every reader that was inside when it was called has left
+*/
+inline void NodeReclaimer::synchronize()
+{
+    std::lock_guard<std::mutex> lock(syncLock_);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for(int round = 0; round < 2; ++round) {
+        uint32_t old = phase_.fetch_add(1, std::memory_order_seq_cst) & 1;
+        for(size_t i = 0; i < ReaderSlots; ++i) {
+            while(slots_[i].count[old].load(std::memory_order_acquire) != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
+
+/**
+* Waits out a grace period, then frees every node retired before the
+* call. Nodes retired meanwhile wait for the next call.
+*/
+inline void NodeReclaimer::reclaim()
+{
+    std::vector<Retired> batch;
+    {
+        std::lock_guard<std::mutex> lock(retireLock_);
+        batch.swap(retired_);
+        retiredCount_.store(0, std::memory_order_relaxed);
+    }
+    if(batch.empty()) return;
+    synchronize();
+    disposeAll(batch);
+}
+
+inline void NodeReclaimer::disposeAll(std::vector<Retired>& retired)
+{
+    for(size_t i = 0; i < retired.size(); ++i) retired[i].dispose(retired[i].p);
+    retired.clear();
+}
+
+/*
+----------------------------------------------
+End implementations for the NodeReclaimer class.
+----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,898 @@
+#ifndef PERSISTENTAVL_H
+#define PERSISTENTAVL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "bst.h"
+
+/**
+* A node of a PersistentAVLTree. Nodes have no parent pointer, since a
+* node can sit in many versions of the tree at once, and count the
+* versions and nodes that point at them.
+*/
+template <typename Key, typename Value>
+struct PersistentNode
+{
+    PersistentNode(const std::pair<const Key, Value>& item) :
+        item(item), left(NULL), right(NULL), refs(1), height(1) { }
+
+    std::pair<const Key, Value> item;
+    PersistentNode* left;
+    PersistentNode* right;
+    std::atomic<uint32_t> refs;
+    int height;  // of the subtree rooted here; a leaf is 1
+};
+
+/**
+* An AVL tree with value semantics whose versions share structure.
+* Copying a tree, or taking a snapshot(), is O(1): the copy just holds
+* on to the same root. An insert or remove then copies only the nodes on
+* its root to leaf path that some other version can see, and updates
+* the rest in place, so a tree with no snapshots alive runs at the
+* speed of an ordinary one.
+*
+* Nodes are reference counted. A node is changed in place only when its
+* count is one, and is copied otherwise, its copy taking a new reference
+* to each child. A version can therefore never see another one change.
+* The counts are atomic, so snapshots can be read and destroyed on
+* other threads while the tree they came from keeps taking writes. The
+* tree itself, like the other trees, needs one writer at a time, and
+* snapshot() counts as a read.
+*
+* Key and Value must be copyable, since copying a node copies its item.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class PersistentAVLTree
+{
+    typedef PersistentNode<Key, Value> NodeType;
+
+public:
+    class Snapshot;
+
+    PersistentAVLTree();
+    explicit PersistentAVLTree(const Compare& comp);
+    PersistentAVLTree(const PersistentAVLTree& other);
+    PersistentAVLTree& operator=(const PersistentAVLTree& other);
+    ~PersistentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    Snapshot snapshot() const;
+
+    /**
+    * A bidirectional iterator over the items in key order. Items are
+    * read-only, since other versions may share them. The iterator keeps
+    * the path from the root, and --end() reaches the largest item.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key,Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        const_iterator();
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class PersistentAVLTree<Key, Value, Compare>;
+        explicit const_iterator(const NodeType* root);
+        void pushLeftmost(const NodeType* node);
+        void pushRightmost(const NodeType* node);
+
+        const NodeType* root_;
+        std::vector<const NodeType*> path_;  // root first; empty at the end
+    };
+    typedef const_iterator iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+    typedef const_reverse_iterator reverse_iterator;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+
+    const_iterator find(const Key& key) const;
+    bool contains(const Key& key) const;
+    const Value* lookup(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    bool empty() const;
+    size_t size() const;
+    bool isBalanced() const;
+    TreeReport verify() const;
+    Compare key_comp() const;
+
+private:
+    // Links that unshareLink() pointed at a copy, each with the node it
+    // pointed at before
+    typedef std::vector<std::pair<NodeType**, NodeType*> > UnshareLog;
+
+    static NodeType* retain(NodeType* node);
+    static void release(NodeType* node);
+    static void unshareLink(NodeType*& link, UnshareLog& log);
+    static int unshareRotated(NodeType* node, bool pathGoesLeft, int pathHeight, UnshareLog& log);
+    static void commit(UnshareLog& log);
+    static void rollback(UnshareLog& log);
+    static int height(const NodeType* node);
+    static void updateHeight(NodeType* node);
+    static NodeType* rotateLeft(NodeType* node);
+    static NodeType* rotateRight(NodeType* node);
+    static NodeType* rebalance(NodeType* node);
+    static void rebalancePath(const std::vector<NodeType**>& path, size_t begin, size_t end);
+    NodeType* prepareInsert(const std::pair<const Key, Value>& keyValuePair, std::vector<NodeType**>& path, UnshareLog& log);
+    void prepareRemove(const Key& key, std::vector<NodeType**>& path, size_t& found, UnshareLog& log);
+    const NodeType* findNode(const Key& key) const;
+
+    NodeType* root_;
+    size_t size_;
+    Compare comp_;
+};
+
+/**
+* A frozen version of a PersistentAVLTree, sharing its nodes. It offers
+* only the read side of the tree's interface, and can be copied freely.
+*/
+template <typename Key, typename Value, typename Compare>
+class PersistentAVLTree<Key, Value, Compare>::Snapshot : private PersistentAVLTree<Key, Value, Compare>
+{
+public:
+    typedef PersistentAVLTree<Key, Value, Compare> Tree;
+    typedef typename Tree::const_iterator const_iterator;
+    typedef typename Tree::iterator iterator;
+    typedef typename Tree::const_reverse_iterator const_reverse_iterator;
+    typedef typename Tree::reverse_iterator reverse_iterator;
+
+    using Tree::begin;
+    using Tree::end;
+    using Tree::rbegin;
+    using Tree::rend;
+    using Tree::find;
+    using Tree::contains;
+    using Tree::lookup;
+    using Tree::lower_bound;
+    using Tree::empty;
+    using Tree::size;
+    using Tree::verify;
+    using Tree::key_comp;
+
+private:
+    friend class PersistentAVLTree<Key, Value, Compare>;
+    explicit Snapshot(const Tree& tree) : Tree(tree) { }
+};
+
+/*
+-------------------------------------------------------------------
+Begin implementations for the PersistentAVLTree::const_iterator class.
+-------------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::const_iterator::const_iterator() :
+    root_(NULL)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::const_iterator::const_iterator(const NodeType* root) :
+    root_(root)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::const_iterator::pushLeftmost(const NodeType* node)
+{
+    for(; node != NULL; node = node->left) path_.push_back(node);
+}
+
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::const_iterator::pushRightmost(const NodeType* node)
+{
+    for(; node != NULL; node = node->right) path_.push_back(node);
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<const Key,Value> &
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return path_.back()->item;
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<const Key,Value> *
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return &path_.back()->item;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    if(path_.empty() || rhs.path_.empty()) return path_.empty() && rhs.path_.empty();
+    return path_.back() == rhs.path_.back();
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Goes down to the leftmost node of the right subtree, or else back up
+* past every ancestor reached from its right
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator&
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    const NodeType* node = path_.back();
+    if(node->right != NULL) {
+        pushLeftmost(node->right);
+        return *this;
+    }
+    path_.pop_back();
+    while(!path_.empty() && path_.back()->right == node) {
+        node = path_.back();
+        path_.pop_back();
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator&
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator--()
+{
+    if(path_.empty()) {
+        pushRightmost(root_);
+        return *this;
+    }
+    const NodeType* node = path_.back();
+    if(node->left != NULL) {
+        pushRightmost(node->left);
+        return *this;
+    }
+    path_.pop_back();
+    while(!path_.empty() && path_.back()->left == node) {
+        node = path_.back();
+        path_.pop_back();
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+-----------------------------------------------------------------
+End implementations for the PersistentAVLTree::const_iterator class.
+-----------------------------------------------------------------
+*/
+
+/*
+--------------------------------------------------------
+Begin implementations for the PersistentAVLTree class.
+--------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree() :
+    root_(NULL),
+    size_(0)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const Compare& comp) :
+    root_(NULL),
+    size_(0),
+    comp_(comp)
+{
+
+}
+
+/**
+* O(1): the copy shares every node with other
+*/
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const PersistentAVLTree& other) :
+    root_(retain(other.root_)),
+    size_(other.size_),
+    comp_(other.comp_)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>&
+PersistentAVLTree<Key, Value, Compare>::operator=(const PersistentAVLTree& other)
+{
+    NodeType* old = root_;
+    root_ = retain(other.root_);
+    size_ = other.size_;
+    comp_ = other.comp_;
+    release(old);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::~PersistentAVLTree()
+{
+    release(root_);
+}
+
+/**
+* Returns a read-only version of the tree as it is now, in O(1)
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot
+PersistentAVLTree<Key, Value, Compare>::snapshot() const
+{
+    return Snapshot(*this);
+}
+
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::clear()
+{
+    release(root_);
+    root_ = NULL;
+    size_ = 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+size_t PersistentAVLTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value, typename Compare>
+Compare PersistentAVLTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::retain(NodeType* node)
+{
+    if(node != NULL) node->refs.fetch_add(1, std::memory_order_relaxed);
+    return node;
+}
+
+/**
+* Drops one reference to node, freeing it, and releasing its children,
+* if it was the last
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::release(NodeType* node)
+{
+    while(node != NULL && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        NodeType* right = node->right;
+        release(node->left);
+        delete node;
+        node = right;
+    }
+}
+
+/**
+* Points link at a node that nothing else refers to, copying the node
+* it points at if another version shares it. The reference the link
+* held moves to log, where commit() drops it or rollback() gives it
+* back. Nothing is changed if the copy throws.
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::unshareLink(NodeType*& link, UnshareLog& log)
+{
+    NodeType* node = link;
+    if(node->refs.load(std::memory_order_acquire) == 1) return;
+    log.push_back(std::make_pair(&link, node));
+    NodeType* copy;
+    try {
+        copy = new NodeType(node->item);
+    }
+    catch(...) {
+        log.pop_back();
+        throw;
+    }
+    copy->left = retain(node->left);
+    copy->right = retain(node->right);
+    copy->height = node->height;
+    link = copy;
+}
+
+/**
+* node is on the path of a remove, which goes on to its left child if
+* pathGoesLeft, and that child's subtree will be pathHeight high. Works
+* out whether rebalance() will rotate node, and if so unshares the nodes
+* off the path that the rotation moves up. Returns node's height after
+* it has been rebalanced.
+*/
+template<typename Key, typename Value, typename Compare>
+int PersistentAVLTree<Key, Value, Compare>::unshareRotated(NodeType* node, bool pathGoesLeft, int pathHeight, UnshareLog& log)
+{
+    NodeType*& sibling = pathGoesLeft ? node->right : node->left;
+    int siblingHeight = height(sibling);
+    if(siblingHeight - pathHeight <= 1) return 1 + std::max(siblingHeight, pathHeight);
+
+    unshareLink(sibling, log);
+    NodeType*& nearChild = pathGoesLeft ? sibling->left : sibling->right;
+    int nearHeight = height(nearChild);
+    int farHeight = height(pathGoesLeft ? sibling->right : sibling->left);
+    if(nearHeight <= farHeight) {
+        return 1 + std::max(1 + std::max(pathHeight, nearHeight), farHeight);
+    }
+
+    // A double rotation lifts the near child above both
+    unshareLink(nearChild, log);
+    int toNode = height(pathGoesLeft ? nearChild->left : nearChild->right);
+    int toSibling = height(pathGoesLeft ? nearChild->right : nearChild->left);
+    return 1 + std::max(1 + std::max(pathHeight, toNode), 1 + std::max(toSibling, farHeight));
+}
+
+/**
+* Drops the references to the nodes that were copied, once the new
+* version is in place
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::commit(UnshareLog& log)
+{
+    for(size_t i = 0; i < log.size(); ++i) {
+        release(log[i].second);
+    }
+}
+
+/**
+* Points every logged link back at its original node and frees the
+* copies, newest first, so that the tree is as it was before
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::rollback(UnshareLog& log)
+{
+    for(size_t i = log.size(); i-- > 0; ) {
+        NodeType* copy = *log[i].first;
+        *log[i].first = log[i].second;
+        release(copy);
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+int PersistentAVLTree<Key, Value, Compare>::height(const NodeType* node)
+{
+    return node == NULL ? 0 : node->height;
+}
+
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::updateHeight(NodeType* node)
+{
+    node->height = 1 + std::max(height(node->left), height(node->right));
+}
+
+/**
+* Rotations take an unshared node whose child that moves up is unshared
+* too, and return the root of the rotated subtree
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::rotateLeft(NodeType* node)
+{
+    NodeType* right = node->right;
+    node->right = right->left;
+    right->left = node;
+    updateHeight(node);
+    updateHeight(right);
+    return right;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::rotateRight(NodeType* node)
+{
+    NodeType* left = node->left;
+    node->left = left->right;
+    left->right = node;
+    updateHeight(node);
+    updateHeight(left);
+    return left;
+}
+
+/**
+* Restores the AVL property at an unshared node whose subtrees differ
+* in height by at most two. The nodes it rotates must be unshared: for
+* an insert they are on the path, for a remove unshareSibling() sees to
+* them.
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::rebalance(NodeType* node)
+{
+    int balance = height(node->right) - height(node->left);
+    if(balance > 1) {
+        if(height(node->right->right) < height(node->right->left)) {
+            node->right = rotateRight(node->right);
+        }
+        return rotateLeft(node);
+    }
+    if(balance < -1) {
+        if(height(node->left->left) < height(node->left->right)) {
+            node->left = rotateLeft(node->left);
+        }
+        return rotateRight(node);
+    }
+    updateHeight(node);
+    return node;
+}
+
+/**
+* Rebalances the nodes that path[begin, end) point at, bottom up. Only
+* unshared nodes are touched, so this cannot throw.
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::rebalancePath(const std::vector<NodeType**>& path, size_t begin, size_t end)
+{
+    for(size_t i = end; i-- > begin; ) {
+        *path[i] = rebalance(*path[i]);
+    }
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already
+* present. Only the nodes on the search path are copied, and only those
+* that another version shares. All copies are made before anything is
+* relinked, so if one throws, or copying the pair does, the tree and
+* every version are left as they were. If assigning the value of a key
+* that this tree alone holds throws, the value is left as Value's
+* assignment leaves it.
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::vector<NodeType**> path;
+    path.reserve(height(root_) + 1);
+    UnshareLog log;
+    NodeType* leaf = NULL;
+    try {
+        leaf = prepareInsert(keyValuePair, path, log);
+    }
+    catch(...) {
+        rollback(log);
+        throw;
+    }
+    if(leaf != NULL) {
+        *path.back() = leaf;
+        rebalancePath(path, 0, path.size() - 1);
+        ++size_;
+    }
+    commit(log);
+}
+
+/**
+* The part of an insert that can throw. Unshares the search path, whose
+* links go to path, and either overwrites the value of the key's node
+* or returns a new node for the pair, to go where the last link of path
+* points. An insert only rotates nodes on its path, so the rest of it
+* needs no copies.
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::prepareInsert(const std::pair<const Key, Value>& keyValuePair,
+                                                      std::vector<NodeType**>& path, UnshareLog& log)
+{
+    NodeType** link = &root_;
+    while(*link != NULL) {
+        path.push_back(link);
+        unshareLink(*link, log);
+        NodeType* node = *link;
+        if(comp_(keyValuePair.first, node->item.first)) {
+            link = &node->left;
+        }
+        else if(comp_(node->item.first, keyValuePair.first)) {
+            link = &node->right;
+        }
+        else {
+            node->item.second = keyValuePair.second;
+            return NULL;
+        }
+    }
+    path.push_back(link);
+    return new NodeType(keyValuePair);
+}
+
+/**
+* Removes the key if present. A miss copies nothing. As for insert, a
+* copy that throws leaves the tree and every version as they were.
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    if(findNode(key) == NULL) return;
+    std::vector<NodeType**> path;
+    path.reserve(height(root_));
+    size_t found = 0;
+    UnshareLog log;
+    try {
+        prepareRemove(key, path, found, log);
+    }
+    catch(...) {
+        rollback(log);
+        throw;
+    }
+
+    // Splice in a child, or else the smallest node on the right, which
+    // the last link of path points at
+    NodeType* node = *path[found];
+    if(node->left == NULL || node->right == NULL) {
+        *path[found] = (node->left != NULL) ? node->left : node->right;
+        node->left = node->right = NULL;
+        release(node);
+        rebalancePath(path, 0, found);
+    }
+    else {
+        NodeType* min = *path.back();
+        *path.back() = min->right;
+        rebalancePath(path, found + 1, path.size() - 1);
+        min->left = node->left;
+        min->right = node->right;
+        *path[found] = min;
+        node->left = node->right = NULL;
+        release(node);
+        rebalancePath(path, 0, found + 1);
+    }
+    --size_;
+    commit(log);
+}
+
+/**
+* The part of a remove that can throw. Unshares the search path down to
+* the key's node, whose link is path[found], and on from there to the
+* smallest node on its right if it has two children; path gets every
+* link. Then replays the rebalancing on heights alone, bottom up, to
+* unshare the nodes off the path that it will rotate.
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::prepareRemove(const Key& key, std::vector<NodeType**>& path,
+                                                           size_t& found, UnshareLog& log)
+{
+    NodeType** link = &root_;
+    while(true) {
+        path.push_back(link);
+        unshareLink(*link, log);
+        NodeType* node = *link;
+        if(comp_(key, node->item.first)) link = &node->left;
+        else if(comp_(node->item.first, key)) link = &node->right;
+        else break;
+    }
+    found = path.size() - 1;
+
+    NodeType* node = *link;
+    size_t i = found;
+    int h = height(node) - 1;
+    if(node->left != NULL && node->right != NULL) {
+        link = &node->right;
+        while(true) {
+            path.push_back(link);
+            unshareLink(*link, log);
+            if((*link)->left == NULL) break;
+            link = &(*link)->left;
+        }
+        i = path.size() - 1;
+        h = height((*link)->right);
+    }
+
+    // The smallest node on the right takes the key's node's place, with
+    // the same children, so the replay treats it as that node
+    while(i-- > 0) {
+        NodeType* parent = *path[i];
+        h = unshareRotated(parent, path[i + 1] == &parent->left, h, log);
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::findNode(const Key& key) const
+{
+    const NodeType* curr = root_;
+    while(curr != NULL) {
+        if(comp_(key, curr->item.first)) curr = curr->left;
+        else if(comp_(curr->item.first, key)) curr = curr->right;
+        else return curr;
+    }
+    return NULL;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    const_iterator it(root_);
+    const NodeType* curr = root_;
+    while(curr != NULL) {
+        it.path_.push_back(curr);
+        if(comp_(key, curr->item.first)) curr = curr->left;
+        else if(comp_(curr->item.first, key)) curr = curr->right;
+        else return it;
+    }
+    return end();
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    return findNode(key) != NULL;
+}
+
+/**
+* Returns a pointer to the value stored under key, or NULL if key is
+* not in the tree
+*/
+template<typename Key, typename Value, typename Compare>
+const Value* PersistentAVLTree<Key, Value, Compare>::lookup(const Key& key) const
+{
+    const NodeType* node = findNode(key);
+    return node == NULL ? NULL : &node->item.second;
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+* The path is cut back to the last node where the search went left,
+* which is where the iterator ends up.
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    const_iterator it(root_);
+    size_t keep = 0;
+    const NodeType* curr = root_;
+    while(curr != NULL) {
+        it.path_.push_back(curr);
+        if(comp_(curr->item.first, key)) {
+            curr = curr->right;
+        }
+        else {
+            keep = it.path_.size();
+            curr = curr->left;
+        }
+    }
+    it.path_.resize(keep);
+    return it;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::begin() const
+{
+    const_iterator it(root_);
+    it.pushLeftmost(root_);
+    return it;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(root_);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_reverse_iterator
+PersistentAVLTree<Key, Value, Compare>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_reverse_iterator
+PersistentAVLTree<Key, Value, Compare>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return verify().balanced;
+}
+
+/**
+* Checks key order, stored heights, the AVL balance at every node and
+* the item count
+*/
+template<typename Key, typename Value, typename Compare>
+TreeReport PersistentAVLTree<Key, Value, Compare>::verify() const
+{
+    struct Checker
+    {
+        const Compare& comp;
+        TreeReport& report;
+
+        // Returns the subtree height, or -1 after recording an error
+        int check(const NodeType* node, const Key* lo, const Key* hi)
+        {
+            if(node == NULL) return 0;
+            if((lo != NULL && !comp(*lo, node->item.first)) ||
+               (hi != NULL && !comp(node->item.first, *hi))) {
+                report.valid = false;
+                report.error = "keys are out of order";
+                return -1;
+            }
+            int left = check(node->left, lo, &node->item.first);
+            if(left < 0) return -1;
+            int right = check(node->right, &node->item.first, hi);
+            if(right < 0) return -1;
+            ++report.nodeCount;
+            if(node->height != 1 + std::max(left, right)) {
+                report.valid = false;
+                report.error = "stored height is wrong";
+                return -1;
+            }
+            if(left - right > 1 || right - left > 1) {
+                report.balanced = false;
+                report.valid = false;
+                report.error = "node is out of AVL balance";
+                return -1;
+            }
+            return node->height;
+        }
+    };
+
+    TreeReport report;
+    Checker checker = { comp_, report };
+    int h = checker.check(root_, NULL, NULL);
+    if(h >= 0) {
+        report.height = h;
+        if(report.nodeCount != size_) {
+            report.valid = false;
+            report.error = "item count does not match size()";
+        }
+    }
+    return report;
+}
+
+/*
+------------------------------------------------------
+End implementations for the PersistentAVLTree class.
+------------------------------------------------------
+*/
+
+#endif
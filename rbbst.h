@@ -0,0 +1,519 @@
+#ifndef RBBST_H
+#define RBBST_H
+
+#include <cstdint>
+#include <vector>
+#include "bst.h"
+
+/**
+* A node for a red-black tree, which adds its color as a data member.
+* New nodes start out red.
+*/
+template <typename Key, typename Value>
+class RBNode : public Node<Key, Value>
+{
+public:
+    // Constructors.
+    RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent);
+    template<typename... Args>
+    RBNode(RBNode<Key, Value>* parent, Args&&... args);
+
+    // Getter/setter for the node's color.
+    bool isRed() const;
+    void setRed(bool red);
+
+    // Getters for parent, left, and right, redefined to return RBNodes
+    // as AVLNode does.
+    RBNode<Key, Value>* getParent() const;
+    RBNode<Key, Value>* getLeft() const;
+    RBNode<Key, Value>* getRight() const;
+
+protected:
+    bool red_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RBNode class.
+  -------------------------------------------------
+*/
+
+template<class Key, class Value>
+RBNode<Key, Value>::RBNode(const Key& key, const Value& value, RBNode<Key, Value> *parent) :
+    Node<Key, Value>(key, value, parent), red_(true)
+{
+
+}
+
+/**
+* Constructs the item in place from args; see the matching Node constructor.
+*/
+template<class Key, class Value>
+template<typename... Args>
+RBNode<Key, Value>::RBNode(RBNode<Key, Value>* parent, Args&&... args) :
+    Node<Key, Value>(parent, std::forward<Args>(args)...), red_(true)
+{
+
+}
+
+template<class Key, class Value>
+bool RBNode<Key, Value>::isRed() const
+{
+    return red_;
+}
+
+template<class Key, class Value>
+void RBNode<Key, Value>::setRed(bool red)
+{
+    red_ = red;
+}
+
+/**
+* The static_cast is safe because an RBTree only ever links RBNodes together.
+*/
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getParent() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->parent_);
+}
+
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getLeft() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->left_);
+}
+
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getRight() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->right_);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RBNode class.
+  -----------------------------------------------
+*/
+
+/**
+* A red-black tree. It balances less strictly than AVLTree, up to
+* twice the shortest path rather than one level, and in exchange an
+* insert does at most two rotations and a remove at most three, where
+* an AVL remove may rotate at every level. For write-heavy tables that
+* trades a slightly deeper find for cheaper updates.
+*
+* Red-black trees may legitimately have sibling subtrees whose heights
+* differ by more than one, so isBalanced() (the AVL height property)
+* can be false for a valid tree; verify().valid checks the red-black
+* rules.
+*/
+template <class Key, class Value,
+          class Compare = std::less<Key>,
+          class Alloc = std::allocator<std::pair<const Key, Value> > >
+class RBTree : public BinarySearchTree<Key, Value, Compare, Alloc, RBNode<Key, Value> >
+{
+public:
+    RBTree();
+    explicit RBTree(const Compare& comp);
+    RBTree(const Compare& comp, const Alloc& alloc);
+    template<typename ForwardIt>
+    RBTree(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
+
+    virtual void remove(const Key& key);
+
+protected:
+    virtual void nodeSwap(RBNode<Key,Value>* n1, RBNode<Key,Value>* n2);
+    virtual void afterInsert(RBNode<Key,Value>* node);
+    virtual const char* verifyNode(RBNode<Key,Value>* node, int leftHeight, int rightHeight) const;
+    virtual void initBuiltNode(RBNode<Key,Value>* node, int leftHeight, int rightHeight);
+
+    void rotateLeft(RBNode<Key,Value>* x);
+    void rotateRight(RBNode<Key,Value>* x);
+    void insertFix(RBNode<Key,Value>* n);
+    void removeFix(RBNode<Key,Value>* n);
+    static bool isRed(RBNode<Key,Value>* node);
+    static int blackHeight(RBNode<Key,Value>* node);
+    static void paintLevelRed(RBNode<Key,Value>* node, int depth);
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RBTree class.
+  -------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare, class Alloc>
+RBTree<Key, Value, Compare, Alloc>::RBTree()
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+RBTree<Key, Value, Compare, Alloc>::RBTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare, Alloc, RBNode<Key, Value> >(comp)
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+RBTree<Key, Value, Compare, Alloc>::RBTree(const Compare& comp, const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Compare, Alloc, RBNode<Key, Value> >(comp, alloc)
+{
+
+}
+
+/**
+ * Builds the tree from a range in O(n) if it is sorted. As with
+ * AVLTree, the colors are set through a virtual hook, so this cannot be
+ * left to the base constructor.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+template<typename ForwardIt>
+RBTree<Key, Value, Compare, Alloc>::RBTree(ForwardIt first, ForwardIt last, const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare, Alloc, RBNode<Key, Value> >(comp)
+{
+    this->assign(first, last);
+}
+
+/**
+ * A missing child counts as black.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+bool RBTree<Key, Value, Compare, Alloc>::isRed(RBNode<Key,Value>* node)
+{
+    return node != NULL && node->isRed();
+}
+
+/**
+ * Called by BinarySearchTree with every newly linked (red) node.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void RBTree<Key, Value, Compare, Alloc>::afterInsert(RBNode<Key,Value>* node)
+{
+    this->adjustSizes(node->getParent(), 1);
+    insertFix(node);
+}
+
+/**
+ * Resolves a red node n with a red parent. Recoloring moves the
+ * violation two levels up; once the uncle is black, one or two
+ * rotations end it.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void RBTree<Key, Value, Compare, Alloc>::insertFix(RBNode<Key,Value>* n)
+{
+    while(isRed(n->getParent())) {
+        RBNode<Key,Value>* p = n->getParent();
+        // The root is black, so a red parent has a parent
+        RBNode<Key,Value>* g = p->getParent();
+
+        if(p == g->getLeft()) {
+            RBNode<Key,Value>* uncle = g->getRight();
+            if(isRed(uncle)) {
+                p->setRed(false);
+                uncle->setRed(false);
+                g->setRed(true);
+                n = g;
+                continue;
+            }
+            if(n == p->getRight()) {
+                // zig-zag
+                rotateLeft(p);
+                n = p;
+                p = n->getParent();
+            }
+            // zig-zig
+            rotateRight(g);
+            p->setRed(false);
+            g->setRed(true);
+        }
+        else {
+            RBNode<Key,Value>* uncle = g->getLeft();
+            if(isRed(uncle)) {
+                p->setRed(false);
+                uncle->setRed(false);
+                g->setRed(true);
+                n = g;
+                continue;
+            }
+            if(n == p->getLeft()) {
+                rotateRight(p);
+                n = p;
+                p = n->getParent();
+            }
+            rotateLeft(g);
+            p->setRed(false);
+            g->setRed(true);
+        }
+        break;
+    }
+    this->root_->setRed(false);
+}
+
+/*
+ * As in AVLTree, a node with 2 children is first swapped with its
+ * predecessor, so the node removed has at most one child.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void RBTree<Key, Value, Compare, Alloc>::remove(const Key& key)
+{
+    RBNode<Key,Value>* node = this->internalFind(key);
+    if(node == NULL) return;
+
+    if(node->getLeft() != NULL && node->getRight() != NULL) {
+        RBNode<Key,Value>* pred = this->predecessor(node);
+        nodeSwap(node, pred);
+    }
+
+    RBNode<Key,Value>* child =
+        (node->getLeft() != NULL) ? node->getLeft() : node->getRight();
+
+    // A black node with a child has a red one, which takes over its
+    // black. A black leaf leaves its paths one black short, which has
+    // to be fixed while it is still in place.
+    if(child != NULL) {
+        child->setRed(false);
+    }
+    else if(!node->isRed()) {
+        removeFix(node);
+    }
+
+    RBNode<Key,Value>* parent = node->getParent();
+    if(child != NULL) {
+        child->setParent(parent);
+    }
+    if(parent == NULL) {
+        this->root_ = child;
+    }
+    else if(node == parent->getLeft()) {
+        parent->setLeft(child);
+    }
+    else {
+        parent->setRight(child);
+    }
+
+    this->destroyNode(node);
+    this->adjustSizes(parent, -1);
+}
+
+/**
+ * n is a black node whose paths are one black short ("double black").
+ * A red sibling is rotated up first; then either the sibling turns red
+ * and the shortage moves up to the parent, or one or two rotations
+ * lend n a black and end it.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void RBTree<Key, Value, Compare, Alloc>::removeFix(RBNode<Key,Value>* n)
+{
+    while(n != this->root_ && !n->isRed()) {
+        RBNode<Key,Value>* p = n->getParent();
+
+        if(n == p->getLeft()) {
+            RBNode<Key,Value>* s = p->getRight();
+            if(s->isRed()) {
+                s->setRed(false);
+                p->setRed(true);
+                rotateLeft(p);
+                s = p->getRight();
+            }
+            if(!isRed(s->getLeft()) && !isRed(s->getRight())) {
+                s->setRed(true);
+                n = p;
+                continue;
+            }
+            if(!isRed(s->getRight())) {
+                s->getLeft()->setRed(false);
+                s->setRed(true);
+                rotateRight(s);
+                s = p->getRight();
+            }
+            s->setRed(p->isRed());
+            p->setRed(false);
+            s->getRight()->setRed(false);
+            rotateLeft(p);
+        }
+        else {
+            RBNode<Key,Value>* s = p->getLeft();
+            if(s->isRed()) {
+                s->setRed(false);
+                p->setRed(true);
+                rotateRight(p);
+                s = p->getLeft();
+            }
+            if(!isRed(s->getLeft()) && !isRed(s->getRight())) {
+                s->setRed(true);
+                n = p;
+                continue;
+            }
+            if(!isRed(s->getLeft())) {
+                s->getRight()->setRed(false);
+                s->setRed(true);
+                rotateLeft(s);
+                s = p->getLeft();
+            }
+            s->setRed(p->isRed());
+            p->setRed(false);
+            s->getLeft()->setRed(false);
+            rotateRight(p);
+        }
+        return;
+    }
+    n->setRed(false);
+}
+
+/**
+ * Rotations relink pointers and fix the two subtree sizes that change,
+ * as in AVLTree; the callers set the colors.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void RBTree<Key, Value, Compare, Alloc>::rotateLeft(RBNode<Key,Value>* x)
+{
+    RBNode<Key,Value>* y = x->getRight();
+    RBNode<Key,Value>* p = x->getParent();
+    RBNode<Key,Value>* B = y->getLeft();
+
+    y->setParent(p);
+    if(p == NULL) {
+        this->root_ = y;
+    }
+    else if(x == p->getLeft()) {
+        p->setLeft(y);
+    }
+    else {
+        p->setRight(y);
+    }
+
+    y->setLeft(x);
+    x->setParent(y);
+
+    x->setRight(B);
+    if(B != NULL) {
+        B->setParent(x);
+    }
+
+    this->updateSize(x);
+    this->updateSize(y);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void RBTree<Key, Value, Compare, Alloc>::rotateRight(RBNode<Key,Value>* x)
+{
+    RBNode<Key,Value>* y = x->getLeft();
+    RBNode<Key,Value>* p = x->getParent();
+    RBNode<Key,Value>* B = y->getRight();
+
+    y->setParent(p);
+    if(p == NULL) {
+        this->root_ = y;
+    }
+    else if(x == p->getLeft()) {
+        p->setLeft(y);
+    }
+    else {
+        p->setRight(y);
+    }
+
+    y->setRight(x);
+    x->setParent(y);
+
+    x->setLeft(B);
+    if(B != NULL) {
+        B->setParent(x);
+    }
+
+    this->updateSize(x);
+    this->updateSize(y);
+}
+
+/**
+ * The number of black nodes on the path down the left edge. In a valid
+ * subtree every path has that many.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+int RBTree<Key, Value, Compare, Alloc>::blackHeight(RBNode<Key,Value>* node)
+{
+    int h = 0;
+    for(; node != NULL; node = node->getLeft()) {
+        if(!node->isRed()) ++h;
+    }
+    return h;
+}
+
+/**
+ * Checks the red-black rules at node: a red node has no red child, the
+ * root is black, and both subtrees hold the same number of blacks on
+ * every path. The last walks down both subtrees, which adds up to
+ * O(n) over a tree of logarithmic height.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+const char* RBTree<Key, Value, Compare, Alloc>::verifyNode(RBNode<Key,Value>* node, int /*leftHeight*/, int /*rightHeight*/) const
+{
+    if(node->isRed() && (node->getParent() == NULL || isRed(node->getLeft()) || isRed(node->getRight()))) {
+        return "red node is the root or has a red child";
+    }
+    if(blackHeight(node->getLeft()) != blackHeight(node->getRight())) {
+        return "subtrees have different black heights";
+    }
+    return NULL;
+}
+
+/**
+ * Colors a bulk-built subtree. Such a tree has all its leaves on its
+ * last two levels, so it is valid with every node black except those
+ * on the last level of the whole tree, when that level is not full.
+ * The depth is not known here, but wherever the children's black
+ * heights differ, the deeper child is still all black and reaches that
+ * last level, so its bottom level is painted red. Each node is painted
+ * at most once, so this adds O(n) to the build.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void RBTree<Key, Value, Compare, Alloc>::initBuiltNode(RBNode<Key,Value>* node, int leftHeight, int rightHeight)
+{
+    node->setRed(false);
+    int leftBlack = blackHeight(node->getLeft());
+    int rightBlack = blackHeight(node->getRight());
+    if(leftBlack > rightBlack) {
+        paintLevelRed(node->getLeft(), leftHeight - 1);
+    }
+    else if(rightBlack > leftBlack) {
+        paintLevelRed(node->getRight(), rightHeight - 1);
+    }
+}
+
+/**
+ * Paints red every node depth levels below node
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void RBTree<Key, Value, Compare, Alloc>::paintLevelRed(RBNode<Key,Value>* node, int depth)
+{
+    std::vector<std::pair<RBNode<Key,Value>*, int> > stack;
+    stack.push_back(std::make_pair(node, 0));
+    while(!stack.empty()) {
+        RBNode<Key,Value>* curr = stack.back().first;
+        int d = stack.back().second;
+        stack.pop_back();
+        if(d == depth) {
+            curr->setRed(true);
+            continue;
+        }
+        if(curr->getLeft() != NULL) stack.push_back(std::make_pair(curr->getLeft(), d + 1));
+        if(curr->getRight() != NULL) stack.push_back(std::make_pair(curr->getRight(), d + 1));
+    }
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void RBTree<Key, Value, Compare, Alloc>::nodeSwap(RBNode<Key,Value>* n1, RBNode<Key,Value>* n2)
+{
+    BinarySearchTree<Key, Value, Compare, Alloc, RBNode<Key, Value> >::nodeSwap(n1, n2);
+    bool tempRed = n1->isRed();
+    n1->setRed(n2->isRed());
+    n2->setRed(tempRed);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RBTree class.
+  -----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef SLABALLOC_H
+#define SLABALLOC_H
+
+#include <cstddef>
+#include <new>
+#include <memory>
+#include <vector>
+
+/**
+* The pages and free list behind a SlabAllocator. It holds raw slots,
+* not objects of any one type, so that allocators rebound to different
+* types can share it.
+*/
+struct SlabPool
+{
+    // A free slot holds the link to the next one
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    SlabPool() : slotSize(0), freeList(NULL), bump(NULL), bumpEnd(NULL) { }
+    ~SlabPool()
+    {
+        for(size_t i = 0; i < pages.size(); ++i) {
+            ::operator delete(pages[i]);
+        }
+    }
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    size_t slotSize;     // 0 until the first slot is handed out
+    std::vector<char*> pages;
+    FreeSlot* freeList;  // slots returned by deallocate
+    char* bump;          // next never-used slot in the newest page
+    char* bumpEnd;
+};
+
+/**
+* A pool allocator for tree nodes. Single objects are carved out of
+* pages of SlotsPerPage slots, so consecutive inserts land next to each
+* other in memory. Freed slots go on a free list and are handed out
+* again in O(1). release() returns every page at once, which lets a
+* tree drop all of its nodes without freeing them one by one.
+*
+* Copies of an allocator share the same pool, and so do allocators
+* rebound from one another, as the standard allocator requirements
+* demand. The pool does not know the type it holds: its slot size is
+* fixed by the first single object allocated from it, and only types
+* with that slot size are carved out of its pages. A tree rebinds its
+* allocator to its node type and never allocates through the original,
+* so trees built on copies of one SlabAllocator, of the item type or
+* the node type, share a pool. A tree only releases the pool in bulk
+* while it is its sole owner (see soleOwner()); otherwise it frees its
+* nodes one at a time. Requests for more than one object, or for an
+* object of another slot size, fall through to operator new.
+*/
+template <typename T, size_t SlotsPerPage = 1024>
+class SlabAllocator
+{
+public:
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef SlabAllocator<U, SlotsPerPage> other;
+    };
+
+    SlabAllocator();
+    template <typename U>
+    SlabAllocator(const SlabAllocator<U, SlotsPerPage>& other);
+
+    T* allocate(size_t n);
+    void deallocate(T* p, size_t n);
+
+    // Frees every page. Any object still living in the pool must
+    // already have been destroyed, so only call it when soleOwner().
+    void release();
+    bool soleOwner() const;
+    size_t pageCount() const;
+
+    bool operator==(const SlabAllocator& rhs) const;
+    bool operator!=(const SlabAllocator& rhs) const;
+
+private:
+    template <typename U, size_t N> friend class SlabAllocator;
+
+    typedef SlabPool Pool;
+    typedef SlabPool::FreeSlot FreeSlot;
+
+    static size_t slotSize();
+    bool fromPool(size_t n) const;
+
+    std::shared_ptr<Pool> pool_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the SlabAllocator class.
+  ---------------------------------------------------
+*/
+
+template <typename T, size_t SlotsPerPage>
+SlabAllocator<T, SlotsPerPage>::SlabAllocator() :
+    pool_(new Pool)
+{
+
+}
+
+/**
+* Rebinding constructor. The new allocator shares other's pool, so
+* either can free what the other allocated.
+*/
+template <typename T, size_t SlotsPerPage>
+template <typename U>
+SlabAllocator<T, SlotsPerPage>::SlabAllocator(const SlabAllocator<U, SlotsPerPage>& other) :
+    pool_(other.pool_)
+{
+
+}
+
+/**
+* The size of a slot holding one T: large enough for the free-list
+* link too, and rounded up so that every slot of a page is aligned.
+*/
+template <typename T, size_t SlotsPerPage>
+size_t SlabAllocator<T, SlotsPerPage>::slotSize()
+{
+    size_t align = alignof(T) > alignof(FreeSlot) ? alignof(T) : alignof(FreeSlot);
+    size_t size = sizeof(T) > sizeof(FreeSlot) ? sizeof(T) : sizeof(FreeSlot);
+    return (size + align - 1) / align * align;
+}
+
+/**
+* True if n objects of type T live in the pool's slots rather than
+* coming from operator new. Fixes the pool's slot size if no slot has
+* been handed out yet; once fixed it never changes, so deallocate
+* always takes the path that allocate took.
+*/
+template <typename T, size_t SlotsPerPage>
+bool SlabAllocator<T, SlotsPerPage>::fromPool(size_t n) const
+{
+    if(n != 1 || alignof(T) > alignof(std::max_align_t)) {
+        return false;
+    }
+    if(pool_->slotSize == 0) {
+        pool_->slotSize = slotSize();
+    }
+    return pool_->slotSize == slotSize();
+}
+
+/**
+* Hands out a free-listed slot if there is one, otherwise the next
+* slot of the current page, starting a new page when it is full.
+*/
+template <typename T, size_t SlotsPerPage>
+T* SlabAllocator<T, SlotsPerPage>::allocate(size_t n)
+{
+    if(!fromPool(n)) {
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    Pool& pool = *pool_;
+    if(pool.freeList != NULL) {
+        FreeSlot* slot = pool.freeList;
+        pool.freeList = slot->next;
+        return reinterpret_cast<T*>(slot);
+    }
+    if(pool.bump == pool.bumpEnd) {
+        char* page = static_cast<char*>(::operator new(SlotsPerPage * pool.slotSize));
+        pool.pages.push_back(page);
+        pool.bump = page;
+        pool.bumpEnd = page + SlotsPerPage * pool.slotSize;
+    }
+    T* slot = reinterpret_cast<T*>(pool.bump);
+    pool.bump += pool.slotSize;
+    return slot;
+}
+
+template <typename T, size_t SlotsPerPage>
+void SlabAllocator<T, SlotsPerPage>::deallocate(T* p, size_t n)
+{
+    if(!fromPool(n)) {
+        ::operator delete(p);
+        return;
+    }
+
+    FreeSlot* slot = reinterpret_cast<FreeSlot*>(p);
+    slot->next = pool_->freeList;
+    pool_->freeList = slot;
+}
+
+template <typename T, size_t SlotsPerPage>
+void SlabAllocator<T, SlotsPerPage>::release()
+{
+    Pool& pool = *pool_;
+    for(size_t i = 0; i < pool.pages.size(); ++i) {
+        ::operator delete(pool.pages[i]);
+    }
+    pool.pages.clear();
+    pool.freeList = NULL;
+    pool.bump = NULL;
+    pool.bumpEnd = NULL;
+}
+
+/**
+* True if no other allocator, copied or the user's own, shares this
+* pool, so that everything in it was allocated through this object.
+*/
+template <typename T, size_t SlotsPerPage>
+bool SlabAllocator<T, SlotsPerPage>::soleOwner() const
+{
+    return pool_.use_count() == 1;
+}
+
+/**
+* The number of pages currently held by the pool.
+*/
+template <typename T, size_t SlotsPerPage>
+size_t SlabAllocator<T, SlotsPerPage>::pageCount() const
+{
+    return pool_->pages.size();
+}
+
+template <typename T, size_t SlotsPerPage>
+bool SlabAllocator<T, SlotsPerPage>::operator==(const SlabAllocator& rhs) const
+{
+    return pool_ == rhs.pool_;
+}
+
+template <typename T, size_t SlotsPerPage>
+bool SlabAllocator<T, SlotsPerPage>::operator!=(const SlabAllocator& rhs) const
+{
+    return pool_ != rhs.pool_;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the SlabAllocator class.
+  -------------------------------------------------
+*/
+
+#endif
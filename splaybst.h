@@ -0,0 +1,285 @@
+#ifndef SPLAYBST_H
+#define SPLAYBST_H
+
+#include "bst.h"
+
+/**
+* A splay tree. find, remove and every form of insert rotate the node
+* they reach to the root, so recently used keys sit a few levels down
+* and a skewed or temporally local workload is served in a handful of
+* hops. There is no balance information: any single operation can cost
+* O(n), but a sequence of m operations costs O(m log n) amortized, and
+* keys accessed often stay near the top.
+*
+* Splaying inserts are insert (every overload), emplace, try_emplace,
+* insert_or_assign and operator[], whether the key is new or already
+* present. Lookups that splay are the non-const find only; the const
+* find, contains, lookup, lower_bound, upper_bound, rank, select and
+* the iterators do not, and neither does the const operator[].
+*
+* The restructuring has two consequences. The non-const find changes
+* the tree, so even lookups must not run concurrently with anything
+* else. And the tree can legitimately be very deep (ascending inserts
+* leave a path), so isBalanced() is usually false; verify().valid still
+* checks order and sizes.
+*
+* Splaying only relinks nodes, so iterators stay valid across it.
+*/
+template <class Key, class Value,
+          class Compare = std::less<Key>,
+          class Alloc = std::allocator<std::pair<const Key, Value> > >
+class SplayTree : public BinarySearchTree<Key, Value, Compare, Alloc, Node<Key, Value> >
+{
+public:
+    typedef typename BinarySearchTree<Key, Value, Compare, Alloc, Node<Key, Value> >::iterator iterator;
+
+    SplayTree();
+    explicit SplayTree(const Compare& comp);
+    SplayTree(const Compare& comp, const Alloc& alloc);
+    template<typename ForwardIt>
+    SplayTree(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
+
+    using BinarySearchTree<Key, Value, Compare, Alloc, Node<Key, Value> >::find;
+    iterator find(const Key& key);
+    virtual void remove(const Key& key);
+
+protected:
+    virtual void afterInsert(Node<Key,Value>* node);
+    virtual void afterHit(Node<Key,Value>* node);
+
+    void splay(Node<Key,Value>* x);
+    void rotateLeft(Node<Key,Value>* x);
+    void rotateRight(Node<Key,Value>* x);
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the SplayTree class.
+  -------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare, class Alloc>
+SplayTree<Key, Value, Compare, Alloc>::SplayTree()
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+SplayTree<Key, Value, Compare, Alloc>::SplayTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare, Alloc, Node<Key, Value> >(comp)
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+SplayTree<Key, Value, Compare, Alloc>::SplayTree(const Compare& comp, const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Compare, Alloc, Node<Key, Value> >(comp, alloc)
+{
+
+}
+
+/**
+ * Builds the tree from a range in O(n) if it is sorted. A splay tree
+ * keeps nothing per node, so the base constructor's build is enough.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+template<typename ForwardIt>
+SplayTree<Key, Value, Compare, Alloc>::SplayTree(ForwardIt first, ForwardIt last, const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare, Alloc, Node<Key, Value> >(first, last, comp)
+{
+
+}
+
+/**
+ * Looks key up and splays the node found to the root. A miss splays
+ * the last node on the search path instead, so the neighbourhood of a
+ * repeatedly missed key gets cheap too.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+typename SplayTree<Key, Value, Compare, Alloc>::iterator
+SplayTree<Key, Value, Compare, Alloc>::find(const Key& key)
+{
+    Node<Key,Value>* parent;
+    bool left;
+    Node<Key,Value>* node = this->findInsertPos(key, parent, left);
+    if(node != NULL) {
+        splay(node);
+    }
+    else if(parent != NULL) {
+        splay(parent);
+    }
+    return this->makeIterator(node);
+}
+
+/**
+ * Called by BinarySearchTree with every newly linked node.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void SplayTree<Key, Value, Compare, Alloc>::afterInsert(Node<Key,Value>* node)
+{
+    this->adjustSizes(node->getParent(), 1);
+    splay(node);
+}
+
+/**
+ * Called by BinarySearchTree when an insert finds its key already
+ * present, so that updating a key splays it like inserting one.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void SplayTree<Key, Value, Compare, Alloc>::afterHit(Node<Key,Value>* node)
+{
+    splay(node);
+}
+
+/**
+ * Splays the node to the root and joins its two subtrees: the largest
+ * node on the left is splayed to the top of that subtree, where it has
+ * no right child, and takes the right subtree there. A missing key
+ * splays the last node on its search path, as find() does.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void SplayTree<Key, Value, Compare, Alloc>::remove(const Key& key)
+{
+    Node<Key,Value>* parent;
+    bool left;
+    Node<Key,Value>* node = this->findInsertPos(key, parent, left);
+    if(node == NULL) {
+        if(parent != NULL) splay(parent);
+        return;
+    }
+
+    splay(node);
+    Node<Key,Value>* l = node->getLeft();
+    Node<Key,Value>* r = node->getRight();
+    if(l == NULL) {
+        this->root_ = r;
+        if(r != NULL) r->setParent(NULL);
+    }
+    else {
+        l->setParent(NULL);
+        this->root_ = l;
+        Node<Key,Value>* max = l;
+        while(max->getRight() != NULL) max = max->getRight();
+        splay(max);
+        max->setRight(r);
+        if(r != NULL) r->setParent(max);
+        this->updateSize(max);
+    }
+    this->destroyNode(node);
+}
+
+/**
+ * Rotates x to the root. Where x and its parent are children on the
+ * same side (zig-zig) the grandparent is rotated first; that, rather
+ * than rotating x up one level at a time, is what roughly halves the
+ * depth of every node on the path and gives the amortized bound.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void SplayTree<Key, Value, Compare, Alloc>::splay(Node<Key,Value>* x)
+{
+    while(x->getParent() != NULL) {
+        Node<Key,Value>* p = x->getParent();
+        Node<Key,Value>* g = p->getParent();
+        bool xLeft = (x == p->getLeft());
+
+        if(g == NULL) {
+            // zig
+            if(xLeft) rotateRight(p);
+            else rotateLeft(p);
+        }
+        else if(xLeft == (p == g->getLeft())) {
+            // zig-zig
+            if(xLeft) {
+                rotateRight(g);
+                rotateRight(p);
+            }
+            else {
+                rotateLeft(g);
+                rotateLeft(p);
+            }
+        }
+        else {
+            // zig-zag
+            if(xLeft) {
+                rotateRight(p);
+                rotateLeft(g);
+            }
+            else {
+                rotateLeft(p);
+                rotateRight(g);
+            }
+        }
+    }
+}
+
+/**
+ * Rotations relink pointers and fix the two subtree sizes that change,
+ * as in AVLTree.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void SplayTree<Key, Value, Compare, Alloc>::rotateLeft(Node<Key,Value>* x)
+{
+    Node<Key,Value>* y = x->getRight();
+    Node<Key,Value>* p = x->getParent();
+    Node<Key,Value>* B = y->getLeft();
+
+    y->setParent(p);
+    if(p == NULL) {
+        this->root_ = y;
+    }
+    else if(x == p->getLeft()) {
+        p->setLeft(y);
+    }
+    else {
+        p->setRight(y);
+    }
+
+    y->setLeft(x);
+    x->setParent(y);
+
+    x->setRight(B);
+    if(B != NULL) {
+        B->setParent(x);
+    }
+
+    this->updateSize(x);
+    this->updateSize(y);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void SplayTree<Key, Value, Compare, Alloc>::rotateRight(Node<Key,Value>* x)
+{
+    Node<Key,Value>* y = x->getLeft();
+    Node<Key,Value>* p = x->getParent();
+    Node<Key,Value>* B = y->getRight();
+
+    y->setParent(p);
+    if(p == NULL) {
+        this->root_ = y;
+    }
+    else if(x == p->getLeft()) {
+        p->setLeft(y);
+    }
+    else {
+        p->setRight(y);
+    }
+
+    y->setRight(x);
+    x->setParent(y);
+
+    x->setLeft(B);
+    if(B != NULL) {
+        B->setParent(x);
+    }
+
+    this->updateSize(x);
+    this->updateSize(y);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the SplayTree class.
+  -----------------------------------------------
+*/
+
+#endif
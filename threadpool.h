@@ -0,0 +1,321 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* A small work-stealing thread pool for fork/join style parallel loops.
+* Every worker has its own task queue. A worker takes new work from the
+* back of its own queue and, when that is empty, steals from the front
+* of the others', so a worker that finishes early takes over work from
+* busy ones. Threads outside the pool share one extra queue.
+*
+* Tasks are added to a TaskGroup, and whoever waits on the group runs
+* queued tasks itself until the group is done. The waiting thread
+* therefore counts as one more worker, and by default the pool starts
+* one thread fewer than there are hardware threads.
+*/
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(unsigned threads = 0);
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Number of worker threads, not counting threads that wait
+    unsigned size() const;
+
+    // The calling thread's queue: 0..size()-1 in a worker, else size()
+    unsigned currentSlot() const;
+
+    // A pool sized for the machine, started on first use
+    static WorkStealingPool& shared();
+
+    /**
+    * A set of tasks that can be waited for together. The first
+    * exception a task throws is kept and rethrown by wait().
+    */
+    class TaskGroup
+    {
+    public:
+        explicit TaskGroup(WorkStealingPool& pool);
+        ~TaskGroup();
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        void run(std::function<void()> task);
+        void wait();
+
+    private:
+        friend class WorkStealingPool;
+        void help();
+
+        WorkStealingPool& pool_;
+        std::atomic<size_t> pending_;
+        std::mutex errorLock_;
+        std::exception_ptr error_;
+    };
+
+private:
+    struct Task
+    {
+        std::function<void()> run;
+        TaskGroup* group;
+    };
+
+    // Padded rather than aligned: C++11 new ignores extended alignment
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+        char pad[64];
+    };
+
+    struct ThreadSlot
+    {
+        const WorkStealingPool* pool;
+        unsigned index;
+    };
+
+    static ThreadSlot& threadSlot();
+    void push(Task& task);
+    bool take(unsigned slot, bool back, Task& task);
+    bool runOne(unsigned self);
+    void workerLoop(unsigned index);
+
+    std::vector<std::unique_ptr<Queue> > queues_;  // one per worker, then the shared one
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> queued_;
+    std::atomic<unsigned> nextQueue_;
+    std::mutex sleepLock_;
+    std::condition_variable wake_;
+    bool stopping_;
+};
+
+/*
+----------------------------------------------------
+Begin implementations for the WorkStealingPool class.
+----------------------------------------------------
+*/
+
+/**
+* Starts threads workers, or one fewer than the hardware threads if
+* threads is 0. A pool of no workers runs every task in the thread that
+* waits for it.
+*/
+inline WorkStealingPool::WorkStealingPool(unsigned threads) :
+    queued_(0),
+    nextQueue_(0),
+    stopping_(false)
+{
+    if(threads == 0) {
+        unsigned hardware = std::thread::hardware_concurrency();
+        threads = hardware > 1 ? hardware - 1 : 0;
+    }
+    for(unsigned i = 0; i <= threads; ++i) queues_.push_back(std::unique_ptr<Queue>(new Queue));
+    try {
+        for(unsigned i = 0; i < threads; ++i) workers_.push_back(std::thread(&WorkStealingPool::workerLoop, this, i));
+    }
+    catch(...) {
+        {
+            std::lock_guard<std::mutex> lock(sleepLock_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for(size_t i = 0; i < workers_.size(); ++i) workers_[i].join();
+        throw;
+    }
+}
+
+/**
+* No TaskGroup may still be running tasks on the pool
+*/
+inline WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepLock_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for(size_t i = 0; i < workers_.size(); ++i) workers_[i].join();
+}
+
+inline unsigned WorkStealingPool::size() const
+{
+    return static_cast<unsigned>(workers_.size());
+}
+
+inline WorkStealingPool& WorkStealingPool::shared()
+{
+    static WorkStealingPool pool;
+    return pool;
+}
+
+inline WorkStealingPool::ThreadSlot& WorkStealingPool::threadSlot()
+{
+    static thread_local ThreadSlot slot = { NULL, 0 };
+    return slot;
+}
+
+inline unsigned WorkStealingPool::currentSlot() const
+{
+    const ThreadSlot& slot = threadSlot();
+    return slot.pool == this ? slot.index : size();
+}
+
+/**
+* A worker queues onto its own queue. Other threads deal their tasks
+* out round robin, so that every worker starts with a share.
+*/
+inline void WorkStealingPool::push(Task& task)
+{
+    unsigned slot = currentSlot();
+    if(slot == size() && size() > 0) {
+        slot = nextQueue_.fetch_add(1, std::memory_order_relaxed) % size();
+    }
+    // Counted first, so that the count never runs below the tasks queued
+    queued_.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(queues_[slot]->lock);
+        queues_[slot]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepLock_);
+    }
+    wake_.notify_one();
+}
+
+inline bool WorkStealingPool::take(unsigned slot, bool back, Task& task)
+{
+    Queue& queue = *queues_[slot];
+    std::lock_guard<std::mutex> lock(queue.lock);
+    if(queue.tasks.empty()) return false;
+    if(back) {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+    }
+    else {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+    }
+    return true;
+}
+
+/**
+* Runs one task: the newest of the caller's own queue, or else the
+* oldest of another queue. Returns false if every queue was empty.
+*/
+inline bool WorkStealingPool::runOne(unsigned self)
+{
+    Task task;
+    bool found = take(self, true, task);
+    for(size_t i = 1; !found && i < queues_.size(); ++i) {
+        found = take(static_cast<unsigned>((self + i) % queues_.size()), false, task);
+    }
+    if(!found) return false;
+    queued_.fetch_sub(1);
+
+    try {
+        task.run();
+    }
+    catch(...) {
+        std::lock_guard<std::mutex> lock(task.group->errorLock_);
+        if(!task.group->error_) task.group->error_ = std::current_exception();
+    }
+    task.group->pending_.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+inline void WorkStealingPool::workerLoop(unsigned index)
+{
+    ThreadSlot& slot = threadSlot();
+    slot.pool = this;
+    slot.index = index;
+    while(true) {
+        if(runOne(index)) continue;
+        std::unique_lock<std::mutex> lock(sleepLock_);
+        wake_.wait(lock, [this]() { return stopping_ || queued_.load() > 0; });
+        if(stopping_ && queued_.load() == 0) return;
+    }
+}
+
+/*
+--------------------------------------------------
+End implementations for the WorkStealingPool class.
+--------------------------------------------------
+*/
+
+/*
+-------------------------------------------------------------
+Begin implementations for the WorkStealingPool::TaskGroup class.
+-------------------------------------------------------------
+*/
+
+inline WorkStealingPool::TaskGroup::TaskGroup(WorkStealingPool& pool) :
+    pool_(pool),
+    pending_(0)
+{
+
+}
+
+/**
+* Waits for tasks still running, dropping any exception
+*/
+inline WorkStealingPool::TaskGroup::~TaskGroup()
+{
+    help();
+}
+
+inline void WorkStealingPool::TaskGroup::run(std::function<void()> task)
+{
+    Task queued = { std::move(task), this };
+    pending_.fetch_add(1);
+    try {
+        pool_.push(queued);
+    }
+    catch(...) {
+        pending_.fetch_sub(1);
+        throw;
+    }
+}
+
+/**
+* Runs queued tasks, this group's or others', until every task of this
+* group is done, then rethrows the first exception one of them threw
+*/
+inline void WorkStealingPool::TaskGroup::wait()
+{
+    help();
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(errorLock_);
+        error.swap(error_);
+    }
+    if(error) std::rethrow_exception(error);
+}
+
+inline void WorkStealingPool::TaskGroup::help()
+{
+    unsigned self = pool_.currentSlot();
+    while(pending_.load(std::memory_order_acquire) != 0) {
+        if(!pool_.runOne(self)) std::this_thread::yield();
+    }
+}
+
+/*
+-----------------------------------------------------------
+End implementations for the WorkStealingPool::TaskGroup class.
+-----------------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef TREEIO_H
+#define TREEIO_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <unistd.h>
+
+/**
+* The binary snapshot format written by BinarySearchTree::save():
+*
+*   header   magic "BSTS", then uint32 version, byte order mark,
+*            codec tag, sizeof(Key) and sizeof(Value), and a uint64
+*            item count, all in host byte order
+*   items    count key/value pairs in ascending key order, each
+*            encoded by the codec
+*
+* Snapshots are meant to be read back on the platform that wrote them;
+* load() rejects any header whose byte order, sizes or codec differ.
+*/
+struct SnapshotHeader
+{
+    static const uint32_t Version = 1;
+    static const uint32_t ByteOrderMark = 0x01020304;
+
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t codecTag;
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint64_t count;
+};
+
+/**
+* The default snapshot codec. Trivially copyable types are stored as
+* their raw bytes and std::string as a uint64 length and its bytes.
+* Any other key or value type needs a codec of its own, a class with
+* the same members: a distinct Tag, and write/read for both the key and
+* the value type. read is called as codec.template read<T>(in) and
+* throws, or sets the stream's failbit, on bad input.
+*/
+struct BinaryCodec
+{
+    static const uint32_t Tag = 1;
+
+    template<typename T>
+    void write(std::ostream& out, const T& value) const
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "BinaryCodec stores only trivially copyable types and std::string; pass a codec");
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void write(std::ostream& out, const std::string& value) const
+    {
+        uint64_t size = value.size();
+        out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        out.write(value.data(), value.size());
+    }
+
+    template<typename T>
+    typename std::enable_if<!std::is_same<T, std::string>::value, T>::type read(std::istream& in) const
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "BinaryCodec stores only trivially copyable types and std::string; pass a codec");
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type bytes;
+        in.read(reinterpret_cast<char*>(&bytes), sizeof(T));
+        return *reinterpret_cast<const T*>(&bytes);
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_same<T, std::string>::value, T>::type read(std::istream& in) const
+    {
+        uint64_t size = 0;
+        in.read(reinterpret_cast<char*>(&size), sizeof(size));
+        std::string value;
+        // Read in bounded pieces, so a corrupt length fails at the end
+        // of the stream instead of allocating it up front
+        char piece[4096];
+        while(in && size > 0) {
+            size_t n = size < sizeof(piece) ? static_cast<size_t>(size) : sizeof(piece);
+            in.read(piece, n);
+            value.append(piece, static_cast<size_t>(in.gcount()));
+            size -= n;
+        }
+        return value;
+    }
+};
+
+/**
+* CRC-32 (the IEEE polynomial used by zlib and Ethernet) of size bytes,
+* for telling a whole record from one torn by a crash
+*/
+inline uint32_t crc32(const char* data, size_t size)
+{
+    struct Table
+    {
+        uint32_t entries[256];
+        Table()
+        {
+            for(uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for(int bit = 0; bit < 8; ++bit) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                entries[i] = c;
+            }
+        }
+    };
+    static const Table table;
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for(size_t i = 0; i < size; ++i) {
+        crc = table.entries[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/**
+* A stream buffer that appends everything written to it to a string, so
+* a codec can encode a record in memory before it is framed
+*/
+class StringAppendBuf : public std::streambuf
+{
+public:
+    explicit StringAppendBuf(std::string& out) : out_(out) { }
+
+protected:
+    int_type overflow(int_type ch)
+    {
+        if(!traits_type::eq_int_type(ch, traits_type::eof())) out_.push_back(traits_type::to_char_type(ch));
+        return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n)
+    {
+        out_.append(s, static_cast<size_t>(n));
+        return n;
+    }
+
+private:
+    std::string& out_;
+};
+
+/**
+* A stream buffer that reads from bytes held elsewhere, e.g. a record
+* already checked and ready to decode. reset() points it at new bytes.
+*/
+class MemoryReadBuf : public std::streambuf
+{
+public:
+    void reset(const char* data, size_t size)
+    {
+        char* begin = const_cast<char*>(data);
+        setg(begin, begin, begin + size);
+    }
+};
+
+/**
+* A buffered stream buffer over a POSIX file descriptor, so snapshots
+* can be written to and read from sockets, pipes and open files. The
+* descriptor is not closed. Reading buffers ahead, so the descriptor's
+* offset may end up past the last byte consumed.
+*/
+class FdStreamBuf : public std::streambuf
+{
+public:
+    explicit FdStreamBuf(int fd);
+    ~FdStreamBuf();
+
+    static const size_t BufferSize = 1 << 16;
+
+protected:
+    int_type overflow(int_type ch);
+    int sync();
+    int_type underflow();
+
+private:
+    bool flushOut();
+
+    int fd_;
+    std::vector<char> out_;
+    std::vector<char> in_;
+};
+
+/*
+-----------------------------------------------
+Begin implementations for the FdStreamBuf class.
+-----------------------------------------------
+*/
+
+inline FdStreamBuf::FdStreamBuf(int fd) :
+    fd_(fd),
+    out_(BufferSize),
+    in_(BufferSize)
+{
+    setp(&out_[0], &out_[0] + out_.size());
+    setg(&in_[0], &in_[0], &in_[0]);
+}
+
+/**
+* Writes out whatever is still buffered; errors are lost here, so
+* callers that care call pubsync() first
+*/
+inline FdStreamBuf::~FdStreamBuf()
+{
+    flushOut();
+}
+
+inline bool FdStreamBuf::flushOut()
+{
+    const char* p = pbase();
+    while(p < pptr()) {
+        ssize_t written = ::write(fd_, p, pptr() - p);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        p += written;
+    }
+    setp(&out_[0], &out_[0] + out_.size());
+    return true;
+}
+
+inline FdStreamBuf::int_type FdStreamBuf::overflow(int_type ch)
+{
+    if(!flushOut()) return traits_type::eof();
+    if(!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+inline int FdStreamBuf::sync()
+{
+    return flushOut() ? 0 : -1;
+}
+
+inline FdStreamBuf::int_type FdStreamBuf::underflow()
+{
+    if(gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    ssize_t got;
+    do {
+        got = ::read(fd_, &in_[0], in_.size());
+    } while(got < 0 && errno == EINTR);
+    if(got <= 0) return traits_type::eof();
+    setg(&in_[0], &in_[0], &in_[0] + got);
+    return traits_type::to_int_type(*gptr());
+}
+
+/*
+---------------------------------------------
+End implementations for the FdStreamBuf class.
+---------------------------------------------
+*/
+
+#endif